@@ -346,8 +346,8 @@ void CL_FinishTimeDemo(void)
         time = 1;
     }
 
-    Con_Printf("%i frames %5.1f seconds %5.1f fps\n", frames, time,
-        frames / time);
+    Con_Printf("%i frames %5.1f seconds %5.1f fps (%s spans)\n", frames, time,
+        frames / time, D_SpanKernelName());
 }
 
 /*
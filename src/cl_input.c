@@ -536,6 +536,14 @@ void CL_SendMove(usercmd_t* cmd)
     MSG_WriteByte(&buf, cmd->lightlevel);
 #endif
 
+    //
+    // let the server send the next updates against the newest frame we have
+    //
+    if (cl.deltasequence) {
+        MSG_WriteByte(&buf, clc_ackframe);
+        MSG_WriteLong(&buf, cl.deltasequence);
+    }
+
     //
     // deliver the message
     //
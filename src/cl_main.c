@@ -30,6 +30,7 @@ cvar_t cl_color = { "_cl_color", "0", true };
 
 cvar_t cl_shownet = { "cl_shownet", "0" }; // can be 0, 1, or 2
 cvar_t cl_nolerp = { "cl_nolerp", "0" };
+cvar_t cl_deltaents = { "cl_deltaents", "1" }; // ask servers for delta compressed entity updates
 
 cvar_t lookspring = { "lookspring", "0", true };
 cvar_t lookstrafe = { "lookstrafe", "0", true };
@@ -43,7 +44,8 @@ cvar_t m_side = { "m_side", "0.8", true };
 client_static_t cls;
 client_state_t cl;
 
-entity_t cl_entities[MAX_EDICTS];
+entity_t* cl_entities;
+int cl_max_edicts;
 entity_t cl_static_entities[MAX_STATIC_ENTITIES];
 lightstyle_t cl_lightstyle[MAX_LIGHTSTYLES];
 dlight_t cl_dlights[MAX_DLIGHTS];
@@ -73,7 +75,7 @@ void CL_ClearState(void)
     SZ_Clear(&cls.message);
 
     // clear other arrays
-    memset(cl_entities, 0, sizeof(cl_entities));
+    memset(cl_entities, 0, cl_max_edicts * sizeof(*cl_entities));
     memset(cl_dlights, 0, sizeof(cl_dlights));
     memset(cl_lightstyle, 0, sizeof(cl_lightstyle));
     memset(cl_temp_entities, 0, sizeof(cl_temp_entities));
@@ -177,6 +179,12 @@ void CL_SignonReply(void)
 
     switch (cls.signon) {
     case 1:
+        // stock engines can't read svc_deltaframe, so demos don't get it
+        if (cl_deltaents.value && !cls.demorecording) {
+            MSG_WriteByte(&cls.message, clc_stringcmd);
+            MSG_WriteString(&cls.message, "deltaents");
+        }
+
         MSG_WriteByte(&cls.message, clc_stringcmd);
         MSG_WriteString(&cls.message, "prespawn");
         break;
@@ -660,6 +668,8 @@ void CL_Init(void)
 {
     SZ_Alloc(&cls.message, 1024);
 
+    CL_GrowEntities(MAX_EDICTS);
+
     CL_InitInput();
     CL_InitTEnts();
 
@@ -678,6 +688,7 @@ void CL_Init(void)
     Cvar_RegisterVariable(&cl_anglespeedkey);
     Cvar_RegisterVariable(&cl_shownet);
     Cvar_RegisterVariable(&cl_nolerp);
+    Cvar_RegisterVariable(&cl_deltaents);
     Cvar_RegisterVariable(&lookspring);
     Cvar_RegisterVariable(&lookstrafe);
     Cvar_RegisterVariable(&sensitivity);
@@ -52,11 +52,48 @@ char* svc_strings[] = {
     "svc_foundsecret", "svc_spawnstaticsound", "svc_intermission",
     "svc_finale",  // [string] music [string] text
     "svc_cdtrack", // [byte] track [byte] looptrack
-    "svc_sellscreen", "svc_cutscene"
+    "svc_sellscreen", "svc_cutscene",
+    "svc_deltaframe" // [long] sequence [long] frame the updates are against
 };
 
 //=============================================================================
 
+/*
+===============
+CL_GrowEntities
+
+Makes room for at least count entities.  The array is kept from map to map,
+so it only ever reaches the largest -edicts of the servers seen.
+===============
+*/
+void CL_GrowEntities(int count)
+{
+    int newmax;
+    entity_t* ents;
+
+    if (count <= cl_max_edicts) {
+        return;
+    }
+
+    newmax = cl_max_edicts ? cl_max_edicts : MAX_EDICTS;
+    while (newmax < count) {
+        newmax *= 2;
+    }
+
+    if (newmax > MAX_EDICTS_LIMIT) {
+        newmax = MAX_EDICTS_LIMIT;
+    }
+
+    ents = realloc(cl_entities, newmax * sizeof(*cl_entities));
+    if (!ents) {
+        Sys_Error("CL_GrowEntities: couldn't allocate %i entities", newmax);
+    }
+
+    memset(ents + cl_max_edicts, 0, (newmax - cl_max_edicts) * sizeof(*ents));
+    cl_entities = ents;
+    cl_max_edicts = newmax;
+}
+
 /*
 ===============
 CL_EntityNum
@@ -67,10 +104,14 @@ This error checks and tracks the total number of entities
 entity_t* CL_EntityNum(int num)
 {
     if (num >= cl.num_entities) {
-        if (num >= MAX_EDICTS) {
+        if (num >= MAX_EDICTS_LIMIT) {
             Host_Error("CL_EntityNum: %i is an invalid number", num);
         }
 
+        // nothing holds on to entity pointers from one message to the next,
+        // cl_visedicts is only built afterwards in CL_RelinkEntities
+        CL_GrowEntities(num + 1);
+
         while (cl.num_entities <= num) {
             cl_entities[cl.num_entities].colormap = vid.colormap;
             cl.num_entities++;
@@ -109,13 +150,13 @@ void CL_ParseStartSoundPacket(void)
         attenuation = DEFAULT_SOUND_PACKET_ATTENUATION;
     }
 
-    channel = MSG_ReadShort();
+    channel = (unsigned short)MSG_ReadShort(); // entities past 4095 set the top bit
     sound_num = MSG_ReadByte();
 
     ent = channel >> 3;
     channel &= 7;
 
-    if (ent > MAX_EDICTS) {
+    if (ent >= MAX_EDICTS_LIMIT) {
         Host_Error("CL_ParseStartSoundPacket: ent = %i", ent);
     }
 
@@ -230,6 +271,9 @@ void CL_ParseServerInfo(void)
 
     cl.scores = Hunk_AllocName(cl.maxclients * sizeof(*cl.scores), "scores");
 
+    // demos can have delta frames even if cl_deltaents is off now
+    cl.deltaframes = Hunk_AllocName(UPDATE_BACKUP * sizeof(*cl.deltaframes), "deltaframes");
+
     // parse gametype
     cl.gametype = MSG_ReadByte();
 
@@ -336,6 +380,9 @@ void CL_ParseUpdate(int bits)
     qboolean forcelink;
     entity_t* ent;
     int num;
+    int colormap;
+    entity_state_t* base;
+    packetentity_t* pe;
 
     if (cls.signon == SIGNONS - 1) { // first update is the final signon stage
         cls.signon = SIGNONS;
@@ -355,6 +402,25 @@ void CL_ParseUpdate(int bits)
 
     ent = CL_EntityNum(num);
 
+    // fields that aren't sent are as they were in the frame the server named,
+    // or the baseline if the entity wasn't in it; updates come in entity order
+    base = &ent->baseline;
+    if (cl.deltafrom) {
+        while (cl.deltafromindex < cl.deltafrom->numentities && cl.deltafrom->entities[cl.deltafromindex].number < num) {
+            cl.deltafromindex++;
+        }
+
+        if (cl.deltafromindex < cl.deltafrom->numentities && cl.deltafrom->entities[cl.deltafromindex].number == num) {
+            base = &cl.deltafrom->entities[cl.deltafromindex].state;
+        }
+    }
+
+    pe = NULL;
+    if (cl.deltato && cl.deltato->numentities < MAX_PACKET_ENTITIES) {
+        pe = &cl.deltato->entities[cl.deltato->numentities++];
+        pe->number = num;
+    }
+
     for (i = 0; i < 16; i++) {
         if (bits & (1 << i)) {
             bitcounts[i]++;
@@ -375,7 +441,7 @@ void CL_ParseUpdate(int bits)
             Host_Error("CL_ParseModel: bad modnum");
         }
     } else {
-        modnum = ent->baseline.modelindex;
+        modnum = base->modelindex;
     }
 
     model = cl.model_precache[modnum];
@@ -404,15 +470,17 @@ void CL_ParseUpdate(int bits)
     if (bits & U_FRAME) {
         ent->frame = MSG_ReadByte();
     } else {
-        ent->frame = ent->baseline.frame;
+        ent->frame = base->frame;
     }
 
     if (bits & U_COLORMAP) {
         i = MSG_ReadByte();
     } else {
-        i = ent->baseline.colormap;
+        i = base->colormap;
     }
 
+    colormap = i;
+
     if (!i) {
         ent->colormap = vid.colormap;
     } else {
@@ -427,7 +495,7 @@ void CL_ParseUpdate(int bits)
     if (bits & U_SKIN) {
         skin = MSG_ReadByte();
     } else {
-        skin = ent->baseline.skin;
+        skin = base->skin;
     }
 
     if (skin != ent->skinnum) {
@@ -442,7 +510,7 @@ void CL_ParseUpdate(int bits)
     if (bits & U_SKIN) {
         ent->skinnum = MSG_ReadByte();
     } else {
-        ent->skinnum = ent->baseline.skin;
+        ent->skinnum = base->skin;
     }
 
 #endif
@@ -450,7 +518,7 @@ void CL_ParseUpdate(int bits)
     if (bits & U_EFFECTS) {
         ent->effects = MSG_ReadByte();
     } else {
-        ent->effects = ent->baseline.effects;
+        ent->effects = base->effects;
     }
 
     // shift the known values for interpolation
@@ -460,37 +528,48 @@ void CL_ParseUpdate(int bits)
     if (bits & U_ORIGIN1) {
         ent->msg_origins[0][0] = MSG_ReadCoord();
     } else {
-        ent->msg_origins[0][0] = ent->baseline.origin[0];
+        ent->msg_origins[0][0] = base->origin[0];
     }
 
     if (bits & U_ANGLE1) {
         ent->msg_angles[0][0] = MSG_ReadAngle();
     } else {
-        ent->msg_angles[0][0] = ent->baseline.angles[0];
+        ent->msg_angles[0][0] = base->angles[0];
     }
 
     if (bits & U_ORIGIN2) {
         ent->msg_origins[0][1] = MSG_ReadCoord();
     } else {
-        ent->msg_origins[0][1] = ent->baseline.origin[1];
+        ent->msg_origins[0][1] = base->origin[1];
     }
 
     if (bits & U_ANGLE2) {
         ent->msg_angles[0][1] = MSG_ReadAngle();
     } else {
-        ent->msg_angles[0][1] = ent->baseline.angles[1];
+        ent->msg_angles[0][1] = base->angles[1];
     }
 
     if (bits & U_ORIGIN3) {
         ent->msg_origins[0][2] = MSG_ReadCoord();
     } else {
-        ent->msg_origins[0][2] = ent->baseline.origin[2];
+        ent->msg_origins[0][2] = base->origin[2];
     }
 
     if (bits & U_ANGLE3) {
         ent->msg_angles[0][2] = MSG_ReadAngle();
     } else {
-        ent->msg_angles[0][2] = ent->baseline.angles[2];
+        ent->msg_angles[0][2] = base->angles[2];
+    }
+
+    // keep what we now hold for the server to send the next updates against
+    if (pe) {
+        pe->state.modelindex = modnum;
+        pe->state.frame = ent->frame;
+        pe->state.colormap = colormap;
+        pe->state.skin = ent->skinnum;
+        pe->state.effects = ent->effects;
+        VectorCopy(ent->msg_origins[0], pe->state.origin);
+        VectorCopy(ent->msg_angles[0], pe->state.angles);
     }
 
     if (bits & U_NOLERP) {
@@ -506,6 +585,47 @@ void CL_ParseUpdate(int bits)
     }
 }
 
+/*
+==================
+CL_ParseDeltaFrame
+
+The entity updates in the rest of the message are against the frame the
+server names, and are kept as the new frame for it to name later.  If the
+named frame is gone the updates are taken against the baselines and not
+kept or acknowledged, so the server soon falls back to the baselines too.
+==================
+*/
+void CL_ParseDeltaFrame(void)
+{
+    int sequence, from;
+
+    if (!cl.deltaframes) {
+        Host_Error("CL_ParseDeltaFrame: no serverinfo");
+    }
+
+    sequence = MSG_ReadLong();
+    from = MSG_ReadLong();
+
+    cl.deltafrom = NULL;
+    cl.deltafromindex = 0;
+    cl.deltato = NULL;
+
+    if (from) {
+        cl.deltafrom = &cl.deltaframes[from & UPDATE_MASK];
+        if (cl.deltafrom->sequence != from) {
+            Con_DPrintf("CL_ParseDeltaFrame: frame %i is gone\n", from);
+            cl.deltafrom = NULL;
+
+            return;
+        }
+    }
+
+    cl.deltato = &cl.deltaframes[sequence & UPDATE_MASK];
+    cl.deltato->sequence = sequence;
+    cl.deltato->numentities = 0;
+    cl.deltasequence = sequence;
+}
+
 /*
 ==================
 CL_ParseBaseline
@@ -753,6 +873,8 @@ void CL_ParseServerMessage(void)
     }
 
     cl.onground = false; // unless the server says otherwise
+    cl.deltafrom = NULL; // unless an svc_deltaframe says otherwise
+    cl.deltato = NULL;
                          //
                          // parse the message
                          //
@@ -795,6 +917,10 @@ void CL_ParseServerMessage(void)
             cl.mtime[0] = MSG_ReadFloat();
             break;
 
+        case svc_deltaframe:
+            CL_ParseDeltaFrame();
+            break;
+
         case svc_clientdata:
             i = MSG_ReadShort();
             CL_ParseClientdata(i);
@@ -214,6 +214,13 @@ typedef struct {
     // frag scoreboard
     scoreboard_t* scores; // [cl.maxclients]
 
+    // delta compressed entity updates
+    packetframe_t* deltaframes; // [UPDATE_BACKUP]
+    packetframe_t* deltafrom;   // this message's updates are against, NULL for the baselines
+    packetframe_t* deltato;     // this message's updates are kept in, NULL to not keep them
+    int deltafromindex;         // next entity to look at in deltafrom
+    int deltasequence;          // newest frame kept, acknowledged with every move
+
 #ifdef QUAKE2
     // light level at player's position including dlights
     // this is sent back to the server each frame
@@ -227,6 +234,7 @@ typedef struct {
 //
 extern cvar_t cl_name;
 extern cvar_t cl_color;
+extern cvar_t cl_deltaents;
 
 extern cvar_t cl_upspeed;
 extern cvar_t cl_forwardspeed;
@@ -260,7 +268,8 @@ extern cvar_t m_side;
 
 extern client_state_t cl;
 
-extern entity_t cl_entities[MAX_EDICTS];
+extern entity_t* cl_entities; // [cl_max_edicts], grows as higher numbers arrive
+extern int cl_max_edicts;
 extern entity_t cl_static_entities[MAX_STATIC_ENTITIES];
 extern lightstyle_t cl_lightstyle[MAX_LIGHTSTYLES];
 extern dlight_t cl_dlights[MAX_DLIGHTS];
@@ -335,6 +344,7 @@ void CL_TimeDemo_f(void);
 //
 void CL_ParseServerMessage(void);
 void CL_NewTranslation(int slot);
+void CL_GrowEntities(int count);
 
 //
 // view
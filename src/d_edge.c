@@ -26,7 +26,7 @@ static int miplevel;
 
 float scale_for_mip;
 extern int screenwidth;
-int ubasestep, errorterm, erroradjustup, erroradjustdown;
+THREAD_LOCAL int ubasestep, errorterm, erroradjustup, erroradjustdown;
 int vstartscan;
 
 // FIXME: should go away
@@ -35,6 +35,8 @@ extern void R_TransformFrustum(void);
 
 vec3_t transformed_modelorg;
 
+surfgrad_t* d_surfgrads;
+
 /*
 ==============
 D_DrawPoly
@@ -74,20 +76,19 @@ int D_MipLevelForScale(float scale)
 
 /*
 ==============
-D_DrawSolidSurface
+D_DrawSolidSpans
 ==============
 */
 
 // FIXME: clean this up
 
-void D_DrawSolidSurface(surf_t* surf, int color)
+void D_DrawSolidSpans(espan_t* span, int color)
 {
-    espan_t* span;
     byte* pdest;
     int u, u2, pix;
 
     pix = (color << 24) | (color << 16) | (color << 8) | color;
-    for (span = surf->spans; span; span = span->pnext) {
+    for (; span; span = span->pnext) {
         pdest = (byte*)d_viewbuffer + screenwidth * span->v;
         u = span->u;
         u2 = span->u + span->count - 1;
@@ -160,142 +161,352 @@ void D_CalcGradients(msurface_t* pface)
 
 /*
 ==============
-D_DrawSurfaces
+D_SetupSurface
+
+Works out everything the span drawers need for one surface.  This touches
+the surface cache and the view transform, so it always runs on the main
+thread.  With d_deferbuild set, a surface cache miss is left in sg->pending
+for D_BuildPendingSurfaces instead of being built here.
 ==============
 */
-void D_DrawSurfaces(void)
+static vec3_t world_transformed_modelorg;
+static qboolean d_deferbuild;
+
+static void D_SetupSurface(surf_t* s, surfgrad_t* sg)
 {
-    surf_t* s;
     msurface_t* pface;
     surfcache_t* pcurrentcache;
-    vec3_t world_transformed_modelorg;
     vec3_t local_modelorg;
 
-    currententity = &cl_entities[0];
-    TransformVector(modelorg, transformed_modelorg);
-    VectorCopy(transformed_modelorg, world_transformed_modelorg);
+    sg->surf = s;
+    sg->pending = NULL;
+    sg->d_zistepu = s->d_zistepu;
+    sg->d_zistepv = s->d_zistepv;
+    sg->d_ziorigin = s->d_ziorigin;
 
     // TODO: could preset a lot of this at mode set time
     if (r_drawflat.value) {
-        for (s = &surfaces[1]; s < surface_p; s++) {
-            if (!s->spans) {
-                continue;
-            }
+        sg->kind = SG_SOLID;
+        sg->color = (int)((uintptr_t)s->data & 0xFF);
+        return;
+    }
+
+    r_drawnpolycount++;
 
-            d_zistepu = s->d_zistepu;
-            d_zistepv = s->d_zistepv;
-            d_ziorigin = s->d_ziorigin;
+    if (s->flags & SURF_DRAWSKY) {
+        if (!r_skymade) {
+            R_MakeSky();
+        }
+
+        sg->kind = SG_SKY;
+        return;
+    }
+
+    if (s->flags & SURF_DRAWBACKGROUND) {
+        // set up a gradient for the background surface that places it
+        // effectively at infinity distance from the viewpoint
+        sg->d_zistepu = 0;
+        sg->d_zistepv = 0;
+        sg->d_ziorigin = -0.9;
 
-            D_DrawSolidSurface(s, (int)((uintptr_t)s->data & 0xFF));
-            D_DrawZSpans(s->spans);
+        sg->kind = SG_SOLID;
+        sg->color = (int)r_clearcolor.value & 0xFF;
+        return;
+    }
+
+    if (s->insubmodel) {
+        // FIXME: we don't want to do all this for every polygon!
+        // TODO: store once at start of frame
+        currententity = s->entity; //FIXME: make this passed in to
+        // R_RotateBmodel ()
+        VectorSubtract(r_origin, currententity->origin, local_modelorg);
+        TransformVector(local_modelorg, transformed_modelorg);
+
+        R_RotateBmodel(); // FIXME: don't mess with the frustum,
+                          // make entity passed in
+    }
+
+    pface = s->data;
+
+    if (s->flags & SURF_DRAWTURB) {
+        sg->kind = SG_TURB;
+        miplevel = 0;
+        cacheblock = (pixel_t*)R_TurbFrame(pface->texinfo->texture);
+        if (cacheblock) {
+            cachewidth = TILE_SIZE;
+        } else {
+            cacheblock = (pixel_t*)((byte*)pface->texinfo->texture + pface->texinfo->texture->offsets[0]);
+            cachewidth = 64;
         }
     } else {
-        for (s = &surfaces[1]; s < surface_p; s++) {
-            if (!s->spans) {
+        sg->kind = SG_TEXTURED;
+        miplevel = D_MipLevelForScale(s->nearzi * scale_for_mip * pface->texinfo->mipadjust);
+
+        // FIXME: make this passed in to D_CacheSurface
+        if (d_deferbuild) {
+            pcurrentcache = D_CacheSurfaceDeferred(pface, miplevel, &sg->build, &sg->pending);
+        } else {
+            pcurrentcache = D_CacheSurface(pface, miplevel);
+        }
+
+        cacheblock = (pixel_t*)pcurrentcache->data;
+        cachewidth = pcurrentcache->width;
+    }
+
+    D_CalcGradients(pface);
+
+    sg->cacheblock = cacheblock;
+    sg->cachewidth = cachewidth;
+    sg->d_sdivzstepu = d_sdivzstepu;
+    sg->d_tdivzstepu = d_tdivzstepu;
+    sg->d_sdivzstepv = d_sdivzstepv;
+    sg->d_tdivzstepv = d_tdivzstepv;
+    sg->d_sdivzorigin = d_sdivzorigin;
+    sg->d_tdivzorigin = d_tdivzorigin;
+    sg->sadjust = sadjust;
+    sg->tadjust = tadjust;
+    sg->bbextents = bbextents;
+    sg->bbextentt = bbextentt;
+
+    if (s->insubmodel) {
+        //
+        // restore the old drawing state
+        // FIXME: we don't want to do this every time!
+        // TODO: speed up
+        //
+        currententity = &cl_entities[0];
+        VectorCopy(world_transformed_modelorg, transformed_modelorg);
+        VectorCopy(base_vpn, vpn);
+        VectorCopy(base_vup, vup);
+        VectorCopy(base_vright, vright);
+        VectorCopy(base_modelorg, modelorg);
+        R_TransformFrustum();
+    }
+}
+
+/*
+==============
+D_DrawSurfaceSpans
+
+Fills and z-writes a list of spans using a surface's setup
+==============
+*/
+static void D_DrawSurfaceSpans(const surfgrad_t* sg, espan_t* pspans)
+{
+    cacheblock = sg->cacheblock;
+    cachewidth = sg->cachewidth;
+    d_sdivzstepu = sg->d_sdivzstepu;
+    d_tdivzstepu = sg->d_tdivzstepu;
+    d_zistepu = sg->d_zistepu;
+    d_sdivzstepv = sg->d_sdivzstepv;
+    d_tdivzstepv = sg->d_tdivzstepv;
+    d_zistepv = sg->d_zistepv;
+    d_sdivzorigin = sg->d_sdivzorigin;
+    d_tdivzorigin = sg->d_tdivzorigin;
+    d_ziorigin = sg->d_ziorigin;
+    sadjust = sg->sadjust;
+    tadjust = sg->tadjust;
+    bbextents = sg->bbextents;
+    bbextentt = sg->bbextentt;
+
+    switch (sg->kind) {
+    case SG_SOLID:
+        D_DrawSolidSpans(pspans, sg->color);
+        break;
+
+    case SG_SKY:
+        D_DrawSkyScans8(pspans);
+        break;
+
+    case SG_TURB:
+        Turbulent8(pspans);
+        break;
+
+    case SG_TEXTURED:
+        (*d_drawspans)(pspans);
+        break;
+    }
+
+    (*d_drawzspans)(pspans);
+}
+
+/*
+==============
+D_DrawBand
+
+Draws the part of every set up surface that falls on scanlines
+[v, v + d_bandheight).  Bands never share pixels, so they can be drawn in
+any order on any thread.
+==============
+*/
+#define BAND_SPANS 256   // spans copied out per surface before drawing
+#define BANDS_PER_THREAD 4 // extra bands so busy parts of the screen even out
+#define MIN_BAND_HEIGHT 4
+
+static int d_numsurfgrads;
+static int d_bandtop, d_bandheight;
+
+surfgrad_t** d_pendingsurfs;
+static int d_numpending;
+
+static void D_BuildPendingJob(int job, void* data)
+{
+    UNUSED(data);
+
+    D_BuildPendingSurface(&d_pendingsurfs[job]->build);
+}
+
+/*
+==============
+D_BuildPendingSurfaces
+
+Builds the cache blocks queued by D_SetupSurface on the worker threads.  If
+the blocks can't be trusted they are flagged stale instead, so the serial
+path rebuilds them.
+==============
+*/
+static void D_BuildPendingSurfaces(qboolean discard)
+{
+    surfgrad_t* sg;
+    int i;
+
+    d_numpending = 0;
+    for (i = 0, sg = d_surfgrads; i < d_numsurfgrads; i++, sg++) {
+        if (sg->pending) {
+            d_pendingsurfs[d_numpending++] = sg;
+        }
+    }
+
+    if (!discard) {
+        Sys_RunParallel(D_BuildPendingJob, d_numpending, NULL);
+    }
+
+    for (i = 0; i < d_numpending; i++) {
+        sg = d_pendingsurfs[i];
+        sg->pending->pending = false;
+
+        // the rover may have handed the block on to another surface since
+        if (discard && sg->build.surf->cachespots[sg->build.surfmip] == sg->pending) {
+            sg->pending->texture = NULL;
+        }
+    }
+}
+
+static void D_DrawBand(int band, void* data)
+{
+    espan_t bandspans[BAND_SPANS];
+    espan_t* span;
+    surfgrad_t* sg;
+    int i, count, top, bottom;
+
+    UNUSED(data);
+
+    top = d_bandtop + band * d_bandheight;
+    bottom = top + d_bandheight;
+
+    for (i = 0, sg = d_surfgrads; i < d_numsurfgrads; i++, sg++) {
+        count = 0;
+
+        // spans are linked in as the edges are scanned from the top down,
+        // so each list runs from the bottom of the screen up
+        for (span = sg->surf->spans; span; span = span->pnext) {
+            if (span->v >= bottom) {
                 continue;
             }
 
-            r_drawnpolycount++;
-
-            d_zistepu = s->d_zistepu;
-            d_zistepv = s->d_zistepv;
-            d_ziorigin = s->d_ziorigin;
-
-            if (s->flags & SURF_DRAWSKY) {
-                if (!r_skymade) {
-                    R_MakeSky();
-                }
-
-                D_DrawSkyScans8(s->spans);
-                D_DrawZSpans(s->spans);
-            } else if (s->flags & SURF_DRAWBACKGROUND) {
-                // set up a gradient for the background surface that places it
-                // effectively at infinity distance from the viewpoint
-                d_zistepu = 0;
-                d_zistepv = 0;
-                d_ziorigin = -0.9;
-
-                D_DrawSolidSurface(s, (int)r_clearcolor.value & 0xFF);
-                D_DrawZSpans(s->spans);
-            } else if (s->flags & SURF_DRAWTURB) {
-                pface = s->data;
-                miplevel = 0;
-                cacheblock = (pixel_t*)((byte*)pface->texinfo->texture + pface->texinfo->texture->offsets[0]);
-                cachewidth = 64;
-
-                if (s->insubmodel) {
-                    // FIXME: we don't want to do all this for every polygon!
-                    // TODO: store once at start of frame
-                    currententity = s->entity; //FIXME: make this passed in to
-                    // R_RotateBmodel ()
-                    VectorSubtract(r_origin, currententity->origin, local_modelorg);
-                    TransformVector(local_modelorg, transformed_modelorg);
-
-                    R_RotateBmodel(); // FIXME: don't mess with the frustum,
-                                      // make entity passed in
-                }
-
-                D_CalcGradients(pface);
-                Turbulent8(s->spans);
-                D_DrawZSpans(s->spans);
-
-                if (s->insubmodel) {
-                    //
-                    // restore the old drawing state
-                    // FIXME: we don't want to do this every time!
-                    // TODO: speed up
-                    //
-                    currententity = &cl_entities[0];
-                    VectorCopy(world_transformed_modelorg, transformed_modelorg);
-                    VectorCopy(base_vpn, vpn);
-                    VectorCopy(base_vup, vup);
-                    VectorCopy(base_vright, vright);
-                    VectorCopy(base_modelorg, modelorg);
-                    R_TransformFrustum();
-                }
-            } else {
-                if (s->insubmodel) {
-                    // FIXME: we don't want to do all this for every polygon!
-                    // TODO: store once at start of frame
-                    currententity = s->entity; //FIXME: make this passed in to
-                    // R_RotateBmodel ()
-                    VectorSubtract(r_origin, currententity->origin, local_modelorg);
-                    TransformVector(local_modelorg, transformed_modelorg);
-
-                    R_RotateBmodel(); // FIXME: don't mess with the frustum,
-                                      // make entity passed in
-                }
-
-                pface = s->data;
-                miplevel = D_MipLevelForScale(s->nearzi * scale_for_mip * pface->texinfo->mipadjust);
-
-                // FIXME: make this passed in to D_CacheSurface
-                pcurrentcache = D_CacheSurface(pface, miplevel);
-
-                cacheblock = (pixel_t*)pcurrentcache->data;
-                cachewidth = pcurrentcache->width;
-
-                D_CalcGradients(pface);
-
-                (*d_drawspans)(s->spans);
-
-                D_DrawZSpans(s->spans);
-
-                if (s->insubmodel) {
-                    //
-                    // restore the old drawing state
-                    // FIXME: we don't want to do this every time!
-                    // TODO: speed up
-                    //
-                    currententity = &cl_entities[0];
-                    VectorCopy(world_transformed_modelorg, transformed_modelorg);
-                    VectorCopy(base_vpn, vpn);
-                    VectorCopy(base_vup, vup);
-                    VectorCopy(base_vright, vright);
-                    VectorCopy(base_modelorg, modelorg);
-                    R_TransformFrustum();
-                }
+            if (span->v < top) {
+                break;
+            }
+
+            bandspans[count] = *span;
+            bandspans[count].pnext = &bandspans[count + 1];
+
+            if (++count == BAND_SPANS) {
+                bandspans[count - 1].pnext = NULL;
+                D_DrawSurfaceSpans(sg, bandspans);
+                count = 0;
+            }
+        }
+
+        if (count) {
+            bandspans[count - 1].pnext = NULL;
+            D_DrawSurfaceSpans(sg, bandspans);
+        }
+    }
+}
+
+/*
+==============
+D_DrawSurfaces
+==============
+*/
+void D_DrawSurfaces(void)
+{
+    surf_t* s;
+    surfgrad_t sg;
+    int numthreads, numbands, drawnpolycount, surfcount;
+    int schits, scmisses, hotevictions;
+
+    currententity = &cl_entities[0];
+    TransformVector(modelorg, transformed_modelorg);
+    VectorCopy(transformed_modelorg, world_transformed_modelorg);
+
+    numthreads = Sys_NumThreads();
+    if (numthreads > r_threads.value) {
+        numthreads = r_threads.value;
+    }
+
+    numbands = (current_iv - vstartscan + 1) / MIN_BAND_HEIGHT;
+    if (numbands > numthreads * BANDS_PER_THREAD) {
+        numbands = numthreads * BANDS_PER_THREAD;
+    }
+
+    if (numthreads > 1 && numbands > 1) {
+        //
+        // set up every surface first, then fill the bands in parallel
+        //
+        drawnpolycount = r_drawnpolycount;
+        surfcount = c_surf;
+        schits = c_schits;
+        scmisses = c_scmisses;
+        hotevictions = d_hotevictions;
+
+        d_cacheconflict = false;
+        d_deferbuild = true;
+
+        d_numsurfgrads = 0;
+        for (s = &surfaces[1]; s < surface_p; s++) {
+            if (s->spans) {
+                D_SetupSurface(s, &d_surfgrads[d_numsurfgrads++]);
             }
         }
+
+        d_deferbuild = false;
+
+        // a block handed out earlier in this pass can only be taken back by
+        // evicting one drawn this frame, the one case the bands can't handle
+        if (d_hotevictions == hotevictions && !d_cacheconflict) {
+            D_BuildPendingSurfaces(false);
+
+            d_bandtop = vstartscan;
+            d_bandheight = (current_iv - vstartscan + numbands) / numbands;
+            Sys_RunParallel(D_DrawBand, numbands, NULL);
+            return;
+        }
+
+        D_BuildPendingSurfaces(true);
+        r_drawnpolycount = drawnpolycount;
+        c_surf = surfcount;
+        c_schits = schits;
+        c_scmisses = scmisses;
+    }
+
+    for (s = &surfaces[1]; s < surface_p; s++) {
+        if (!s->spans) {
+            continue;
+        }
+
+        D_SetupSurface(s, &sg);
+        D_DrawSurfaceSpans(&sg, s->spans);
     }
 }
@@ -41,18 +41,20 @@ typedef enum {
     pt_blob2
 } ptype_t;
 
-// !!! if this is changed, it must be changed in d_ifacea.h too !!!
-typedef struct particle_s {
+// the particles are kept as parallel arrays, live ones packed at the front,
+// so they can be moved and projected several at a time
+typedef struct {
+    int numactive;
+    int maxparticles;
     // driver-usable fields
-    vec3_t org;
-    float color;
+    float* org[3];
+    byte* color;
     // drivers never touch the following fields
-    struct particle_s* next;
-    vec3_t vel;
-    float ramp;
-    float die;
-    ptype_t type;
-} particle_t;
+    float* vel[3];
+    float* ramp;
+    float* die;
+    byte* type;
+} particles_t;
 
 #define PARTICLE_Z_CLIP 8.0
 
@@ -130,6 +132,7 @@ extern float r_aliasuvscale; // scale-up factor for screen u and v
 //  on Alias vertices passed to driver
 extern int r_pixbytes;
 extern qboolean r_dowarp;
+extern qboolean r_scaleview; // 3D view drawn into r_scalebuffer at a lower resolution
 
 extern affinetridesc_t r_affinetridesc;
 extern spritedesc_t r_spritedesc;
@@ -149,7 +152,8 @@ void D_DisableBackBufferAccess(void);
 void D_EndDirectRect(int x, int y, int width, int height);
 void D_PolysetDraw(void);
 void D_PolysetDrawFinalVerts(finalvert_t* fv, int numverts);
-void D_DrawParticle(particle_t* pparticle);
+void D_PolysetFlush(void);
+void D_DrawParticles(particles_t* particles);
 void D_DrawPoly(void);
 void D_DrawSprite(void);
 void D_DrawSurfaces(void);
@@ -162,6 +166,8 @@ void D_SetupFrame(void);
 void D_StartParticles(void);
 void D_TurnZOn(void);
 void D_WarpScreen(void);
+void D_ScaleScreen(void);
+char* D_SpanKernelName(void);
 
 void D_FillRect(vrect_t* vrect, int color);
 void D_DrawRect(void);
@@ -197,11 +203,13 @@ typedef struct {
     int surfmip;        // mipmapped ratio of surface texels / world pixels
     int surfwidth;      // in mipmapped texels
     int surfheight;     // in mipmapped texels
+    struct staticlight_s* staticlight; // cached lightstyles for dlit surfaces
 } drawsurf_t;
 
-extern drawsurf_t r_drawsurf;
+extern THREAD_LOCAL drawsurf_t r_drawsurf;
 
 void R_DrawSurface(void);
+struct staticlight_s* R_StaticLightForSurface(msurface_t* surf);
 void R_GenTile(msurface_t* psurf, void* pdest);
 
 // !!! if this is changed, it must be changed in d_ifacea.h too !!!
@@ -220,6 +228,9 @@ extern float skyspeed, skyspeed2;
 extern float skytime;
 
 extern int c_surf;
+extern int c_schits, c_scmisses, c_scevictions;
+extern int sc_size;
 extern vrect_t scr_vrect;
 
 extern byte* r_warpbuffer;
+extern byte* r_scalebuffer; // vid.width pixels per row
@@ -28,8 +28,6 @@ cvar_t d_subdiv16 = { "d_subdiv16", "1" };
 cvar_t d_mipcap = { "d_mipcap", "0" };
 cvar_t d_mipscale = { "d_mipscale", "1" };
 
-surfcache_t* d_initial_rover;
-qboolean d_roverwrapped;
 int d_minmip;
 float d_scalemip[NUM_MIPS - 1];
 
@@ -51,6 +49,8 @@ void D_Init(void)
     Cvar_RegisterVariable(&d_subdiv16);
     Cvar_RegisterVariable(&d_mipcap);
     Cvar_RegisterVariable(&d_mipscale);
+    Cvar_RegisterVariable(&d_spankernel);
+    Cvar_RegisterVariable(&d_surfcachemax);
 
     r_drawpolys = false;
     r_worldpolysbacktofront = false;
@@ -117,19 +117,20 @@ void D_SetupFrame(void)
 
     if (r_dowarp) {
         d_viewbuffer = r_warpbuffer;
+    } else if (r_scaleview) {
+        d_viewbuffer = r_scalebuffer;
     } else {
         d_viewbuffer = (void*)(byte*)vid.buffer;
     }
 
     if (r_dowarp) {
         screenwidth = WARP_WIDTH;
+    } else if (r_scaleview) {
+        screenwidth = vid.width;
     } else {
         screenwidth = vid.rowbytes;
     }
 
-    d_roverwrapped = false;
-    d_initial_rover = sc_rover;
-
     d_minmip = d_mipcap.value;
     if (d_minmip > 3) {
         d_minmip = 3;
@@ -141,7 +142,7 @@ void D_SetupFrame(void)
         d_scalemip[i] = basemip[i] * d_mipscale.value;
     }
 
-    d_drawspans = D_DrawSpans8;
+    D_SelectSpanKernels();
     d_aflatcolor = 0;
 }
 
@@ -35,41 +35,78 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define SURFCACHE_SIZE_AT_320X200 600 * 1024
 
 typedef struct surfcache_s {
-    struct surfcache_s* next;
+    struct surfcache_s *next, *prev; // in its size class, oldest first
     struct surfcache_s** owner; // NULL is an empty chunk of memory
     int lightadj[MAXLIGHTMAPS]; // checked for strobe flush
     int dlight;
     int size; // including header
+    int sizeclass;
+    int lastframe; // r_framecount when last drawn
     unsigned width;
     unsigned height; // DEBUG only needed for debug
     float mipscale;
+    qboolean pending; // queued for D_BuildPendingSurface
     struct texture_s* texture; // checked for animating textures
     byte data[4];              // width*height elements
 } surfcache_t;
 
+// how D_DrawSurfaces fills a surface's spans
+typedef enum {
+    SG_SOLID,
+    SG_SKY,
+    SG_TURB,
+    SG_TEXTURED
+} sgkind_t;
+
+// per-surface span setup, computed once by D_DrawSurfaces and then shared
+// read-only by every band that has spans on the surface
+typedef struct surfgrad_s {
+    surf_t* surf;
+    sgkind_t kind;
+    int color; // SG_SOLID only
+    pixel_t* cacheblock;
+    int cachewidth;
+    float d_sdivzstepu, d_tdivzstepu, d_zistepu;
+    float d_sdivzstepv, d_tdivzstepv, d_zistepv;
+    float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
+    fixed16_t sadjust, tadjust, bbextents, bbextentt;
+    surfcache_t* pending; // cache block still to be built from build
+    drawsurf_t build;
+} surfgrad_t;
+
+extern surfgrad_t* d_surfgrads; // r_cnumsurfs entries
+extern surfgrad_t** d_pendingsurfs; // r_cnumsurfs entries
+
 // !!! if this is changed, it must be changed in asm_draw.h too !!!
 typedef struct sspan_s {
     int u, v, count;
 } sspan_t;
 
 extern cvar_t d_subdiv16;
+extern cvar_t d_spankernel;
 
 extern float scale_for_mip;
 
-extern qboolean d_roverwrapped;
-extern surfcache_t* sc_rover;
-extern surfcache_t* d_initial_rover;
+extern int d_hotevictions;
+extern cvar_t d_surfcachemax;
 
-extern float d_sdivzstepu, d_tdivzstepu, d_zistepu;
-extern float d_sdivzstepv, d_tdivzstepv, d_zistepv;
-extern float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
+extern THREAD_LOCAL float d_sdivzstepu, d_tdivzstepu, d_zistepu;
+extern THREAD_LOCAL float d_sdivzstepv, d_tdivzstepv, d_zistepv;
+extern THREAD_LOCAL float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
 
-extern fixed16_t sadjust, tadjust;
-extern fixed16_t bbextents, bbextentt;
+extern THREAD_LOCAL fixed16_t sadjust, tadjust;
+extern THREAD_LOCAL fixed16_t bbextents, bbextentt;
 
 void D_DrawSpans8(espan_t* pspans);
 void D_DrawSpans16(espan_t* pspans);
 void D_DrawZSpans(espan_t* pspans);
+void D_DrawSpans8_SSE2(espan_t* pspan);
+void D_DrawZSpans_SSE2(espan_t* pspan);
+void D_DrawSpans8_AVX2(espan_t* pspan);
+void D_DrawZSpans_AVX2(espan_t* pspan);
+void D_WarpRow(byte* dest, byte* src, int* rows, int* columns, int* turb, int count);
+void D_WarpRow_AVX2(byte* dest, byte* src, int* rows, int* columns, int* turb, int count);
+void D_SelectSpanKernels(void);
 void Turbulent8(espan_t* pspan);
 void D_SpriteDrawSpans(sspan_t* pspan);
 
@@ -79,6 +116,9 @@ void D_DrawSkyScans16(espan_t* pspan);
 void R_ShowSubDiv(void);
 extern void (*prealspandrawer)(void);
 surfcache_t* D_CacheSurface(msurface_t* surface, int miplevel);
+surfcache_t* D_CacheSurfaceDeferred(msurface_t* surface, int miplevel, drawsurf_t* build, surfcache_t** pbuild);
+void D_BuildPendingSurface(drawsurf_t* build);
+extern qboolean d_cacheconflict;
 
 extern int D_MipLevelForScale(float scale);
 
@@ -86,7 +126,7 @@ extern short* d_pzbuffer;
 extern unsigned int d_zrowbytes, d_zwidth;
 
 extern int* d_pscantable;
-extern int d_scantable[MAXHEIGHT];
+extern int* d_scantable; // vid.height entries
 
 extern int d_vrectx, d_vrecty, d_vrectright_particle, d_vrectbottom_particle;
 
@@ -94,9 +134,11 @@ extern int d_y_aspect_shift, d_pix_min, d_pix_max, d_pix_shift;
 
 extern pixel_t* d_viewbuffer;
 
-extern short* zspantable[MAXHEIGHT];
+extern short** zspantable; // vid.height entries
 
 extern int d_minmip;
 extern float d_scalemip[3];
 
 extern void (*d_drawspans)(espan_t* pspan);
+extern void (*d_drawzspans)(espan_t* pspan);
+extern void (*d_warprow)(byte* dest, byte* src, int* rows, int* columns, int* turb, int count);
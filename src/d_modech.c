@@ -26,8 +26,8 @@ int d_vrectx, d_vrecty, d_vrectright_particle, d_vrectbottom_particle;
 
 int d_y_aspect_shift, d_pix_min, d_pix_max, d_pix_shift;
 
-int d_scantable[MAXHEIGHT];
-short* zspantable[MAXHEIGHT];
+int* d_scantable;
+short** zspantable;
 
 /*
 ================
@@ -40,6 +40,8 @@ void D_ViewChanged(void)
 
     if (r_dowarp) {
         rowbytes = WARP_WIDTH;
+    } else if (r_scaleview) {
+        rowbytes = vid.width;
     } else {
         rowbytes = vid.rowbytes;
     }
@@ -22,6 +22,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 #include "d_local.h"
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define PARTICLE_BLOCK 256
+
 /*
 ==============
 D_EndParticles
@@ -44,41 +50,19 @@ void D_StartParticles(void)
 
 /*
 ==============
-D_DrawParticle
+D_PlotParticle
+
+Z-tests and draws one projected particle
 ==============
 */
-void D_DrawParticle(particle_t* pparticle)
+static void D_PlotParticle(int u, int v, int izi, int color)
 {
-    vec3_t local, transformed;
-    float zi;
     byte* pdest;
     short* pz;
-    int i, izi, pix, count, u, v;
-
-    // transform point
-    VectorSubtract(pparticle->org, r_origin, local);
-
-    transformed[0] = DotProduct(local, r_pright);
-    transformed[1] = DotProduct(local, r_pup);
-    transformed[2] = DotProduct(local, r_ppn);
-
-    if (transformed[2] < PARTICLE_Z_CLIP) {
-        return;
-    }
-
-    // project the point
-    // FIXME: preadjust xcenter and ycenter
-    zi = 1.0 / transformed[2];
-    u = (int)(xcenter + zi * transformed[0] + 0.5);
-    v = (int)(ycenter - zi * transformed[1] + 0.5);
-
-    if ((v > d_vrectbottom_particle) || (u > d_vrectright_particle) || (v < d_vrecty) || (u < d_vrectx)) {
-        return;
-    }
+    int i, pix, count;
 
     pz = d_pzbuffer + (d_zwidth * v) + u;
     pdest = d_viewbuffer + d_scantable[v] + u;
-    izi = (int)(zi * 0x8000);
 
     pix = izi >> d_pix_shift;
 
@@ -95,7 +79,7 @@ void D_DrawParticle(particle_t* pparticle)
         for (; count; count--, pz += d_zwidth, pdest += screenwidth) {
             if (pz[0] <= izi) {
                 pz[0] = izi;
-                pdest[0] = pparticle->color;
+                pdest[0] = color;
             }
         }
         break;
@@ -106,12 +90,12 @@ void D_DrawParticle(particle_t* pparticle)
         for (; count; count--, pz += d_zwidth, pdest += screenwidth) {
             if (pz[0] <= izi) {
                 pz[0] = izi;
-                pdest[0] = pparticle->color;
+                pdest[0] = color;
             }
 
             if (pz[1] <= izi) {
                 pz[1] = izi;
-                pdest[1] = pparticle->color;
+                pdest[1] = color;
             }
         }
         break;
@@ -122,17 +106,17 @@ void D_DrawParticle(particle_t* pparticle)
         for (; count; count--, pz += d_zwidth, pdest += screenwidth) {
             if (pz[0] <= izi) {
                 pz[0] = izi;
-                pdest[0] = pparticle->color;
+                pdest[0] = color;
             }
 
             if (pz[1] <= izi) {
                 pz[1] = izi;
-                pdest[1] = pparticle->color;
+                pdest[1] = color;
             }
 
             if (pz[2] <= izi) {
                 pz[2] = izi;
-                pdest[2] = pparticle->color;
+                pdest[2] = color;
             }
         }
         break;
@@ -143,22 +127,22 @@ void D_DrawParticle(particle_t* pparticle)
         for (; count; count--, pz += d_zwidth, pdest += screenwidth) {
             if (pz[0] <= izi) {
                 pz[0] = izi;
-                pdest[0] = pparticle->color;
+                pdest[0] = color;
             }
 
             if (pz[1] <= izi) {
                 pz[1] = izi;
-                pdest[1] = pparticle->color;
+                pdest[1] = color;
             }
 
             if (pz[2] <= izi) {
                 pz[2] = izi;
-                pdest[2] = pparticle->color;
+                pdest[2] = color;
             }
 
             if (pz[3] <= izi) {
                 pz[3] = izi;
-                pdest[3] = pparticle->color;
+                pdest[3] = color;
             }
         }
         break;
@@ -170,10 +154,154 @@ void D_DrawParticle(particle_t* pparticle)
             for (i = 0; i < pix; i++) {
                 if (pz[i] <= izi) {
                     pz[i] = izi;
-                    pdest[i] = pparticle->color;
+                    pdest[i] = color;
                 }
             }
         }
         break;
     }
 }
+
+/*
+==============
+D_ProjectParticles
+
+Transforms and projects a block of particles, keeping the ones that land in
+the view.  Returns how many were kept.
+==============
+*/
+static int D_ProjectParticles(particles_t* particles, int first, int count,
+    int* index, int* us, int* vs, int* izis)
+{
+    float *ox, *oy, *oz;
+    float local[3], tz, zi;
+    int i, u, v, visible;
+
+    ox = particles->org[0] + first;
+    oy = particles->org[1] + first;
+    oz = particles->org[2] + first;
+    visible = 0;
+    i = 0;
+
+#if defined(__SSE2__)
+    {
+        __m128 rx, ry, rz, right4[3], up4[3], pn4[3], lx, ly, lz, x, y, z, vzi, clip;
+        __m128 cx, cy, half, scale;
+        __m128i vu, vv, vizi, left, right, top, bottom, reject;
+        int tu[4], tv[4], tizi[4], mask, j;
+
+        rx = _mm_set1_ps(r_origin[0]);
+        ry = _mm_set1_ps(r_origin[1]);
+        rz = _mm_set1_ps(r_origin[2]);
+        for (j = 0; j < 3; j++) {
+            right4[j] = _mm_set1_ps(r_pright[j]);
+            up4[j] = _mm_set1_ps(r_pup[j]);
+            pn4[j] = _mm_set1_ps(r_ppn[j]);
+        }
+
+        clip = _mm_set1_ps(PARTICLE_Z_CLIP);
+        cx = _mm_set1_ps(xcenter);
+        cy = _mm_set1_ps(ycenter);
+        half = _mm_set1_ps(0.5);
+        scale = _mm_set1_ps(0x8000);
+        left = _mm_set1_epi32(d_vrectx);
+        right = _mm_set1_epi32(d_vrectright_particle);
+        top = _mm_set1_epi32(d_vrecty);
+        bottom = _mm_set1_epi32(d_vrectbottom_particle);
+
+        for (; i + 4 <= count; i += 4) {
+            lx = _mm_sub_ps(_mm_loadu_ps(ox + i), rx);
+            ly = _mm_sub_ps(_mm_loadu_ps(oy + i), ry);
+            lz = _mm_sub_ps(_mm_loadu_ps(oz + i), rz);
+
+            x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, right4[0]), _mm_mul_ps(ly, right4[1])), _mm_mul_ps(lz, right4[2]));
+            y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, up4[0]), _mm_mul_ps(ly, up4[1])), _mm_mul_ps(lz, up4[2]));
+            z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, pn4[0]), _mm_mul_ps(ly, pn4[1])), _mm_mul_ps(lz, pn4[2]));
+
+            // anything too close is thrown out below, so the divide can't hurt
+            vzi = _mm_div_ps(_mm_set1_ps(1), _mm_max_ps(z, clip));
+            vu = _mm_cvttps_epi32(_mm_add_ps(_mm_add_ps(cx, _mm_mul_ps(vzi, x)), half));
+            vv = _mm_cvttps_epi32(_mm_add_ps(_mm_sub_ps(cy, _mm_mul_ps(vzi, y)), half));
+            vizi = _mm_cvttps_epi32(_mm_mul_ps(vzi, scale));
+
+            reject = _mm_castps_si128(_mm_cmplt_ps(z, clip));
+            reject = _mm_or_si128(reject, _mm_cmpgt_epi32(vv, bottom));
+            reject = _mm_or_si128(reject, _mm_cmpgt_epi32(vu, right));
+            reject = _mm_or_si128(reject, _mm_cmplt_epi32(vv, top));
+            reject = _mm_or_si128(reject, _mm_cmplt_epi32(vu, left));
+
+            mask = ~_mm_movemask_ps(_mm_castsi128_ps(reject)) & 15;
+            if (!mask) {
+                continue;
+            }
+
+            _mm_storeu_si128((__m128i*)tu, vu);
+            _mm_storeu_si128((__m128i*)tv, vv);
+            _mm_storeu_si128((__m128i*)tizi, vizi);
+
+            for (; mask; mask &= mask - 1) {
+                j = __builtin_ctz(mask);
+                index[visible] = first + i + j;
+                us[visible] = tu[j];
+                vs[visible] = tv[j];
+                izis[visible] = tizi[j];
+                visible++;
+            }
+        }
+    }
+#endif
+
+    for (; i < count; i++) {
+        local[0] = ox[i] - r_origin[0];
+        local[1] = oy[i] - r_origin[1];
+        local[2] = oz[i] - r_origin[2];
+
+        tz = DotProduct(local, r_ppn);
+        if (tz < PARTICLE_Z_CLIP) {
+            continue;
+        }
+
+        // FIXME: preadjust xcenter and ycenter
+        zi = 1.0 / tz;
+        u = (int)(xcenter + zi * DotProduct(local, r_pright) + 0.5);
+        v = (int)(ycenter - zi * DotProduct(local, r_pup) + 0.5);
+
+        if ((v > d_vrectbottom_particle) || (u > d_vrectright_particle) || (v < d_vrecty) || (u < d_vrectx)) {
+            continue;
+        }
+
+        index[visible] = first + i;
+        us[visible] = u;
+        vs[visible] = v;
+        izis[visible] = (int)(zi * 0x8000);
+        visible++;
+    }
+
+    return visible;
+}
+
+/*
+==============
+D_DrawParticles
+
+Projects the particles a block at a time, then z-tests what survived
+==============
+*/
+void D_DrawParticles(particles_t* particles)
+{
+    int index[PARTICLE_BLOCK], us[PARTICLE_BLOCK], vs[PARTICLE_BLOCK], izis[PARTICLE_BLOCK];
+    int first, count, visible, i;
+
+    for (first = 0; first < particles->numactive; first += PARTICLE_BLOCK) {
+        count = particles->numactive - first;
+        if (count > PARTICLE_BLOCK) {
+            count = PARTICLE_BLOCK;
+        }
+
+        visible = D_ProjectParticles(particles, first, count, index, us, vs, izis);
+
+        for (i = 0; i < visible; i++) {
+            D_PlotParticle(us[i], vs[i], izis[i], particles->color[index[i]]);
+        }
+    }
+}
@@ -39,60 +39,84 @@ typedef struct {
     int sfrac, tfrac, light, zi;
 } spanpackage_t;
 
+// vertices are 0, 1 or 2 for r_p[0..2], -1 for none
 typedef struct {
     int isflattop;
     int numleftedges;
-    int* pleftedgevert0;
-    int* pleftedgevert1;
-    int* pleftedgevert2;
+    int leftedgevert0;
+    int leftedgevert1;
+    int leftedgevert2;
     int numrightedges;
-    int* prightedgevert0;
-    int* prightedgevert1;
-    int* prightedgevert2;
+    int rightedgevert0;
+    int rightedgevert1;
+    int rightedgevert2;
 } edgetable;
 
-int r_p0[6], r_p1[6], r_p2[6];
+// a triangle waiting for D_PolysetFlush
+typedef struct {
+    int v[3][6]; // u, v, s, t, light, 1/z with the seam fixup applied
+    int top, bottom; // first and last screen rows it can touch
+} polytri_t;
+
+static THREAD_LOCAL int r_p[3][6];
 
-byte* d_pcolormap;
+static THREAD_LOCAL byte* d_pcolormap;
 
 int d_aflatcolor;
-int d_xdenom;
-
-edgetable* pedgetable;
-
-edgetable edgetables[12] = {
-    { 0, 1, r_p0, r_p2, NULL, 2, r_p0, r_p1, r_p2 },
-    { 0, 2, r_p1, r_p0, r_p2, 1, r_p1, r_p2, NULL },
-    { 1, 1, r_p0, r_p2, NULL, 1, r_p1, r_p2, NULL },
-    { 0, 1, r_p1, r_p0, NULL, 2, r_p1, r_p2, r_p0 },
-    { 0, 2, r_p0, r_p2, r_p1, 1, r_p0, r_p1, NULL },
-    { 0, 1, r_p2, r_p1, NULL, 1, r_p2, r_p0, NULL },
-    { 0, 1, r_p2, r_p1, NULL, 2, r_p2, r_p0, r_p1 },
-    { 0, 2, r_p2, r_p1, r_p0, 1, r_p2, r_p0, NULL },
-    { 0, 1, r_p1, r_p0, NULL, 1, r_p1, r_p2, NULL },
-    { 1, 1, r_p2, r_p1, NULL, 1, r_p0, r_p1, NULL },
-    { 1, 1, r_p1, r_p0, NULL, 1, r_p2, r_p0, NULL },
-    { 0, 1, r_p0, r_p2, NULL, 1, r_p0, r_p1, NULL },
+static THREAD_LOCAL int d_xdenom;
+
+static THREAD_LOCAL edgetable* pedgetable;
+
+static edgetable edgetables[12] = {
+    { 0, 1, 0, 2, -1, 2, 0, 1, 2 },
+    { 0, 2, 1, 0, 2, 1, 1, 2, -1 },
+    { 1, 1, 0, 2, -1, 1, 1, 2, -1 },
+    { 0, 1, 1, 0, -1, 2, 1, 2, 0 },
+    { 0, 2, 0, 2, 1, 1, 0, 1, -1 },
+    { 0, 1, 2, 1, -1, 1, 2, 0, -1 },
+    { 0, 1, 2, 1, -1, 2, 2, 0, 1 },
+    { 0, 2, 2, 1, 0, 1, 2, 0, -1 },
+    { 0, 1, 1, 0, -1, 1, 1, 2, -1 },
+    { 1, 1, 2, 1, -1, 1, 0, 1, -1 },
+    { 1, 1, 1, 0, -1, 1, 2, 0, -1 },
+    { 0, 1, 0, 2, -1, 1, 0, 1, -1 },
 };
 
-// FIXME: some of these can become statics
-int a_sstepxfrac, a_tstepxfrac, r_lstepx, a_ststepxwhole;
-int r_sstepx, r_tstepx, r_lstepy, r_sstepy, r_tstepy;
-int r_zistepx, r_zistepy;
-int d_aspancount, d_countextrastep;
-
-spanpackage_t* a_spans;
-spanpackage_t* d_pedgespanpackage;
-static int ystart;
-byte *d_pdest, *d_ptex;
-short* d_pz;
-int d_sfrac, d_tfrac, d_light, d_zi;
-int d_ptexextrastep, d_sfracextrastep;
-int d_tfracextrastep, d_lightextrastep, d_pdestextrastep;
-int d_lightbasestep, d_pdestbasestep, d_ptexbasestep;
-int d_sfracbasestep, d_tfracbasestep;
-int d_ziextrastep, d_zibasestep;
-int d_pzextrastep, d_pzbasestep;
+static THREAD_LOCAL int a_sstepxfrac, a_tstepxfrac, r_lstepx, a_ststepxwhole;
+static THREAD_LOCAL int r_sstepx, r_tstepx, r_lstepy, r_sstepy, r_tstepy;
+static THREAD_LOCAL int r_zistepx, r_zistepy;
+static THREAD_LOCAL int d_aspancount, d_countextrastep;
+
+static THREAD_LOCAL spanpackage_t* a_spans;
+static THREAD_LOCAL spanpackage_t* d_pedgespanpackage;
+static THREAD_LOCAL int ystart, d_aspantop;
+static THREAD_LOCAL byte *d_pdest, *d_ptex;
+static THREAD_LOCAL short* d_pz;
+static THREAD_LOCAL int d_sfrac, d_tfrac, d_light, d_zi;
+static THREAD_LOCAL int d_ptexextrastep, d_sfracextrastep;
+static THREAD_LOCAL int d_tfracextrastep, d_lightextrastep, d_pdestextrastep;
+static THREAD_LOCAL int d_lightbasestep, d_pdestbasestep, d_ptexbasestep;
+static THREAD_LOCAL int d_sfracbasestep, d_tfracbasestep;
+static THREAD_LOCAL int d_ziextrastep, d_zibasestep;
+static THREAD_LOCAL int d_pzextrastep, d_pzbasestep;
+
+// rows [d_polytop, d_polybottom) are the only ones this thread may touch
+static THREAD_LOCAL int d_polytop, d_polybottom;
+
+#define MAX_POLYTRIS 1024 // queued before an early flush
+#define MAX_POLY_BANDS 16
+#define POLY_BANDS_PER_THREAD 2
+#define MIN_POLY_BAND_HEIGHT 8
+
+static polytri_t d_polytris[MAX_POLYTRIS];
+static int d_numpolytris;
+
+static finalvert_t* d_polyverts; // plotted before the triangles
+static int d_numpolyverts;
+
+static int d_polybins[MAX_POLYTRIS * MAX_POLY_BANDS];
+static int d_polybinstart[MAX_POLY_BANDS + 1];
+static int d_polyfirstrow, d_polybandheight;
 
 typedef struct {
     int quotient;
@@ -103,14 +127,12 @@ static adivtab_t adivtab[32 * 32] = {
 #include "adivtab.h"
 };
 
-byte* skintable[MAX_LBM_HEIGHT];
-int skinwidth;
-byte* skinstart;
+static byte* skintable[MAX_LBM_HEIGHT];
+static int skinwidth;
+static byte* skinstart;
 
 void D_PolysetDrawSpans8(spanpackage_t* pspanpackage);
 void D_PolysetCalcGradients(int skinwidth);
-void D_DrawSubdiv(void);
-void D_DrawNonSubdiv(void);
 void D_PolysetRecursiveTriangle(int* p1, int* p2, int* p3);
 void D_PolysetSetEdgeTable(void);
 void D_RasterizeAliasPolySmooth(void);
@@ -119,34 +141,89 @@ void D_PolysetScanLeftEdge(int height);
 /*
 ================
 D_PolysetDraw
+
+Queues the front facing triangles in r_affinetridesc for D_PolysetFlush.  The
+vertices are copied, so the caller's finalverts can be reused right away.
 ================
 */
 void D_PolysetDraw(void)
 {
-    spanpackage_t
-        spans[DPS_MAXSPANS + 1 + ((CACHE_SIZE - 1) / sizeof(spanpackage_t)) + 1];
-    // one extra because of cache line pretouching
+    mtriangle_t* ptri;
+    finalvert_t *pfv, *index[3];
+    polytri_t* pt;
+    int i, j, lnumtriangles;
 
-    a_spans = (spanpackage_t*)(((long)&spans[0] + CACHE_SIZE - 1) & ~(CACHE_SIZE - 1));
+    pfv = r_affinetridesc.pfinalverts;
+    ptri = r_affinetridesc.ptriangles;
+    lnumtriangles = r_affinetridesc.numtriangles;
 
-    if (r_affinetridesc.drawtype) {
-        D_DrawSubdiv();
-    } else {
-        D_DrawNonSubdiv();
+    for (i = 0; i < lnumtriangles; i++, ptri++) {
+        index[0] = pfv + ptri->vertindex[0];
+        index[1] = pfv + ptri->vertindex[1];
+        index[2] = pfv + ptri->vertindex[2];
+
+        if (((index[0]->v[1] - index[1]->v[1]) * (index[0]->v[0] - index[2]->v[0]) - (index[0]->v[0] - index[1]->v[0]) * (index[0]->v[1] - index[2]->v[1])) >= 0) {
+            continue;
+        }
+
+        if (d_numpolytris == MAX_POLYTRIS) {
+            D_PolysetFlush();
+        }
+
+        pt = &d_polytris[d_numpolytris++];
+        pt->top = pt->bottom = index[0]->v[1];
+
+        for (j = 0; j < 3; j++) {
+            memcpy(pt->v[j], index[j]->v, sizeof(pt->v[j]));
+
+            if (!ptri->facesfront && (index[j]->flags & ALIAS_ONSEAM)) {
+                pt->v[j][2] += r_affinetridesc.seamfixupX16;
+            }
+
+            if (pt->v[j][1] < pt->top) {
+                pt->top = pt->v[j][1];
+            }
+
+            if (pt->v[j][1] > pt->bottom) {
+                pt->bottom = pt->v[j][1];
+            }
+        }
     }
 }
 
 /*
 ================
 D_PolysetDrawFinalVerts
+
+Queues the vertices themselves to be plotted ahead of the triangles
 ================
 */
 void D_PolysetDrawFinalVerts(finalvert_t* fv, int numverts)
 {
+    if (d_numpolytris) {
+        D_PolysetFlush();
+    }
+
+    d_polyverts = fv;
+    d_numpolyverts = numverts;
+}
+
+/*
+================
+D_PolysetPlotFinalVerts
+================
+*/
+static void D_PolysetPlotFinalVerts(void)
+{
+    finalvert_t* fv;
     int i, z;
     short* zbuf;
 
-    for (i = 0; i < numverts; i++, fv++) {
+    for (i = 0, fv = d_polyverts; i < d_numpolyverts; i++, fv++) {
+        if (fv->v[1] < d_polytop || fv->v[1] >= d_polybottom) {
+            continue;
+        }
+
         // valid triangle coordinates for filling can include the bottom and
         // right clip edges, due to the fill rule; these shouldn't be drawn
         if ((fv->v[0] < r_refdef.vrectright) && (fv->v[1] < r_refdef.vrectbottom)) {
@@ -166,126 +243,149 @@ void D_PolysetDrawFinalVerts(finalvert_t* fv, int numverts)
 
 /*
 ================
-D_DrawSubdiv
+D_PolysetDrawBand
+
+Draws the part of every queued triangle that falls on the band's rows, in
+queue order.  Each row belongs to exactly one band, so every pixel sees the
+same sequence of z tests it would if the triangles were drawn one by one.
 ================
 */
-void D_DrawSubdiv(void)
+static void D_PolysetDrawBand(int band, void* data)
 {
-    mtriangle_t* ptri;
-    finalvert_t *pfv, *index0, *index1, *index2;
+    spanpackage_t
+        spans[DPS_MAXSPANS + 1 + ((CACHE_SIZE - 1) / sizeof(spanpackage_t)) + 1];
+    // one extra because of cache line pretouching
+    polytri_t* pt;
     int i;
-    int lnumtriangles;
 
-    pfv = r_affinetridesc.pfinalverts;
-    ptri = r_affinetridesc.ptriangles;
-    lnumtriangles = r_affinetridesc.numtriangles;
-
-    for (i = 0; i < lnumtriangles; i++) {
-        index0 = pfv + ptri[i].vertindex[0];
-        index1 = pfv + ptri[i].vertindex[1];
-        index2 = pfv + ptri[i].vertindex[2];
+    UNUSED(data);
 
-        if (((index0->v[1] - index1->v[1]) * (index0->v[0] - index2->v[0]) - (index0->v[0] - index1->v[0]) * (index0->v[1] - index2->v[1])) >= 0) {
-            continue;
-        }
+    a_spans = (spanpackage_t*)(((long)&spans[0] + CACHE_SIZE - 1) & ~(CACHE_SIZE - 1));
 
-        d_pcolormap = &((byte*)acolormap)[index0->v[4] & 0xFF00];
+    d_polytop = d_polyfirstrow + band * d_polybandheight;
+    d_polybottom = d_polytop + d_polybandheight;
 
-        if (ptri[i].facesfront) {
-            D_PolysetRecursiveTriangle(index0->v, index1->v, index2->v);
-        } else {
-            int s0, s1, s2;
+    D_PolysetPlotFinalVerts();
 
-            s0 = index0->v[2];
-            s1 = index1->v[2];
-            s2 = index2->v[2];
+    for (i = d_polybinstart[band]; i < d_polybinstart[band + 1]; i++) {
+        pt = &d_polytris[d_polybins[i]];
 
-            if (index0->flags & ALIAS_ONSEAM) {
-                index0->v[2] += r_affinetridesc.seamfixupX16;
-            }
+        d_pcolormap = &((byte*)acolormap)[pt->v[0][4] & 0xFF00];
 
-            if (index1->flags & ALIAS_ONSEAM) {
-                index1->v[2] += r_affinetridesc.seamfixupX16;
-            }
+        if (r_affinetridesc.drawtype) {
+            D_PolysetRecursiveTriangle(pt->v[0], pt->v[1], pt->v[2]);
+            continue;
+        }
 
-            if (index2->flags & ALIAS_ONSEAM) {
-                index2->v[2] += r_affinetridesc.seamfixupX16;
-            }
+        memcpy(r_p, pt->v, sizeof(r_p));
 
-            D_PolysetRecursiveTriangle(index0->v, index1->v, index2->v);
+        d_xdenom = (r_p[0][1] - r_p[1][1]) * (r_p[0][0] - r_p[2][0]) - (r_p[0][0] - r_p[1][0]) * (r_p[0][1] - r_p[2][1]);
 
-            index0->v[2] = s0;
-            index1->v[2] = s1;
-            index2->v[2] = s2;
-        }
+        D_PolysetSetEdgeTable();
+        D_RasterizeAliasPolySmooth();
     }
 }
 
 /*
 ================
-D_DrawNonSubdiv
+D_PolysetFlush
+
+Draws everything queued since the last flush.  The rows the model covers are
+cut into horizontal bands, the triangles are binned by the rows they span,
+and the bands are drawn in parallel.  Called once the whole model has been
+queued, before anything else can look at the z-buffer.
 ================
 */
-void D_DrawNonSubdiv(void)
+void D_PolysetFlush(void)
 {
-    mtriangle_t* ptri;
-    finalvert_t *pfv, *index0, *index1, *index2;
-    int i;
-    int lnumtriangles;
+    polytri_t* pt;
+    finalvert_t* fv;
+    int i, b, top, bottom, numthreads, numbands;
+    int first[MAX_POLYTRIS], last[MAX_POLYTRIS];
 
-    pfv = r_affinetridesc.pfinalverts;
-    ptri = r_affinetridesc.ptriangles;
-    lnumtriangles = r_affinetridesc.numtriangles;
+    if (!d_numpolytris && !d_numpolyverts) {
+        return;
+    }
 
-    for (i = 0; i < lnumtriangles; i++, ptri++) {
-        index0 = pfv + ptri->vertindex[0];
-        index1 = pfv + ptri->vertindex[1];
-        index2 = pfv + ptri->vertindex[2];
+    top = MAXHEIGHT;
+    bottom = 0;
 
-        d_xdenom = (index0->v[1] - index1->v[1]) * (index0->v[0] - index2->v[0]) - (index0->v[0] - index1->v[0]) * (index0->v[1] - index2->v[1]);
+    for (i = 0, pt = d_polytris; i < d_numpolytris; i++, pt++) {
+        if (pt->top < top) {
+            top = pt->top;
+        }
 
-        if (d_xdenom >= 0) {
-            continue;
+        if (pt->bottom > bottom) {
+            bottom = pt->bottom;
         }
+    }
 
-        r_p0[0] = index0->v[0]; // u
-        r_p0[1] = index0->v[1]; // v
-        r_p0[2] = index0->v[2]; // s
-        r_p0[3] = index0->v[3]; // t
-        r_p0[4] = index0->v[4]; // light
-        r_p0[5] = index0->v[5]; // iz
-
-        r_p1[0] = index1->v[0];
-        r_p1[1] = index1->v[1];
-        r_p1[2] = index1->v[2];
-        r_p1[3] = index1->v[3];
-        r_p1[4] = index1->v[4];
-        r_p1[5] = index1->v[5];
-
-        r_p2[0] = index2->v[0];
-        r_p2[1] = index2->v[1];
-        r_p2[2] = index2->v[2];
-        r_p2[3] = index2->v[3];
-        r_p2[4] = index2->v[4];
-        r_p2[5] = index2->v[5];
-
-        if (!ptri->facesfront) {
-            if (index0->flags & ALIAS_ONSEAM) {
-                r_p0[2] += r_affinetridesc.seamfixupX16;
-            }
+    for (i = 0, fv = d_polyverts; i < d_numpolyverts; i++, fv++) {
+        if (fv->v[1] < top) {
+            top = fv->v[1];
+        }
 
-            if (index1->flags & ALIAS_ONSEAM) {
-                r_p1[2] += r_affinetridesc.seamfixupX16;
-            }
+        if (fv->v[1] > bottom) {
+            bottom = fv->v[1];
+        }
+    }
 
-            if (index2->flags & ALIAS_ONSEAM) {
-                r_p2[2] += r_affinetridesc.seamfixupX16;
-            }
+    numthreads = Sys_NumThreads();
+    if (numthreads > r_threads.value) {
+        numthreads = r_threads.value;
+    }
+
+    numbands = (bottom - top + 1) / MIN_POLY_BAND_HEIGHT;
+    if (numbands > numthreads * POLY_BANDS_PER_THREAD) {
+        numbands = numthreads * POLY_BANDS_PER_THREAD;
+    }
+
+    if (numbands > MAX_POLY_BANDS) {
+        numbands = MAX_POLY_BANDS;
+    }
+
+    if (numthreads <= 1 || numbands < 1) {
+        numbands = 1;
+    }
+
+    d_polyfirstrow = top;
+    d_polybandheight = (bottom - top + numbands) / numbands;
+
+    //
+    // counting sort by band, which keeps the queue order inside each bin
+    //
+    memset(d_polybinstart, 0, sizeof(d_polybinstart));
+
+    for (i = 0, pt = d_polytris; i < d_numpolytris; i++, pt++) {
+        first[i] = (pt->top - top) / d_polybandheight;
+        last[i] = (pt->bottom - top) / d_polybandheight;
+
+        for (b = first[i]; b <= last[i]; b++) {
+            d_polybinstart[b + 1]++;
         }
+    }
 
-        D_PolysetSetEdgeTable();
-        D_RasterizeAliasPolySmooth();
+    for (b = 0; b < numbands; b++) {
+        d_polybinstart[b + 1] += d_polybinstart[b];
     }
+
+    for (i = 0; i < d_numpolytris; i++) {
+        for (b = first[i]; b <= last[i]; b++) {
+            d_polybins[d_polybinstart[b]++] = i;
+        }
+    }
+
+    // filling the bins moved each start up to the next bin's
+    for (b = numbands; b > 0; b--) {
+        d_polybinstart[b] = d_polybinstart[b - 1];
+    }
+
+    d_polybinstart[0] = 0;
+
+    Sys_RunParallel(D_PolysetDrawBand, numbands, NULL);
+
+    d_numpolytris = 0;
+    d_numpolyverts = 0;
 }
 
 /*
@@ -301,6 +401,15 @@ void D_PolysetRecursiveTriangle(int* lp1, int* lp2, int* lp3)
     int z;
     short* zbuf;
 
+    // every point drawn below lies between these three
+    if (lp1[1] < d_polytop && lp2[1] < d_polytop && lp3[1] < d_polytop) {
+        return;
+    }
+
+    if (lp1[1] >= d_polybottom && lp2[1] >= d_polybottom && lp3[1] >= d_polybottom) {
+        return;
+    }
+
     d = lp2[0] - lp1[0];
     if (d < -1 || d > 1) {
         goto split;
@@ -362,6 +471,10 @@ split:
         goto nodraw;
     }
 
+    if (new[1] < d_polytop || new[1] >= d_polybottom) {
+        goto nodraw;
+    }
+
     z = new[5] >> 16;
     zbuf = zspantable[new[1]] + new[0];
     if (z >= *zbuf) {
@@ -505,10 +618,10 @@ void D_PolysetCalcGradients(int skinwidth)
     float xstepdenominv, ystepdenominv, t0, t1;
     float p01_minus_p21, p11_minus_p21, p00_minus_p20, p10_minus_p20;
 
-    p00_minus_p20 = r_p0[0] - r_p2[0];
-    p01_minus_p21 = r_p0[1] - r_p2[1];
-    p10_minus_p20 = r_p1[0] - r_p2[0];
-    p11_minus_p21 = r_p1[1] - r_p2[1];
+    p00_minus_p20 = r_p[0][0] - r_p[2][0];
+    p01_minus_p21 = r_p[0][1] - r_p[2][1];
+    p10_minus_p20 = r_p[1][0] - r_p[2][0];
+    p11_minus_p21 = r_p[1][1] - r_p[2][1];
 
     xstepdenominv = 1.0 / (float)d_xdenom;
 
@@ -517,23 +630,23 @@ void D_PolysetCalcGradients(int skinwidth)
     // ceil () for light so positive steps are exaggerated, negative steps
     // diminished,  pushing us away from underflow toward overflow. Underflow is
     // very visible, overflow is very unlikely, because of ambient lighting
-    t0 = r_p0[4] - r_p2[4];
-    t1 = r_p1[4] - r_p2[4];
+    t0 = r_p[0][4] - r_p[2][4];
+    t1 = r_p[1][4] - r_p[2][4];
     r_lstepx = (int)ceil((t1 * p01_minus_p21 - t0 * p11_minus_p21) * xstepdenominv);
     r_lstepy = (int)ceil((t1 * p00_minus_p20 - t0 * p10_minus_p20) * ystepdenominv);
 
-    t0 = r_p0[2] - r_p2[2];
-    t1 = r_p1[2] - r_p2[2];
+    t0 = r_p[0][2] - r_p[2][2];
+    t1 = r_p[1][2] - r_p[2][2];
     r_sstepx = (int)((t1 * p01_minus_p21 - t0 * p11_minus_p21) * xstepdenominv);
     r_sstepy = (int)((t1 * p00_minus_p20 - t0 * p10_minus_p20) * ystepdenominv);
 
-    t0 = r_p0[3] - r_p2[3];
-    t1 = r_p1[3] - r_p2[3];
+    t0 = r_p[0][3] - r_p[2][3];
+    t1 = r_p[1][3] - r_p[2][3];
     r_tstepx = (int)((t1 * p01_minus_p21 - t0 * p11_minus_p21) * xstepdenominv);
     r_tstepy = (int)((t1 * p00_minus_p20 - t0 * p10_minus_p20) * ystepdenominv);
 
-    t0 = r_p0[5] - r_p2[5];
-    t1 = r_p1[5] - r_p2[5];
+    t0 = r_p[0][5] - r_p[2][5];
+    t1 = r_p[1][5] - r_p[2][5];
     r_zistepx = (int)((t1 * p01_minus_p21 - t0 * p11_minus_p21) * xstepdenominv);
     r_zistepy = (int)((t1 * p00_minus_p20 - t0 * p10_minus_p20) * ystepdenominv);
 
@@ -556,8 +669,16 @@ void D_PolysetDrawSpans8(spanpackage_t* pspanpackage)
     int llight;
     int lzi;
     short* lpz;
+    int y;
+
+    y = d_aspantop + (pspanpackage - a_spans);
 
     do {
+        // the rest of the triangle belongs to the bands below
+        if (y >= d_polybottom) {
+            return;
+        }
+
         lcount = d_aspancount - pspanpackage->count;
 
         errorterm += erroradjustup;
@@ -568,7 +689,7 @@ void D_PolysetDrawSpans8(spanpackage_t* pspanpackage)
             d_aspancount += ubasestep;
         }
 
-        if (lcount) {
+        if (lcount && y >= d_polytop) {
             lpdest = pspanpackage->pdest;
             lptex = pspanpackage->ptex;
             lpz = pspanpackage->pz;
@@ -654,6 +775,7 @@ void D_PolysetDrawSpans8(spanpackage_t* pspanpackage)
         }
 
         pspanpackage++;
+        y++;
     } while (pspanpackage->count != -999999);
 }
 
@@ -703,11 +825,11 @@ void D_RasterizeAliasPolySmooth(void)
     int *plefttop, *prighttop, *pleftbottom, *prightbottom;
     int working_lstepx, originalcount;
 
-    plefttop = pedgetable->pleftedgevert0;
-    prighttop = pedgetable->prightedgevert0;
+    plefttop = r_p[pedgetable->leftedgevert0];
+    prighttop = r_p[pedgetable->rightedgevert0];
 
-    pleftbottom = pedgetable->pleftedgevert1;
-    prightbottom = pedgetable->prightedgevert1;
+    pleftbottom = r_p[pedgetable->leftedgevert1];
+    prightbottom = r_p[pedgetable->rightedgevert1];
 
     initialleftheight = pleftbottom[1] - plefttop[1];
     initialrightheight = prightbottom[1] - prighttop[1];
@@ -728,6 +850,7 @@ void D_RasterizeAliasPolySmooth(void)
     d_pedgespanpackage = a_spans;
 
     ystart = plefttop[1];
+    d_aspantop = ystart;
     d_aspancount = plefttop[0] - prighttop[0];
 
     d_ptex = (byte*)r_affinetridesc.pskin + (plefttop[2] >> 16) + (plefttop[3] >> 16) * r_affinetridesc.skinwidth;
@@ -797,7 +920,7 @@ void D_RasterizeAliasPolySmooth(void)
         int height;
 
         plefttop = pleftbottom;
-        pleftbottom = pedgetable->pleftedgevert2;
+        pleftbottom = r_p[pedgetable->leftedgevert2];
 
         height = pleftbottom[1] - plefttop[1];
 
@@ -883,7 +1006,7 @@ void D_RasterizeAliasPolySmooth(void)
         d_aspancount = prightbottom[0] - prighttop[0];
 
         prighttop = prightbottom;
-        prightbottom = pedgetable->prightedgevert2;
+        prightbottom = r_p[pedgetable->rightedgevert2];
 
         height = prightbottom[1] - prighttop[1];
 
@@ -913,9 +1036,9 @@ void D_PolysetSetEdgeTable(void)
     // determine which edges are right & left, and the order in which
     // to rasterize them
     //
-    if (r_p0[1] >= r_p1[1]) {
-        if (r_p0[1] == r_p1[1]) {
-            if (r_p0[1] < r_p2[1]) {
+    if (r_p[0][1] >= r_p[1][1]) {
+        if (r_p[0][1] == r_p[1][1]) {
+            if (r_p[0][1] < r_p[2][1]) {
                 pedgetable = &edgetables[2];
             } else {
                 pedgetable = &edgetables[5];
@@ -927,7 +1050,7 @@ void D_PolysetSetEdgeTable(void)
         }
     }
 
-    if (r_p0[1] == r_p2[1]) {
+    if (r_p[0][1] == r_p[2][1]) {
         if (edgetableindex) {
             pedgetable = &edgetables[8];
         } else {
@@ -935,7 +1058,7 @@ void D_PolysetSetEdgeTable(void)
         }
 
         return;
-    } else if (r_p1[1] == r_p2[1]) {
+    } else if (r_p[1][1] == r_p[2][1]) {
         if (edgetableindex) {
             pedgetable = &edgetables[10];
         } else {
@@ -945,11 +1068,11 @@ void D_PolysetSetEdgeTable(void)
         return;
     }
 
-    if (r_p0[1] > r_p2[1]) {
+    if (r_p[0][1] > r_p[2][1]) {
         edgetableindex += 2;
     }
 
-    if (r_p1[1] > r_p2[1]) {
+    if (r_p[1][1] > r_p[2][1]) {
         edgetableindex += 4;
     }
 
@@ -25,33 +25,58 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "r_local.h"
 #include "d_local.h"
 
-unsigned char *r_turb_pbase, *r_turb_pdest;
-fixed16_t r_turb_s, r_turb_t, r_turb_sstep, r_turb_tstep;
-int* r_turb_turb;
-int r_turb_spancount;
+THREAD_LOCAL unsigned char *r_turb_pbase, *r_turb_pdest;
+THREAD_LOCAL fixed16_t r_turb_s, r_turb_t, r_turb_sstep, r_turb_tstep;
+THREAD_LOCAL int* r_turb_turb;
+THREAD_LOCAL int r_turb_spancount;
 
 void D_DrawTurbulent8Span(void);
+void D_DrawTurbulentFrame8Span(void);
+
+#define MIN_WARP_BAND 16 // rows per job, fewer isn't worth a thread
+
+// the warp tables only depend on the view and screen rects, so they are
+// kept until one of them changes
+static int d_warprows[MAXHEIGHT + (AMP2 * 2)]; // source row offsets
+static int d_warpcolumns[MAXWIDTH + (AMP2 * 2)];
+static vrect_t d_warpview, d_warpscreen;
+static int d_warpwidth = -1;
+
+static int* d_warpturb;
+static int d_warpbandheight;
 
 /*
 =============
-D_WarpScreen
+D_SameRect
+=============
+*/
+static qboolean D_SameRect(vrect_t* a, vrect_t* b)
+{
+    return a->x == b->x && a->y == b->y && a->width == b->width && a->height == b->height;
+}
+
+/*
+=============
+D_WarpTables
 
-// this performs a slight compression of the screen at the same time as
-// the sine warp, to keep the edges from wrapping
+this performs a slight compression of the screen at the same time as
+the sine warp, to keep the edges from wrapping
 =============
 */
-void D_WarpScreen(void)
+static void D_WarpTables(void)
 {
     int w, h;
     int u, v;
-    byte* dest;
-    int* turb;
-    int* col;
-    byte** row;
-    byte* rowptr[MAXHEIGHT + (AMP2 * 2)];
-    int column[MAXWIDTH + (AMP2 * 2)];
     float wratio, hratio;
 
+    if (screenwidth == d_warpwidth && D_SameRect(&r_refdef.vrect, &d_warpview) && D_SameRect(&scr_vrect, &d_warpscreen)) {
+        return;
+    }
+
+    d_warpwidth = screenwidth;
+    d_warpview = r_refdef.vrect;
+    d_warpscreen = scr_vrect;
+
     w = r_refdef.vrect.width;
     h = r_refdef.vrect.height;
 
@@ -59,26 +84,127 @@ void D_WarpScreen(void)
     hratio = h / (float)scr_vrect.height;
 
     for (v = 0; v < scr_vrect.height + AMP2 * 2; v++) {
-        rowptr[v] = d_viewbuffer + (r_refdef.vrect.y * screenwidth) + (screenwidth * (int)((float)v * hratio * h / (h + AMP2 * 2)));
+        d_warprows[v] = (r_refdef.vrect.y * screenwidth) + (screenwidth * (int)((float)v * hratio * h / (h + AMP2 * 2)));
     }
 
     for (u = 0; u < scr_vrect.width + AMP2 * 2; u++) {
-        column[u] = r_refdef.vrect.x + (int)((float)u * wratio * w / (w + AMP2 * 2));
+        d_warpcolumns[u] = r_refdef.vrect.x + (int)((float)u * wratio * w / (w + AMP2 * 2));
+    }
+}
+
+/*
+=============
+D_WarpRow
+
+Fills one screen row; rows and columns are already offset by the row's own
+turbulence
+=============
+*/
+void D_WarpRow(byte* dest, byte* src, int* rows, int* columns, int* turb, int count)
+{
+    int u;
+
+    for (u = 0; u < count; u++) {
+        dest[u] = src[rows[turb[u]] + columns[u]];
+    }
+}
+
+/*
+=============
+D_WarpBand
+=============
+*/
+static void D_WarpBand(int job, void* data)
+{
+    int v, vend;
+    byte* dest;
+
+    UNUSED(data);
+
+    v = job * d_warpbandheight;
+    vend = v + d_warpbandheight;
+    if (vend > scr_vrect.height) {
+        vend = scr_vrect.height;
+    }
+
+    dest = vid.buffer + (scr_vrect.y + v) * vid.rowbytes + scr_vrect.x;
+
+    for (; v < vend; v++, dest += vid.rowbytes) {
+        (*d_warprow)(dest, d_viewbuffer, &d_warprows[v], &d_warpcolumns[d_warpturb[v]], d_warpturb, scr_vrect.width);
+    }
+}
+
+/*
+=============
+D_WarpScreen
+=============
+*/
+void D_WarpScreen(void)
+{
+    int numthreads, numbands;
+
+    D_WarpTables();
+
+    d_warpturb = intsintable + ((int)(cl.time * SPEED) & (CYCLE - 1));
+
+    numthreads = Sys_NumThreads();
+    if (numthreads > r_threads.value) {
+        numthreads = r_threads.value;
+    }
+
+    numbands = scr_vrect.height / MIN_WARP_BAND;
+    if (numbands > numthreads) {
+        numbands = numthreads;
+    }
+
+    if (numbands > 1) {
+        d_warpbandheight = (scr_vrect.height + numbands - 1) / numbands;
+        Sys_RunParallel(D_WarpBand, numbands, NULL);
+    } else {
+        d_warpbandheight = scr_vrect.height;
+        D_WarpBand(0, NULL);
+    }
+}
+
+/*
+=============
+D_ScaleScreen
+
+Stretches the 3D view drawn at a lower resolution in r_scalebuffer up to
+scr_vrect in the real screen
+=============
+*/
+void D_ScaleScreen(void)
+{
+    int u, v, w, h, sv, lastsv;
+    byte *src, *dest;
+    int column[MAXWIDTH];
+
+    w = r_refdef.vrect.width;
+    h = r_refdef.vrect.height;
+
+    for (u = 0; u < scr_vrect.width; u++) {
+        column[u] = r_refdef.vrect.x + u * w / scr_vrect.width;
     }
 
-    turb = intsintable + ((int)(cl.time * SPEED) & (CYCLE - 1));
     dest = vid.buffer + scr_vrect.y * vid.rowbytes + scr_vrect.x;
+    lastsv = -1;
 
     for (v = 0; v < scr_vrect.height; v++, dest += vid.rowbytes) {
-        col = &column[turb[v]];
-        row = &rowptr[v];
-
-        for (u = 0; u < scr_vrect.width; u += 4) {
-            dest[u + 0] = row[turb[u + 0]][col[u + 0]];
-            dest[u + 1] = row[turb[u + 1]][col[u + 1]];
-            dest[u + 2] = row[turb[u + 2]][col[u + 2]];
-            dest[u + 3] = row[turb[u + 3]][col[u + 3]];
+        sv = r_refdef.vrect.y + v * h / scr_vrect.height;
+
+        // repeated rows are just copies of the one above
+        if (sv == lastsv) {
+            memcpy(dest, dest - vid.rowbytes, scr_vrect.width);
+            continue;
+        }
+
+        src = r_scalebuffer + sv * vid.width;
+        for (u = 0; u < scr_vrect.width; u++) {
+            dest[u] = src[column[u]];
         }
+
+        lastsv = sv;
     }
 }
 
@@ -100,9 +226,30 @@ void D_DrawTurbulent8Span(void)
     } while (--r_turb_spancount > 0);
 }
 
+/*
+=============
+D_DrawTurbulentFrame8Span
+
+Same as D_DrawTurbulent8Span, from a tile R_TurbFrame has already warped.
+The warp is applied at whole texels, so it can land one texel away from
+the per-pixel one.
+=============
+*/
+void D_DrawTurbulentFrame8Span(void)
+{
+    do {
+        *r_turb_pdest++ = r_turb_pbase[(((r_turb_t >> 16) & (TILE_SIZE - 1)) * TILE_SIZE) + ((r_turb_s >> 16) & (TILE_SIZE - 1))];
+        r_turb_s += r_turb_sstep;
+        r_turb_t += r_turb_tstep;
+    } while (--r_turb_spancount > 0);
+}
+
 /*
 =============
 Turbulent8
+
+cacheblock is either the raw 64x64 texture or a TILE_SIZE frame from
+R_TurbFrame, told apart by cachewidth
 =============
 */
 void Turbulent8(espan_t* pspan)
@@ -224,7 +371,11 @@ void Turbulent8(espan_t* pspan)
             r_turb_s = r_turb_s & ((CYCLE << 16) - 1);
             r_turb_t = r_turb_t & ((CYCLE << 16) - 1);
 
-            D_DrawTurbulent8Span();
+            if (cachewidth == TILE_SIZE) {
+                D_DrawTurbulentFrame8Span();
+            } else {
+                D_DrawTurbulent8Span();
+            }
 
             r_turb_s = snext;
             r_turb_t = tnext;
@@ -0,0 +1,648 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// d_simd.c: SSE2 and AVX2 versions of the span drawers
+//
+// These have to produce exactly what D_DrawSpans8 and D_DrawZSpans do, so the
+// perspective divide still happens every 8 pixels in the same order; only the
+// per-pixel texel addressing, dithering and z stepping run in vector lanes.
+
+#include "quakedef.h"
+#include "r_local.h"
+#include "d_local.h"
+
+cvar_t d_spankernel = { "d_spankernel", "2" }; // 0 = C, 1 = SSE2, 2 = AVX2
+
+void (*d_drawzspans)(espan_t* pspan);
+void (*d_warprow)(byte* dest, byte* src, int* rows, int* columns, int* turb, int count);
+
+static char* d_spankernelnames[] = { "C", "SSE2", "AVX2" };
+static int d_spankernellevel;
+
+#if defined(__SSE2__)
+
+#include <immintrin.h>
+
+/*
+=============
+D_SpanStart
+
+The start of every span is worked out exactly like D_DrawSpans8
+=============
+*/
+static inline void D_SpanStart(espan_t* pspan, float* sdivz, float* tdivz, float* zi, fixed16_t* s, fixed16_t* t)
+{
+    float du, dv, z;
+
+    du = (float)pspan->u;
+    dv = (float)pspan->v;
+
+    *sdivz = d_sdivzorigin + dv * d_sdivzstepv + du * d_sdivzstepu;
+    *tdivz = d_tdivzorigin + dv * d_tdivzstepv + du * d_tdivzstepu;
+    *zi = d_ziorigin + dv * d_zistepv + du * d_zistepu;
+    z = (float)0x10000 / *zi; // prescale to 16.16 fixed-point
+
+    *s = (int)(*sdivz * z) + sadjust;
+    if (*s > bbextents) {
+        *s = bbextents;
+    } else if (*s < 0) {
+        *s = 0;
+    }
+
+    *t = (int)(*tdivz * z) + tadjust;
+    if (*t > bbextentt) {
+        *t = bbextentt;
+    } else if (*t < 0) {
+        *t = 0;
+    }
+}
+
+/*
+=============
+D_SpanEnd
+
+Works out s and t at the end of a subspan, and the steps to get there
+=============
+*/
+static inline void D_SpanEnd(int count, int spancount, float sdivz8stepu, float tdivz8stepu, float zi8stepu,
+    float* sdivz, float* tdivz, float* zi, fixed16_t s, fixed16_t t,
+    fixed16_t* snext, fixed16_t* tnext, fixed16_t* sstep, fixed16_t* tstep)
+{
+    float z, spancountminus1;
+
+    if (count) {
+        *sdivz += sdivz8stepu;
+        *tdivz += tdivz8stepu;
+        *zi += zi8stepu;
+        z = (float)0x10000 / *zi; // prescale to 16.16 fixed-point
+
+        *snext = (int)(*sdivz * z) + sadjust;
+        if (*snext > bbextents) {
+            *snext = bbextents;
+        } else if (*snext < 8) {
+            *snext = 8;
+        }
+
+        *tnext = (int)(*tdivz * z) + tadjust;
+        if (*tnext > bbextentt) {
+            *tnext = bbextentt;
+        } else if (*tnext < 8) {
+            *tnext = 8;
+        }
+
+        *sstep = (*snext - s) >> 3;
+        *tstep = (*tnext - t) >> 3;
+    } else {
+        spancountminus1 = (float)(spancount - 1);
+        *sdivz += d_sdivzstepu * spancountminus1;
+        *tdivz += d_tdivzstepu * spancountminus1;
+        *zi += d_zistepu * spancountminus1;
+        z = (float)0x10000 / *zi; // prescale to 16.16 fixed-point
+        *snext = (int)(*sdivz * z) + sadjust;
+        if (*snext > bbextents) {
+            *snext = bbextents;
+        } else if (*snext < 8) {
+            *snext = 8;
+        }
+
+        *tnext = (int)(*tdivz * z) + tadjust;
+        if (*tnext > bbextentt) {
+            *tnext = bbextentt;
+        } else if (*tnext < 8) {
+            *tnext = 8;
+        }
+
+        if (spancount > 1) {
+            *sstep = (*snext - s) / (spancount - 1);
+            *tstep = (*tnext - t) / (spancount - 1);
+        }
+    }
+}
+
+/*
+=============
+D_SpanTail
+
+Less than 8 pixels left, same loop as D_DrawSpans8
+=============
+*/
+static inline void D_SpanTail(espan_t* pspan, unsigned char* pdest, unsigned char* pbase, int spancount,
+    fixed16_t s, fixed16_t t, fixed16_t sstep, fixed16_t tstep)
+{
+    if (r_udither.value == 0) {
+        do {
+            *pdest++ = *(pbase + (s >> 16) + (t >> 16) * cachewidth);
+            s += sstep;
+            t += tstep;
+        } while (--spancount > 0);
+    } else {
+        do {
+            int idiths = s;
+            int iditht = t;
+
+            int X = (pspan->u + spancount) & 1;
+            int Y = (pspan->v) & 1;
+
+            idiths += r_ditherkernel[X][Y][0];
+            iditht += r_ditherkernel[X][Y][1];
+
+            idiths = idiths >> 16;
+            idiths = idiths ? idiths - 1 : idiths;
+
+            iditht = iditht >> 16;
+            iditht = iditht ? iditht - 1 : iditht;
+
+            *pdest++ = *(pbase + idiths + iditht * cachewidth);
+            s += sstep;
+            t += tstep;
+        } while (--spancount > 0);
+    }
+}
+
+//=============================================================================
+
+/*
+=============
+D_DitherLanes
+
+For a full 8 pixel subspan the dither column of pixel k is (u + 8 - k) & 1,
+which is just (u + k) & 1
+=============
+*/
+static inline void D_DitherLanes(espan_t* pspan, int* dithers, int* dithert)
+{
+    int k, X, Y;
+
+    Y = pspan->v & 1;
+    for (k = 0; k < 8; k++) {
+        X = (pspan->u + k) & 1;
+        dithers[k] = r_ditherkernel[X][Y][0];
+        dithert[k] = r_ditherkernel[X][Y][1];
+    }
+}
+
+/*
+=============
+D_MulLo32_SSE2
+
+SSE2 has no 32 bit multiply, so do the even and odd lanes separately
+=============
+*/
+static inline __m128i D_MulLo32_SSE2(__m128i a, __m128i b)
+{
+    __m128i even, odd;
+
+    even = _mm_mul_epu32(a, b);
+    odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+        _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+/*
+=============
+D_DitherIndex_SSE2
+
+((x + dither) >> 16), minus one unless that came out zero
+=============
+*/
+static inline __m128i D_DitherIndex_SSE2(__m128i x, __m128i dither)
+{
+    x = _mm_srai_epi32(_mm_add_epi32(x, dither), 16);
+
+    return _mm_sub_epi32(_mm_sub_epi32(x, _mm_set1_epi32(1)), _mm_cmpeq_epi32(x, _mm_setzero_si128()));
+}
+
+/*
+=============
+D_DrawSpans8_SSE2
+=============
+*/
+void D_DrawSpans8_SSE2(espan_t* pspan)
+{
+    int count, spancount, k;
+    unsigned char *pbase, *pdest;
+    fixed16_t s, t, snext, tnext, sstep, tstep;
+    float sdivz, tdivz, zi;
+    float sdivz8stepu, tdivz8stepu, zi8stepu;
+    int dithers[8], dithert[8];
+    __m128i ramp0, ramp1, width, dithers0, dithers1, dithert0, dithert1;
+    __m128i vs0, vs1, vt0, vt1, vsstep, vtstep;
+    union {
+        __m128i v[2];
+        int i[8];
+    } offsets;
+    qboolean dither;
+
+    sstep = 0; // keep compiler happy
+    tstep = 0; // ditto
+
+    pbase = (unsigned char*)cacheblock;
+
+    sdivz8stepu = d_sdivzstepu * 8;
+    tdivz8stepu = d_tdivzstepu * 8;
+    zi8stepu = d_zistepu * 8;
+
+    dither = r_udither.value != 0;
+    ramp0 = _mm_setr_epi32(0, 1, 2, 3);
+    ramp1 = _mm_setr_epi32(4, 5, 6, 7);
+    width = _mm_set1_epi32(cachewidth);
+
+    do {
+        pdest = (unsigned char*)((byte*)d_viewbuffer + (screenwidth * pspan->v) + pspan->u);
+
+        count = pspan->count;
+
+        D_SpanStart(pspan, &sdivz, &tdivz, &zi, &s, &t);
+
+        D_DitherLanes(pspan, dithers, dithert);
+        dithers0 = _mm_loadu_si128((__m128i*)&dithers[0]);
+        dithers1 = _mm_loadu_si128((__m128i*)&dithers[4]);
+        dithert0 = _mm_loadu_si128((__m128i*)&dithert[0]);
+        dithert1 = _mm_loadu_si128((__m128i*)&dithert[4]);
+
+        do {
+            // calculate s and t at the far end of the span
+            if (count >= 8) {
+                spancount = 8;
+            } else {
+                spancount = count;
+            }
+
+            count -= spancount;
+
+            D_SpanEnd(count, spancount, sdivz8stepu, tdivz8stepu, zi8stepu,
+                &sdivz, &tdivz, &zi, s, t, &snext, &tnext, &sstep, &tstep);
+
+            if (spancount < 8) {
+                D_SpanTail(pspan, pdest, pbase, spancount, s, t, sstep, tstep);
+                break;
+            }
+
+            vsstep = _mm_set1_epi32(sstep);
+            vtstep = _mm_set1_epi32(tstep);
+            vs0 = _mm_add_epi32(_mm_set1_epi32(s), D_MulLo32_SSE2(ramp0, vsstep));
+            vs1 = _mm_add_epi32(_mm_set1_epi32(s), D_MulLo32_SSE2(ramp1, vsstep));
+            vt0 = _mm_add_epi32(_mm_set1_epi32(t), D_MulLo32_SSE2(ramp0, vtstep));
+            vt1 = _mm_add_epi32(_mm_set1_epi32(t), D_MulLo32_SSE2(ramp1, vtstep));
+
+            if (dither) {
+                vs0 = D_DitherIndex_SSE2(vs0, dithers0);
+                vs1 = D_DitherIndex_SSE2(vs1, dithers1);
+                vt0 = D_DitherIndex_SSE2(vt0, dithert0);
+                vt1 = D_DitherIndex_SSE2(vt1, dithert1);
+            } else {
+                vs0 = _mm_srai_epi32(vs0, 16);
+                vs1 = _mm_srai_epi32(vs1, 16);
+                vt0 = _mm_srai_epi32(vt0, 16);
+                vt1 = _mm_srai_epi32(vt1, 16);
+            }
+
+            offsets.v[0] = _mm_add_epi32(vs0, D_MulLo32_SSE2(vt0, width));
+            offsets.v[1] = _mm_add_epi32(vs1, D_MulLo32_SSE2(vt1, width));
+
+            for (k = 0; k < 8; k++) {
+                pdest[k] = pbase[offsets.i[k]];
+            }
+
+            pdest += 8;
+            s = snext;
+            t = tnext;
+        } while (count > 0);
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+/*
+=============
+D_DrawZSpans_SSE2
+=============
+*/
+void D_DrawZSpans_SSE2(espan_t* pspan)
+{
+    int count, izistep;
+    int izi;
+    short* pdest;
+    double zi;
+    float du, dv;
+    __m128i ramp, step4, a, b;
+
+    // FIXME: check for clamping/range problems
+    // we count on FP exceptions being turned off to avoid range problems
+    izistep = (int)(d_zistepu * 0x8000 * 0x10000);
+
+    ramp = _mm_setr_epi32(0, izistep, (unsigned)izistep * 2, (unsigned)izistep * 3);
+    step4 = _mm_set1_epi32((unsigned)izistep * 4);
+
+    do {
+        pdest = d_pzbuffer + (d_zwidth * pspan->v) + pspan->u;
+
+        count = pspan->count;
+
+        // calculate the initial 1/z
+        du = (float)pspan->u;
+        dv = (float)pspan->v;
+
+        zi = d_ziorigin + dv * d_zistepv + du * d_zistepu;
+        // we count on FP exceptions being turned off to avoid range problems
+        izi = (int)(zi * 0x8000 * 0x10000);
+
+        // the top 16 bits of each lane always fit a short, so the saturating
+        // pack is exact
+        a = _mm_add_epi32(_mm_set1_epi32(izi), ramp);
+        for (; count >= 8; count -= 8, pdest += 8) {
+            b = _mm_add_epi32(a, step4);
+            _mm_storeu_si128((__m128i*)pdest, _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+            a = _mm_add_epi32(b, step4);
+        }
+
+        izi = _mm_cvtsi128_si32(a);
+        for (; count > 0; count--) {
+            *pdest++ = (short)(izi >> 16);
+            izi = (unsigned)izi + izistep;
+        }
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+//=============================================================================
+
+/*
+=============
+D_DrawSpans8_AVX2
+
+Same as the SSE2 version, with all 8 pixels in one register and the texels
+fetched with a hardware gather.  The gather reads a dword per texel, which
+can run up to 3 bytes past the end of a surface; the surface cache always has
+a following block or the guard bytes there.
+=============
+*/
+__attribute__((target("avx2"))) void D_DrawSpans8_AVX2(espan_t* pspan)
+{
+    int count, spancount;
+    unsigned char *pbase, *pdest;
+    fixed16_t s, t, snext, tnext, sstep, tstep;
+    float sdivz, tdivz, zi;
+    float sdivz8stepu, tdivz8stepu, zi8stepu;
+    int dithers[8], dithert[8];
+    __m256i ramp, width, vdithers, vdithert, one, zero, vs, vt, texels;
+    __m128i packed;
+    qboolean dither;
+
+    sstep = 0; // keep compiler happy
+    tstep = 0; // ditto
+
+    pbase = (unsigned char*)cacheblock;
+
+    sdivz8stepu = d_sdivzstepu * 8;
+    tdivz8stepu = d_tdivzstepu * 8;
+    zi8stepu = d_zistepu * 8;
+
+    dither = r_udither.value != 0;
+    ramp = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    width = _mm256_set1_epi32(cachewidth);
+    one = _mm256_set1_epi32(1);
+    zero = _mm256_setzero_si256();
+
+    do {
+        pdest = (unsigned char*)((byte*)d_viewbuffer + (screenwidth * pspan->v) + pspan->u);
+
+        count = pspan->count;
+
+        D_SpanStart(pspan, &sdivz, &tdivz, &zi, &s, &t);
+
+        D_DitherLanes(pspan, dithers, dithert);
+        vdithers = _mm256_loadu_si256((__m256i*)dithers);
+        vdithert = _mm256_loadu_si256((__m256i*)dithert);
+
+        do {
+            // calculate s and t at the far end of the span
+            if (count >= 8) {
+                spancount = 8;
+            } else {
+                spancount = count;
+            }
+
+            count -= spancount;
+
+            D_SpanEnd(count, spancount, sdivz8stepu, tdivz8stepu, zi8stepu,
+                &sdivz, &tdivz, &zi, s, t, &snext, &tnext, &sstep, &tstep);
+
+            if (spancount < 8) {
+                D_SpanTail(pspan, pdest, pbase, spancount, s, t, sstep, tstep);
+                break;
+            }
+
+            vs = _mm256_add_epi32(_mm256_set1_epi32(s), _mm256_mullo_epi32(ramp, _mm256_set1_epi32(sstep)));
+            vt = _mm256_add_epi32(_mm256_set1_epi32(t), _mm256_mullo_epi32(ramp, _mm256_set1_epi32(tstep)));
+
+            if (dither) {
+                vs = _mm256_srai_epi32(_mm256_add_epi32(vs, vdithers), 16);
+                vs = _mm256_sub_epi32(_mm256_sub_epi32(vs, one), _mm256_cmpeq_epi32(vs, zero));
+                vt = _mm256_srai_epi32(_mm256_add_epi32(vt, vdithert), 16);
+                vt = _mm256_sub_epi32(_mm256_sub_epi32(vt, one), _mm256_cmpeq_epi32(vt, zero));
+            } else {
+                vs = _mm256_srai_epi32(vs, 16);
+                vt = _mm256_srai_epi32(vt, 16);
+            }
+
+            texels = _mm256_i32gather_epi32((const int*)pbase, _mm256_add_epi32(vs, _mm256_mullo_epi32(vt, width)), 1);
+
+            // keep the low byte of every dword
+            texels = _mm256_and_si256(texels, _mm256_set1_epi32(0xFF));
+            packed = _mm_packus_epi32(_mm256_castsi256_si128(texels), _mm256_extracti128_si256(texels, 1));
+            packed = _mm_packus_epi16(packed, packed);
+            _mm_storel_epi64((__m128i*)pdest, packed);
+
+            pdest += 8;
+            s = snext;
+            t = tnext;
+        } while (count > 0);
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+/*
+=============
+D_DrawZSpans_AVX2
+=============
+*/
+__attribute__((target("avx2"))) void D_DrawZSpans_AVX2(espan_t* pspan)
+{
+    int count, izistep;
+    int izi;
+    short* pdest;
+    double zi;
+    float du, dv;
+    __m256i ramp, step8, a, b;
+
+    // FIXME: check for clamping/range problems
+    // we count on FP exceptions being turned off to avoid range problems
+    izistep = (int)(d_zistepu * 0x8000 * 0x10000);
+
+    ramp = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(izistep));
+    step8 = _mm256_set1_epi32((unsigned)izistep * 8);
+
+    do {
+        pdest = d_pzbuffer + (d_zwidth * pspan->v) + pspan->u;
+
+        count = pspan->count;
+
+        // calculate the initial 1/z
+        du = (float)pspan->u;
+        dv = (float)pspan->v;
+
+        zi = d_ziorigin + dv * d_zistepv + du * d_zistepu;
+        // we count on FP exceptions being turned off to avoid range problems
+        izi = (int)(zi * 0x8000 * 0x10000);
+
+        // packs works within 128 bit halves, so put the quadwords back in
+        // pixel order afterwards
+        a = _mm256_add_epi32(_mm256_set1_epi32(izi), ramp);
+        for (; count >= 16; count -= 16, pdest += 16) {
+            b = _mm256_add_epi32(a, step8);
+            _mm256_storeu_si256((__m256i*)pdest,
+                _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_srai_epi32(a, 16), _mm256_srai_epi32(b, 16)),
+                    _MM_SHUFFLE(3, 1, 2, 0)));
+            a = _mm256_add_epi32(b, step8);
+        }
+
+        izi = _mm256_extract_epi32(a, 0);
+        for (; count > 0; count--) {
+            *pdest++ = (short)(izi >> 16);
+            izi = (unsigned)izi + izistep;
+        }
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+/*
+=============
+D_WarpRow_AVX2
+
+D_WarpRow with both lookups done as gathers.  The pixel gather reads a whole
+dword, so the source needs three bytes of slack past its last pixel.
+=============
+*/
+__attribute__((target("avx2"))) void D_WarpRow_AVX2(byte* dest, byte* src, int* rows, int* columns, int* turb, int count)
+{
+    __m256i offsets, pixels, pick, order;
+    int u;
+
+    // low byte of each dword, then the two halves side by side
+    pick = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    order = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+
+    for (u = 0; u + 8 <= count; u += 8) {
+        offsets = _mm256_i32gather_epi32(rows, _mm256_loadu_si256((__m256i*)(turb + u)), 4);
+        offsets = _mm256_add_epi32(offsets, _mm256_loadu_si256((__m256i*)(columns + u)));
+        pixels = _mm256_i32gather_epi32((const int*)src, offsets, 1);
+        pixels = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(pixels, pick), order);
+        _mm_storel_epi64((__m128i*)(dest + u), _mm256_castsi256_si128(pixels));
+    }
+
+    for (; u < count; u++) {
+        dest[u] = src[rows[turb[u]] + columns[u]];
+    }
+}
+
+/*
+=============
+D_CPULevel
+
+Highest kernel this CPU can run
+=============
+*/
+static int D_CPULevel(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return 2;
+    }
+
+    return 1;
+}
+
+#else
+
+static int D_CPULevel(void)
+{
+    return 0;
+}
+
+#endif // __SSE2__
+
+/*
+=============
+D_SelectSpanKernels
+
+Picks the best span drawers the CPU supports, capped by d_spankernel
+=============
+*/
+void D_SelectSpanKernels(void)
+{
+    static int cpulevel = -1;
+    int level;
+
+    if (cpulevel < 0) {
+        cpulevel = D_CPULevel();
+    }
+
+    level = (int)d_spankernel.value;
+    if (level > cpulevel) {
+        level = cpulevel;
+    } else if (level < 0) {
+        level = 0;
+    }
+
+    switch (level) {
+#if defined(__SSE2__)
+    case 2:
+        d_drawspans = D_DrawSpans8_AVX2;
+        d_drawzspans = D_DrawZSpans_AVX2;
+        d_warprow = D_WarpRow_AVX2;
+        break;
+
+    case 1:
+        d_drawspans = D_DrawSpans8_SSE2;
+        d_drawzspans = D_DrawZSpans_SSE2;
+        d_warprow = D_WarpRow; // nothing to gain without a gather
+        break;
+#endif
+
+    default:
+        d_drawspans = D_DrawSpans8;
+        d_drawzspans = D_DrawZSpans;
+        d_warprow = D_WarpRow;
+        break;
+    }
+
+    if (level != d_spankernellevel) {
+        Con_DPrintf("Using %s span drawers\n", d_spankernelnames[level]);
+    }
+
+    d_spankernellevel = level;
+}
+
+/*
+=============
+D_SpanKernelName
+=============
+*/
+char* D_SpanKernelName(void)
+{
+    return d_spankernelnames[d_spankernellevel];
+}
@@ -25,9 +25,45 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 float surfscale;
 qboolean r_cache_thrash; // set if surface cache is thrashing
-
-int sc_size;
-surfcache_t *sc_rover, *sc_base;
+qboolean d_cacheconflict; // a pending surface was asked for with another texture
+int d_hotevictions; // blocks taken back after being used this frame
+
+cvar_t d_surfcachemax = { "d_surfcachemax", "65536" }; // kilobytes the cache may grow to
+
+int c_schits, c_scmisses, c_scevictions;
+
+//
+// Blocks are bucketed into size classes four to an octave, so a block evicted
+// from one surface can be handed straight to another of about the same size.
+// Each class keeps its blocks in least recently used order, and memory is
+// carved from a list of chunks: the one VID_Init hands to D_InitCaches, plus
+// extra ones allocated as needed until d_surfcachemax is reached.  Blocks lie
+// end to end in their chunk, so once nothing is left to carve, a big block can
+// be split for a small surface and neighbouring old blocks merged for a big
+// one.  The leftovers wait in free lists by the largest class they can hold.
+//
+#define SC_MINSHIFT 6 // 64 byte smallest class
+#define SC_NUMCLASSES 48
+#define SC_CLASSSIZE(c) ((4 + ((c)&3)) << (SC_MINSHIFT - 2 + ((c) >> 2)))
+
+#define MAX_SCCHUNKS 256
+#define SC_CHUNKSIZE (1024 * 1024)
+
+typedef struct {
+    byte* base;
+    int size; // not counting the guard bytes
+    int used;
+    qboolean allocated; // came from malloc rather than the video hunk
+} scchunk_t;
+
+static scchunk_t sc_chunks[MAX_SCCHUNKS];
+static int sc_numchunks;
+static int sc_curchunk; // the one being carved, earlier ones are full
+
+int sc_size; // total in all chunks
+
+static surfcache_t sc_lru[SC_NUMCLASSES]; // next is the least recently used
+static surfcache_t sc_free[SC_NUMCLASSES]; // blocks with no owner
 
 #define GUARDSIZE 4
 
@@ -54,27 +90,104 @@ int D_SurfaceCacheForRes(int width, int height)
 void D_CheckCacheGuard(void)
 {
     byte* s;
-    int i;
-
-    s = (byte*)sc_base + sc_size;
-    for (i = 0; i < GUARDSIZE; i++) {
-        if (s[i] != (byte)i) {
-            Sys_Error("D_CheckCacheGuard: failed");
+    int i, j;
+
+    for (j = 0; j < sc_numchunks; j++) {
+        s = sc_chunks[j].base + sc_chunks[j].size;
+        for (i = 0; i < GUARDSIZE; i++) {
+            if (s[i] != (byte)i) {
+                Sys_Error("D_CheckCacheGuard: failed");
+            }
         }
     }
 }
 
-void D_ClearCacheGuard(void)
+static void D_ClearCacheGuard(scchunk_t* chunk)
 {
     byte* s;
     int i;
 
-    s = (byte*)sc_base + sc_size;
+    s = chunk->base + chunk->size;
     for (i = 0; i < GUARDSIZE; i++) {
         s[i] = (byte)i;
     }
 }
 
+/*
+================
+D_SCUnlink
+================
+*/
+static void D_SCUnlink(surfcache_t* cache)
+{
+    cache->prev->next = cache->next;
+    cache->next->prev = cache->prev;
+}
+
+/*
+================
+D_SCLinkNewest
+================
+*/
+static void D_SCLinkNewest(surfcache_t* cache)
+{
+    surfcache_t* head;
+
+    head = &sc_lru[cache->sizeclass];
+    cache->next = head;
+    cache->prev = head->prev;
+    head->prev->next = cache;
+    head->prev = cache;
+}
+
+/*
+================
+D_SCTouch
+
+Marks a block as used this frame
+================
+*/
+static void D_SCTouch(surfcache_t* cache)
+{
+    if (cache->lastframe != r_framecount) {
+        cache->lastframe = r_framecount;
+        D_SCUnlink(cache);
+        D_SCLinkNewest(cache);
+    }
+}
+
+/*
+================
+D_SCReset
+
+Empties every size class and chunk
+================
+*/
+static void D_SCReset(void)
+{
+    surfcache_t *c, *head;
+    int i;
+
+    for (i = 0; i < SC_NUMCLASSES; i++) {
+        head = &sc_lru[i];
+        for (c = head->next; c != head; c = c->next) {
+            *c->owner = NULL;
+            if (c->lastframe == r_framecount) {
+                d_hotevictions++;
+            }
+        }
+
+        head->next = head->prev = head;
+        sc_free[i].next = sc_free[i].prev = &sc_free[i];
+    }
+
+    for (i = 0; i < sc_numchunks; i++) {
+        sc_chunks[i].used = 0;
+    }
+
+    sc_curchunk = 0;
+}
+
 /*
 ================
 D_InitCaches
@@ -83,19 +196,36 @@ D_InitCaches
 */
 void D_InitCaches(void* buffer, int size)
 {
+    int i;
+
     if (!msg_suppress_1) {
         Con_Printf("%ik surface cache\n", size / 1024);
     }
 
-    sc_size = size - GUARDSIZE;
-    sc_base = (surfcache_t*)buffer;
-    sc_rover = sc_base;
+    if (sc_numchunks) {
+        D_SCReset();
+    } else {
+        for (i = 0; i < SC_NUMCLASSES; i++) {
+            sc_lru[i].next = sc_lru[i].prev = &sc_lru[i];
+            sc_free[i].next = sc_free[i].prev = &sc_free[i];
+        }
+    }
+
+    for (i = 0; i < sc_numchunks; i++) {
+        if (sc_chunks[i].allocated) {
+            free(sc_chunks[i].base);
+        }
+    }
 
-    sc_base->next = NULL;
-    sc_base->owner = NULL;
-    sc_base->size = sc_size;
+    sc_chunks[0].base = buffer;
+    sc_chunks[0].size = size - GUARDSIZE;
+    sc_chunks[0].used = 0;
+    sc_chunks[0].allocated = false;
+    sc_numchunks = 1;
+    sc_curchunk = 0;
+    sc_size = size;
 
-    D_ClearCacheGuard();
+    D_ClearCacheGuard(&sc_chunks[0]);
 }
 
 /*
@@ -105,22 +235,268 @@ D_FlushCaches
 */
 void D_FlushCaches(void)
 {
-    surfcache_t* c;
+    if (!sc_numchunks) {
+        return;
+    }
 
-    if (!sc_base) {
+    D_SCReset();
+}
+
+/*
+=================
+D_SCCarve
+
+Takes a new block from the end of the current chunk, moving on to the next
+chunk if that one is full, and starting another chunk once every existing one
+is full and the budget allows
+=================
+*/
+static surfcache_t* D_SCCarve(int sizeclass)
+{
+    scchunk_t* chunk;
+    surfcache_t* new;
+    int size;
+
+    size = SC_CLASSSIZE(sizeclass);
+    chunk = &sc_chunks[sc_curchunk];
+
+    // chunks kept from before a reset are carved again before growing
+    while (chunk->size - chunk->used < size && sc_curchunk < sc_numchunks - 1) {
+        chunk = &sc_chunks[++sc_curchunk];
+    }
+
+    if (chunk->size - chunk->used < size) {
+        if (sc_numchunks == MAX_SCCHUNKS || size > SC_CHUNKSIZE - GUARDSIZE) {
+            return NULL;
+        }
+
+        if (sc_size + SC_CHUNKSIZE > d_surfcachemax.value * 1024) {
+            return NULL;
+        }
+
+        chunk = &sc_chunks[sc_numchunks];
+        chunk->base = malloc(SC_CHUNKSIZE);
+        if (!chunk->base) {
+            return NULL;
+        }
+
+        chunk->size = SC_CHUNKSIZE - GUARDSIZE;
+        chunk->used = 0;
+        chunk->allocated = true;
+        D_ClearCacheGuard(chunk);
+
+        sc_curchunk = sc_numchunks++;
+        sc_size += SC_CHUNKSIZE;
+    }
+
+    new = (surfcache_t*)(chunk->base + chunk->used);
+    new->size = size;
+    new->sizeclass = sizeclass;
+    chunk->used += size;
+
+    return new;
+}
+
+/*
+=================
+D_SCFree
+
+Puts a block with no owner in the free list of the largest class it can hold
+=================
+*/
+static void D_SCFree(surfcache_t* cache)
+{
+    surfcache_t* head;
+    int sizeclass;
+
+    for (sizeclass = SC_NUMCLASSES - 1; SC_CLASSSIZE(sizeclass) > cache->size; sizeclass--) {
+    }
+
+    cache->owner = NULL;
+    cache->sizeclass = sizeclass;
+    cache->lastframe = -1;
+
+    head = &sc_free[sizeclass];
+    cache->next = head;
+    cache->prev = head->prev;
+    head->prev->next = cache;
+    head->prev = cache;
+}
+
+/*
+=================
+D_SCSplit
+
+Cuts what a block doesn't need for size off into a free block of its own, if
+there is enough of it to be any use
+=================
+*/
+static void D_SCSplit(surfcache_t* cache, int size)
+{
+    surfcache_t* rest;
+
+    if (cache->size - size < SC_CLASSSIZE(0) || cache->size - size < (int)sizeof(surfcache_t)) {
         return;
     }
 
-    for (c = sc_base; c; c = c->next) {
-        if (c->owner) {
-            *c->owner = NULL;
+    rest = (surfcache_t*)((byte*)cache + size);
+    rest->size = cache->size - size;
+    cache->size = size;
+    D_SCFree(rest);
+}
+
+/*
+=================
+D_SCTake
+
+Takes a block out of its list, telling the owner it is gone
+=================
+*/
+static void D_SCTake(surfcache_t* cache)
+{
+    D_SCUnlink(cache);
+    if (!cache->owner) {
+        return;
+    }
+
+    if (cache->lastframe == r_framecount) {
+        // drawn this frame, and maybe still queued to be built
+        r_cache_thrash = true;
+        d_hotevictions++;
+    }
+
+    *cache->owner = NULL;
+    c_scevictions++;
+}
+
+/*
+=================
+D_SCFindFree
+
+Takes the first free block of the class or a larger one
+=================
+*/
+static surfcache_t* D_SCFindFree(int sizeclass, int lastclass)
+{
+    surfcache_t* c;
+    int i;
+
+    for (i = sizeclass; i <= lastclass; i++) {
+        c = sc_free[i].next;
+        if (c != &sc_free[i]) {
+            D_SCUnlink(c);
+            return c;
         }
     }
 
-    sc_rover = sc_base;
-    sc_base->next = NULL;
-    sc_base->owner = NULL;
-    sc_base->size = sc_size;
+    return NULL;
+}
+
+/*
+=================
+D_SCEvict
+
+Takes back the least recently used block of the class, if it hasn't been drawn
+this frame or hot says that is allowed
+=================
+*/
+static surfcache_t* D_SCEvict(int sizeclass, qboolean hot)
+{
+    surfcache_t* c;
+
+    c = sc_lru[sizeclass].next;
+    if (c == &sc_lru[sizeclass] || (!hot && c->lastframe == r_framecount)) {
+        return NULL;
+    }
+
+    D_SCTake(c);
+
+    return c;
+}
+
+/*
+=================
+D_SCMerge
+
+Finds the run of neighbouring blocks at least size long whose most recently
+drawn block is the oldest, and takes them all back as one block.  The unused
+end of a chunk counts as a free block.  Blocks drawn this frame are only
+included if hot is set.
+=================
+*/
+static surfcache_t* D_SCMerge(int size, qboolean hot)
+{
+    scchunk_t *chunk, *bestchunk;
+    surfcache_t *start, *end, *c, *next, *best;
+    int i, total, newest, bestnewest, bestsize;
+    qboolean blocked;
+
+    best = NULL;
+    bestchunk = NULL;
+    bestnewest = bestsize = 0;
+
+    for (i = 0, chunk = sc_chunks; i < sc_numchunks; i++, chunk++) {
+        for (start = (surfcache_t*)chunk->base; (byte*)start < chunk->base + chunk->size;) {
+            // grow a run from start until it is big enough or hits a block
+            // that can't be taken
+            total = 0;
+            newest = -1;
+            blocked = false;
+            for (end = start; total < size && (byte*)end < chunk->base + chunk->size;) {
+                if ((byte*)end >= chunk->base + chunk->used) {
+                    total = chunk->base + chunk->size - (byte*)start;
+                    break;
+                }
+
+                if (!hot && end->owner && end->lastframe == r_framecount) {
+                    blocked = true;
+                    break;
+                }
+
+                if (end->lastframe > newest) {
+                    newest = end->lastframe;
+                }
+
+                total += end->size;
+                end = (surfcache_t*)((byte*)end + end->size);
+            }
+
+            if (total >= size && (!best || newest < bestnewest)) {
+                best = start;
+                bestchunk = chunk;
+                bestnewest = newest;
+                bestsize = total;
+            }
+
+            if ((byte*)start >= chunk->base + chunk->used) {
+                break;
+            }
+
+            // every run starting before the block that stopped this one
+            // would be stopped by it too
+            if (blocked) {
+                start = end;
+            }
+            start = (surfcache_t*)((byte*)start + start->size);
+        }
+    }
+
+    if (!best) {
+        return NULL;
+    }
+
+    for (c = best; (byte*)c < (byte*)best + bestsize && (byte*)c < bestchunk->base + bestchunk->used; c = next) {
+        next = (surfcache_t*)((byte*)c + c->size);
+        D_SCTake(c);
+    }
+
+    if ((byte*)best + bestsize > bestchunk->base + bestchunk->used) {
+        bestchunk->used = (byte*)best + bestsize - bestchunk->base;
+    }
+
+    best->size = bestsize;
+
+    return best;
 }
 
 /*
@@ -131,7 +507,7 @@ D_SCAlloc
 surfcache_t* D_SCAlloc(int width, int size)
 {
     surfcache_t* new;
-    qboolean wrapped_this_time;
+    int sizeclass;
 
     if ((width < 0) || (width > 256)) {
         Sys_Error("D_SCAlloc: bad cache width %d\n", width);
@@ -143,70 +519,52 @@ surfcache_t* D_SCAlloc(int width, int size)
 
     size = (intptr_t)&((surfcache_t*)0)->data[size];
     size = (size + 3) & ~3;
-    if (size > sc_size) {
-        Sys_Error("D_SCAlloc: %i > cache size", size);
-    }
 
-    // if there is not size bytes after the rover, reset to the start
-    wrapped_this_time = false;
+    for (sizeclass = 0; SC_CLASSSIZE(sizeclass) < size; sizeclass++) {
+    }
 
-    if (!sc_rover || (byte*)sc_rover - (byte*)sc_base > sc_size - size) {
-        if (sc_rover) {
-            wrapped_this_time = true;
-        }
+    c_scmisses++;
 
-        sc_rover = sc_base;
+    // free memory first, then the oldest block of the same size, and only
+    // then cut up or glue together blocks of other sizes
+    new = D_SCFindFree(sizeclass, sizeclass);
+    if (!new) {
+        new = D_SCCarve(sizeclass);
     }
-
-    // colect and free surfcache_t blocks until the rover block is large enough
-    new = sc_rover;
-    if (sc_rover->owner) {
-        *sc_rover->owner = NULL;
+    if (!new) {
+        new = D_SCEvict(sizeclass, false);
     }
-
-    while (new->size < size) {
-        // free another
-        sc_rover = sc_rover->next;
-        if (!sc_rover) {
-            Sys_Error("D_SCAlloc: hit the end of memory");
-        }
-
-        if (sc_rover->owner) {
-            *sc_rover->owner = NULL;
-        }
-
-        new->size += sc_rover->size;
-        new->next = sc_rover->next;
+    if (!new) {
+        new = D_SCFindFree(sizeclass + 1, SC_NUMCLASSES - 1);
+    }
+    if (!new) {
+        new = D_SCMerge(SC_CLASSSIZE(sizeclass), false);
     }
 
-    // create a fragment out of any leftovers
-    if (new->size - size > 256) {
-        sc_rover = (surfcache_t*)((byte*)new + size);
-        sc_rover->size = new->size - size;
-        sc_rover->next = new->next;
-        sc_rover->width = 0;
-        sc_rover->owner = NULL;
-        new->next = sc_rover;
-        new->size = size;
-    } else {
-        sc_rover = new->next;
+    // everything is in use this frame
+    if (!new) {
+        new = D_SCEvict(sizeclass, true);
     }
+    if (!new) {
+        new = D_SCMerge(SC_CLASSSIZE(sizeclass), true);
+    }
+    if (!new) {
+        Sys_Error("D_SCAlloc: %i > cache size", size);
+    }
+
+    D_SCSplit(new, SC_CLASSSIZE(sizeclass));
+    new->sizeclass = sizeclass;
 
     new->width = width;
     // DEBUG
     if (width > 0) {
-        new->height = (size - sizeof(*new) + sizeof(new->data)) / width;
+        new->height = (new->size - sizeof(*new) + sizeof(new->data)) / width;
     }
 
     new->owner = NULL; // should be set properly after return
-
-    if (d_roverwrapped) {
-        if (wrapped_this_time || (sc_rover >= d_initial_rover)) {
-            r_cache_thrash = true;
-        }
-    } else if (wrapped_this_time) {
-        d_roverwrapped = true;
-    }
+    new->pending = false;
+    new->lastframe = r_framecount;
+    D_SCLinkNewest(new);
 
     D_CheckCacheGuard(); // DEBUG
 
@@ -221,13 +579,12 @@ D_SCDump
 void D_SCDump(void)
 {
     surfcache_t* test;
+    int i;
 
-    for (test = sc_base; test; test = test->next) {
-        if (test == sc_rover) {
-            Sys_Printf("ROVER:\n");
+    for (i = 0; i < SC_NUMCLASSES; i++) {
+        for (test = sc_lru[i].next; test != &sc_lru[i]; test = test->next) {
+            printf("%p : %i bytes     %i width     frame %i\n", test, test->size, test->width, test->lastframe);
         }
-
-        printf("%p : %i bytes     %i width\n", test, test->size, test->width);
     }
 }
 
@@ -273,10 +630,13 @@ int D_log2(int num)
 
 /*
 ================
-D_CacheSurface
+D_SetupCacheSurface
+
+Finds or allocates the cache block for a surface and fills in r_drawsurf
+to build it.  Returns false if the cached copy is still good.
 ================
 */
-surfcache_t* D_CacheSurface(msurface_t* surface, int miplevel)
+static qboolean D_SetupCacheSurface(msurface_t* surface, int miplevel, surfcache_t** pcache)
 {
     surfcache_t* cache;
 
@@ -293,9 +653,15 @@ surfcache_t* D_CacheSurface(msurface_t* surface, int miplevel)
     // see if the cache holds apropriate data
     //
     cache = surface->cachespots[miplevel];
+    *pcache = cache;
+
+    if (cache) {
+        D_SCTouch(cache);
+    }
 
     if (cache && !cache->dlight && surface->dlightframe != r_framecount && cache->texture == r_drawsurf.texture && cache->lightadj[0] == r_drawsurf.lightadj[0] && cache->lightadj[1] == r_drawsurf.lightadj[1] && cache->lightadj[2] == r_drawsurf.lightadj[2] && cache->lightadj[3] == r_drawsurf.lightadj[3]) {
-        return cache;
+        c_schits++;
+        return false;
     }
 
     //
@@ -317,6 +683,7 @@ surfcache_t* D_CacheSurface(msurface_t* surface, int miplevel)
         surface->cachespots[miplevel] = cache;
         cache->owner = &surface->cachespots[miplevel];
         cache->mipscale = surfscale;
+        *pcache = cache;
     }
 
     if (surface->dlightframe == r_framecount) {
@@ -333,13 +700,74 @@ surfcache_t* D_CacheSurface(msurface_t* surface, int miplevel)
     cache->lightadj[2] = r_drawsurf.lightadj[2];
     cache->lightadj[3] = r_drawsurf.lightadj[3];
 
-    //
-    // draw and light the surface texture
-    //
     r_drawsurf.surf = surface;
+    r_drawsurf.staticlight = R_StaticLightForSurface(surface);
 
-    c_surf++;
-    R_DrawSurface();
+    return true;
+}
+
+/*
+================
+D_CacheSurface
+================
+*/
+surfcache_t* D_CacheSurface(msurface_t* surface, int miplevel)
+{
+    surfcache_t* cache;
 
-    return surface->cachespots[miplevel];
+    if (D_SetupCacheSurface(surface, miplevel, &cache)) {
+        //
+        // draw and light the surface texture
+        //
+        c_surf++;
+        R_DrawSurface();
+    }
+
+    return cache;
+}
+
+/*
+================
+D_CacheSurfaceDeferred
+
+Like D_CacheSurface, but a surface that needs building is only copied into
+*build and marked pending, so a batch of them can be built at once with
+D_BuildPendingSurface.  *pbuild is left NULL if nothing needs building.
+================
+*/
+surfcache_t* D_CacheSurfaceDeferred(msurface_t* surface, int miplevel, drawsurf_t* build, surfcache_t** pbuild)
+{
+    surfcache_t* cache;
+
+    *pbuild = NULL;
+
+    cache = surface->cachespots[miplevel];
+    if (cache && cache->pending) {
+        // already queued by another entity using the same brush model; an
+        // animating texture on a different frame can't share the block
+        if (cache->texture != R_TextureAnimation(surface->texinfo->texture)) {
+            d_cacheconflict = true;
+        }
+        return cache;
+    }
+
+    if (D_SetupCacheSurface(surface, miplevel, &cache)) {
+        c_surf++;
+        cache->pending = true;
+        *build = r_drawsurf;
+        *pbuild = cache;
+    }
+
+    return cache;
+}
+
+/*
+================
+D_BuildPendingSurface
+================
+*/
+void D_BuildPendingSurface(drawsurf_t* build)
+{
+    r_drawsurf = *build;
+    R_DrawSurface();
 }
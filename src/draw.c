@@ -152,6 +152,8 @@ void Draw_Character(int x, int y, int num)
 
 #endif
 
+    SCR_AddDirtyRect(x, y, 8, 8);
+
     row = num >> 4;
     col = num & 15;
     source = draw_chars + (row << 10) + (col << 3);
@@ -318,6 +320,8 @@ void Draw_Pic(int x, int y, qpic_t* pic)
         Sys_Error("Draw_Pic: bad coordinates");
     }
 
+    SCR_AddDirtyRect(x, y, pic->width, pic->height);
+
     source = pic->data;
 
     if (r_pixbytes == 1) {
@@ -358,6 +362,8 @@ void Draw_TransPic(int x, int y, qpic_t* pic)
         Sys_Error("Draw_TransPic: bad coordinates");
     }
 
+    SCR_AddDirtyRect(x, y, pic->width, pic->height);
+
     source = pic->data;
 
     if (r_pixbytes == 1) {
@@ -447,6 +453,8 @@ void Draw_TransPicTranslate(int x, int y, qpic_t* pic, byte* translation)
         Sys_Error("Draw_TransPic: bad coordinates");
     }
 
+    SCR_AddDirtyRect(x, y, pic->width, pic->height);
+
     source = pic->data;
 
     if (r_pixbytes == 1) {
@@ -582,6 +590,8 @@ void Draw_ConsoleBackground(int lines)
         Draw_CharToConback(ver[x], dest + (x << 3));
     }
 
+    SCR_AddDirtyRect(0, 0, vid.conwidth, lines);
+
     // draw the pic
     if (r_pixbytes == 1) {
         dest = vid.conbuffer;
@@ -731,6 +741,8 @@ void Draw_TileClear(int x, int y, int w, int h)
     byte* psrc;
     vrect_t vr;
 
+    SCR_AddDirtyRect(x, y, w, h);
+
     r_rectdesc.rect.x = x;
     r_rectdesc.rect.y = y;
     r_rectdesc.rect.width = w;
@@ -801,6 +813,8 @@ void Draw_Fill(int x, int y, int w, int h, int c)
     unsigned uc;
     int u, v;
 
+    SCR_AddDirtyRect(x, y, w, h);
+
     if (r_pixbytes == 1) {
         dest = vid.buffer + y * vid.rowbytes + x;
         for (v = 0; v < h; v++, dest += vid.rowbytes) {
@@ -833,6 +847,8 @@ void Draw_FadeScreen(void)
     int x, y;
     byte* pbuf;
 
+    SCR_AddDirtyRect(0, 0, vid.width, vid.height);
+
     VID_UnlockBuffer();
     S_ExtraUpdate();
     VID_LockBuffer();
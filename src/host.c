@@ -734,8 +734,16 @@ void _Host_Frame(float time)
         pass3 = (time3 - time2) * 1000;
         Con_Printf("%3i tot %3i server %3i gfx %3i snd\n", pass1 + pass2 + pass3,
             pass1, pass2, pass3);
+        Con_Printf("%6.2f ms render %6.2f ms present %6.2f ms wait %7i pixels\n",
+            (time2 - time1 - vid_updatetime) * 1000, vid_presenttime * 1000, vid_presentwait * 1000,
+            vid_presentpixels);
     }
 
+    vid_presenttime = 0;
+    vid_presentwait = 0;
+    vid_updatetime = 0;
+    vid_presentpixels = 0;
+
     host_framecount++;
 }
 
@@ -745,6 +753,8 @@ void Host_Frame(float time)
     static double timetotal;
     static int timecount;
     int i, c, m;
+    int hits, lookups;
+    fatpvs_t* fat;
 
     if (!serverprofile.value) {
         _Host_Frame(time);
@@ -767,13 +777,20 @@ void Host_Frame(float time)
     timecount = 0;
     timetotal = 0;
     c = 0;
+    hits = lookups = 0;
     for (i = 0; i < svs.maxclients; i++) {
         if (svs.clients[i].active) {
             c++;
         }
+
+        fat = &svs.clients[i].fatpvs;
+        hits += fat->hits;
+        lookups += fat->hits + fat->misses;
+        fat->hits = fat->misses = 0;
     }
 
-    Con_Printf("serverprofile: %2i clients %2i msec\n", c, m);
+    Con_Printf("serverprofile: %2i clients %2i msec %3i%% fatpvs hits\n", c, m,
+        lookups ? hits * 100 / lookups : 0);
 }
 
 //============================================================================
@@ -1310,6 +1310,41 @@ void Host_PreSpawn_f(void)
     host_client->sendsignon = true;
 }
 
+/*
+==================
+Host_DeltaEnts_f
+
+Sent by clients that understand svc_deltaframe before they prespawn.  Older
+servers ignore it, so those clients just get the usual updates.
+==================
+*/
+void Host_DeltaEnts_f(void)
+{
+    packetframe_t** frames;
+
+    if (cmd_source == src_command) {
+        Con_Printf("deltaents is not valid from the console\n");
+
+        return;
+    }
+
+    if (!sv_deltaents.value || host_client->deltaents) {
+        return;
+    }
+
+    frames = &svs.clientframes[host_client - svs.clients];
+    if (!*frames) {
+        *frames = malloc(UPDATE_BACKUP * sizeof(**frames));
+        if (!*frames) {
+            Sys_Error("Host_DeltaEnts_f: couldn't allocate frames");
+        }
+    }
+
+    host_client->deltaents = true;
+    host_client->framesequence = 0;
+    host_client->ackedframe = 0;
+}
+
 /*
 ==================
 Host_Spawn_f
@@ -1960,6 +1995,7 @@ void Host_InitCommands(void)
     Cmd_AddCommand("spawn", Host_Spawn_f);
     Cmd_AddCommand("begin", Host_Begin_f);
     Cmd_AddCommand("prespawn", Host_PreSpawn_f);
+    Cmd_AddCommand("deltaents", Host_DeltaEnts_f);
     Cmd_AddCommand("kick", Host_Kick_f);
     Cmd_AddCommand("ping", Host_Ping_f);
     Cmd_AddCommand("load", Host_Loadgame_f);
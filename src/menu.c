@@ -3194,8 +3194,6 @@ void M_Draw(void)
     }
 
     if (!m_recursiveDraw) {
-        scr_copyeverything = 1;
-
         if (scr_con_current) {
             Draw_ConsoleBackground(vid.height);
             VID_UnlockBuffer();
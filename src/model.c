@@ -35,6 +35,8 @@ model_t* Mod_LoadModel(model_t* mod, qboolean crash);
 
 byte mod_novis[MAX_MAP_LEAFS / 8];
 
+cvar_t mod_pvscache = { "mod_pvscache", "4096" }; // kilobytes of decompressed vis per map
+
 #define MAX_MOD_KNOWN 256
 model_t mod_known[MAX_MOD_KNOWN];
 int mod_numknown;
@@ -51,6 +53,8 @@ Mod_Init
 */
 void Mod_Init(void)
 {
+    Cvar_RegisterVariable(&mod_pvscache);
+
     memset(mod_novis, 0xff, sizeof(mod_novis));
 }
 
@@ -114,17 +118,14 @@ mleaf_t* Mod_PointInLeaf(vec3_t p, model_t* model)
 
 /*
 ===================
-Mod_DecompressVis
+Mod_DecompressVisRow
 ===================
 */
-byte* Mod_DecompressVis(byte* in, model_t* model)
+static void Mod_DecompressVisRow(byte* in, byte* decompressed, int row)
 {
-    static byte decompressed[MAX_MAP_LEAFS / 8];
     int c;
     byte* out;
-    int row;
 
-    row = (model->numleafs + 7) >> 3;
     out = decompressed;
 
     if (!in) { // no vis info, so make all visible
@@ -133,7 +134,7 @@ byte* Mod_DecompressVis(byte* in, model_t* model)
             row--;
         }
 
-        return decompressed;
+        return;
     }
 
     do {
@@ -149,17 +150,107 @@ byte* Mod_DecompressVis(byte* in, model_t* model)
             c--;
         }
     } while (out - decompressed < row);
+}
+
+/*
+===================
+Mod_DecompressVis
+
+The result is only good until the next call on the same thread
+===================
+*/
+byte* Mod_DecompressVis(byte* in, model_t* model)
+{
+    static THREAD_LOCAL byte decompressed[MAX_MAP_LEAFS / 8];
+
+    Mod_DecompressVisRow(in, decompressed, (model->numleafs + 7) >> 3);
 
     return decompressed;
 }
 
+/*
+===================
+Mod_LeafPVS
+
+Rows in the model's pvs cache are never moved or freed until the map is, so
+any thread can hold on to them.  Once the cache is full, a leaf that isn't in
+it gets Mod_DecompressVis's per-thread buffer instead.
+===================
+*/
 byte* Mod_LeafPVS(mleaf_t* leaf, model_t* model)
 {
+    byte *row, *expected;
+    int leafnum, used;
+
     if (leaf == model->leafs) {
         return mod_novis;
     }
 
-    return Mod_DecompressVis(leaf->compressed_vis, model);
+    leafnum = leaf - model->leafs;
+    if (!model->pvsrows || leafnum > model->numleafs) {
+        return Mod_DecompressVis(leaf->compressed_vis, model);
+    }
+
+    row = __atomic_load_n(&model->pvsrows[leafnum], __ATOMIC_ACQUIRE);
+    if (row) {
+        return row;
+    }
+
+    // check before claiming, so a full cache doesn't keep counting up
+    used = __atomic_load_n(&model->pvspoolused, __ATOMIC_RELAXED);
+    if (used + model->pvsrowbytes > model->pvspoolsize) {
+        return Mod_DecompressVis(leaf->compressed_vis, model);
+    }
+
+    used = __atomic_fetch_add(&model->pvspoolused, model->pvsrowbytes, __ATOMIC_RELAXED);
+    if (used + model->pvsrowbytes > model->pvspoolsize) {
+        return Mod_DecompressVis(leaf->compressed_vis, model);
+    }
+
+    row = model->pvspool + used;
+    Mod_DecompressVisRow(leaf->compressed_vis, row, (model->numleafs + 7) >> 3);
+
+    // another thread may have filled the same leaf meanwhile; theirs wins and
+    // this row is wasted
+    expected = NULL;
+    if (!__atomic_compare_exchange_n(&model->pvsrows[leafnum], &expected, row, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        return expected;
+    }
+
+    return row;
+}
+
+/*
+===================
+Mod_InitPVSCache
+
+Maps whose whole vis matrix fits in mod_pvscache are decompressed up front;
+bigger ones get that much room and fill it as leafs are asked for.  Rows are
+padded with zeros to a multiple of 8 bytes, so they can be read a word at a
+time without running into the next row or off the end of the pool.
+===================
+*/
+void Mod_InitPVSCache(model_t* mod)
+{
+    int i, size;
+
+    mod->pvsrowbytes = ((mod->numleafs + 63) >> 6) << 3;
+    mod->pvsrows = Hunk_AllocName((mod->numleafs + 1) * sizeof(*mod->pvsrows), loadname);
+
+    size = mod->numleafs * mod->pvsrowbytes;
+    if (size > mod_pvscache.value * 1024) {
+        size = (int)(mod_pvscache.value * 1024) / mod->pvsrowbytes * mod->pvsrowbytes;
+    }
+
+    mod->pvspool = Hunk_AllocName(size, loadname);
+    mod->pvspoolsize = size;
+    mod->pvspoolused = 0;
+
+    if (size == mod->numleafs * mod->pvsrowbytes) {
+        for (i = 1; i <= mod->numleafs; i++) {
+            Mod_LeafPVS(&mod->leafs[i], mod);
+        }
+    }
 }
 
 /*
@@ -908,6 +999,21 @@ void Mod_LoadNodes(lump_t* l)
     }
 
     Mod_SetParent(loadmodel->nodes, NULL); // sets nodes and leafs
+
+    //
+    // flatten the parent links into arrays of node numbers, so R_MarkLeaves
+    // can climb them without touching the node structs it isn't marking
+    //
+    loadmodel->nodeparents = Hunk_AllocName(count * sizeof(int), loadname);
+    for (i = 0, out = loadmodel->nodes; i < count; i++, out++) {
+        loadmodel->nodeparents[i] = out->parent ? out->parent - loadmodel->nodes : -1;
+    }
+
+    loadmodel->leafparents = Hunk_AllocName(loadmodel->numleafs * sizeof(int), loadname);
+    for (i = 0; i < loadmodel->numleafs; i++) {
+        p = loadmodel->leafs[i].parent ? loadmodel->leafs[i].parent - loadmodel->nodes : -1;
+        loadmodel->leafparents[i] = p;
+    }
 }
 
 /*
@@ -1216,6 +1322,11 @@ void Mod_LoadBrushModel(model_t* mod, void* buffer)
     mod->numframes = 2; // regular and alternate animation
     mod->flags = 0;
 
+    // the world's vis covers its first submodel's visleafs; the other
+    // submodels copy the pointers but never look up a pvs
+    mod->numleafs = mod->submodels[0].visleafs;
+    Mod_InitPVSCache(mod);
+
     //
     // set up the submodels (FIXME: this is confusing)
     //
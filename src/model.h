@@ -69,6 +69,8 @@ typedef struct texture_s {
     struct texture_s* anim_next;       // in the animation sequence
     struct texture_s* alternate_anims; // bmodels in frmae 1 use these
     unsigned offsets[MIPLEVELS];       // four mip maps stored
+    byte* warpframes;                  // precomputed turbulent frames, or NULL
+    byte* warpbuilt;                   // nonzero for each frame made so far
 } texture_t;
 
 #define SURF_PLANEBACK 2
@@ -114,6 +116,7 @@ typedef struct msurface_s {
     // lighting info
     byte styles[MAXLIGHTMAPS];
     byte* samples; // [numstyles*surfsize]
+    int staticlight; // r_staticlights slot + 1, 0 if none
 } msurface_t;
 
 typedef struct mnode_s {
@@ -312,6 +315,8 @@ typedef struct model_s {
 
     int numnodes;
     mnode_t* nodes;
+    int* nodeparents; // parent node number of each node, -1 for the roots
+    int* leafparents; // parent node number of each leaf
 
     int numtexinfo;
     mtexinfo_t* texinfo;
@@ -337,6 +342,14 @@ typedef struct model_s {
     byte* lightdata;
     char* entities;
 
+    // decompressed vis rows, indexed by leaf number; rows are filled in as
+    // Mod_LeafPVS asks for them until pvspool runs out
+    byte** pvsrows;
+    byte* pvspool;
+    int pvsrowbytes;
+    int pvspoolsize;
+    int pvspoolused;
+
     //
     // additional model data
     //
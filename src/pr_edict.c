@@ -106,7 +106,7 @@ edict_t* ED_Alloc(void)
         }
     }
 
-    if (i == MAX_EDICTS) {
+    if (i == sv.max_edicts) {
         Sys_Error("ED_Alloc: no free edicts");
     }
 
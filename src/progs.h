@@ -38,6 +38,7 @@ typedef struct edict_s {
 
     int num_leafs;
     short leafnums[MAX_ENT_LEAFS];
+    link_t leaflinks[MAX_ENT_LEAFS]; // in sv.leafedicts[leafnums[i]]
 
     entity_state_t baseline;
 
@@ -47,6 +48,7 @@ typedef struct edict_s {
 } edict_t;
 
 #define EDICT_FROM_AREA(l) STRUCT_FROM_LINK(l, edict_t, area)
+#define NUM_FOR_LEAFLINK(l) (((byte*)(l) - (byte*)sv.edicts) / pr_edict_size)
 
 //============================================================================
 
@@ -127,6 +127,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #define svc_cutscene 34
 
+#define svc_deltaframe 35 // [long] sequence [long] frame the updates are against
+// only sent to clients that asked for it with "deltaents"; the entity updates
+// that follow leave out fields unchanged since that frame instead of since the
+// baseline, and 0 means the baselines
+
 //
 // client to server
 //
@@ -135,6 +140,27 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define clc_disconnect 2
 #define clc_move 3      // [usercmd_t]
 #define clc_stringcmd 4 // [string] message
+#define clc_ackframe 5  // [long] newest svc_deltaframe received
+
+//
+// delta compressed entity updates
+//
+#define UPDATE_BACKUP 16 // frames remembered on each side, must be a power of two
+#define UPDATE_MASK (UPDATE_BACKUP - 1)
+#define MAX_PACKET_ENTITIES 256 // entities remembered per frame
+
+typedef struct {
+    int number;
+    entity_state_t state;
+} packetentity_t;
+
+// the entity states a client holds after one svc_deltaframe; entities past
+// MAX_PACKET_ENTITIES are left out on both sides and go back to the baseline
+typedef struct {
+    int sequence;
+    int numentities; // in increasing number order
+    packetentity_t entities[MAX_PACKET_ENTITIES];
+} packetframe_t;
 
 //
 // temp entity events
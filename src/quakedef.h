@@ -55,6 +55,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #define UNUSED(x) (x = x) // for pesky compiler / lint warnings
 
+#define THREAD_LOCAL _Thread_local // state private to each worker thread
+
 #define MINIMUM_MEMORY 0x550000
 #define MINIMUM_MEMORY_LEVELPAK (MINIMUM_MEMORY + 0x100000)
 
@@ -80,7 +82,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 //
 // per-level limits
 //
-#define MAX_EDICTS 600 // FIXME: ouch! ouch! ouch!
+#define MAX_EDICTS 600        // unless raised with -edicts
+#define MAX_EDICTS_LIMIT 8192 // sounds carry the entity in 13 bits
 #define MAX_LIGHTSTYLES 64
 #define MAX_MODELS 256 // these are sent over the net as bytes
 #define MAX_SOUNDS 256 // so they cannot be blindly increased
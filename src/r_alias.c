@@ -24,6 +24,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "d_local.h" // FIXME: shouldn't be needed (is needed for patch
 // right now, but that should move)
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define LIGHT_MIN 5 // lowest light value we'll allow, to avoid the
 //  need for inner-loop light clamping
 
@@ -50,6 +54,13 @@ static vec3_t alias_forward, alias_right, alias_up;
 static maliasskindesc_t* pskindesc;
 
 int r_amodels_drawn;
+int r_amodels_hidden; // rejected by R_AliasOccluded
+
+// screen box and nearest depth of the last model R_AliasCheckBBox accepted;
+// boxes that reach the near clip plane aren't kept
+static qboolean aliasbox_valid;
+static float aliasbox_umin, aliasbox_umax, aliasbox_vmin, aliasbox_vmax;
+static float aliasbox_nearz;
 int a_skinwidth;
 int r_anumverts;
 
@@ -77,6 +88,8 @@ void R_AliasTransformFinalVert(finalvert_t* fv,
     trivertx_t* pverts,
     stvert_t* pstverts);
 void R_AliasProjectFinalVert(finalvert_t* fv, auxvert_t* av);
+void R_AliasTransformFinalVerts(finalvert_t* fv, auxvert_t* av,
+    trivertx_t* pverts, stvert_t* pstverts, int numverts);
 
 /*
 ================
@@ -128,6 +141,7 @@ qboolean R_AliasCheckBBox(void)
 
     zclipped = false;
     zfullyclipped = true;
+    aliasbox_valid = false;
 
     minz = 9999;
     for (i = 0; i < 8; i++) {
@@ -179,6 +193,10 @@ qboolean R_AliasCheckBBox(void)
     anyclip = 0;
     allclip = ALIAS_XY_CLIP_MASK;
 
+    aliasbox_umin = aliasbox_vmin = 1e30;
+    aliasbox_umax = aliasbox_vmax = -1e30;
+    aliasbox_nearz = 1e30;
+
     // TODO: probably should do this loop in ASM, especially if we use floats
     for (i = 0; i < numv; i++) {
         // we don't need to bother with vertices that were z-clipped
@@ -192,6 +210,26 @@ qboolean R_AliasCheckBBox(void)
         v0 = (viewaux[i].fv[0] * xscale * zi) + xcenter;
         v1 = (viewaux[i].fv[1] * yscale * zi) + ycenter;
 
+        if (v0 < aliasbox_umin) {
+            aliasbox_umin = v0;
+        }
+
+        if (v0 > aliasbox_umax) {
+            aliasbox_umax = v0;
+        }
+
+        if (v1 < aliasbox_vmin) {
+            aliasbox_vmin = v1;
+        }
+
+        if (v1 > aliasbox_vmax) {
+            aliasbox_vmax = v1;
+        }
+
+        if (viewaux[i].fv[2] < aliasbox_nearz) {
+            aliasbox_nearz = viewaux[i].fv[2];
+        }
+
         flags = 0;
 
         if (v0 < r_refdef.fvrectx) {
@@ -218,6 +256,8 @@ qboolean R_AliasCheckBBox(void)
         return false; // trivial reject off one side
     }
 
+    aliasbox_valid = !zclipped;
+
     currententity->trivial_accept = !anyclip & !zclipped;
 
     if (currententity->trivial_accept) {
@@ -229,6 +269,62 @@ qboolean R_AliasCheckBBox(void)
     return true;
 }
 
+/*
+================
+R_AliasOccluded
+
+True if every pixel under the box R_AliasCheckBBox just passed already has
+something nearer than the nearest corner of the box in the z-buffer.  The
+model's own z can't be nearer than that anywhere, so none of it would be
+drawn.
+================
+*/
+qboolean R_AliasOccluded(void)
+{
+    int u, v, u0, u1, v0, v1, limit;
+    short* pz;
+
+    if (!aliasbox_valid) {
+        return false;
+    }
+
+    // the polyset z is 1/z scaled by 0x8000 once shifted down; a little
+    // slack keeps rounding from hiding anything
+    limit = (int)(0x8000 * 1.001 / aliasbox_nearz) + 1;
+
+    u0 = (int)floor(aliasbox_umin) - 1;
+    u1 = (int)ceil(aliasbox_umax) + 1;
+    v0 = (int)floor(aliasbox_vmin) - 1;
+    v1 = (int)ceil(aliasbox_vmax) + 1;
+
+    if (u0 < r_refdef.vrect.x) {
+        u0 = r_refdef.vrect.x;
+    }
+
+    if (u1 > r_refdef.vrectright - 1) {
+        u1 = r_refdef.vrectright - 1;
+    }
+
+    if (v0 < r_refdef.vrect.y) {
+        v0 = r_refdef.vrect.y;
+    }
+
+    if (v1 > r_refdef.vrectbottom - 1) {
+        v1 = r_refdef.vrectbottom - 1;
+    }
+
+    for (v = v0; v <= v1; v++) {
+        pz = d_pzbuffer + d_zwidth * v;
+        for (u = u0; u <= u1; u++) {
+            if (pz[u] <= limit) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
 /*
 ================
 R_AliasTransformVector
@@ -241,6 +337,153 @@ void R_AliasTransformVector(vec3_t in, vec3_t out)
     out[2] = DotProduct(in, aliastransform[2]) + aliastransform[2][3];
 }
 
+#if defined(__SSE2__)
+/*
+================
+R_AliasLoadVerts4
+
+Splits four packed trivertx_t into one register per coordinate
+================
+*/
+static void R_AliasLoadVerts4(trivertx_t* pverts, __m128* x, __m128* y, __m128* z)
+{
+    __m128i v, mask;
+
+    v = _mm_loadu_si128((__m128i*)pverts);
+    mask = _mm_set1_epi32(0xFF);
+
+    *x = _mm_cvtepi32_ps(_mm_and_si128(v, mask));
+    *y = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 8), mask));
+    *z = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 16), mask));
+}
+
+/*
+================
+R_AliasTransformRow4
+
+One row of aliastransform applied to four vertices, in the same order of
+operations as DotProduct so the result matches the scalar path
+================
+*/
+static __m128 R_AliasTransformRow4(int row, __m128 x, __m128 y, __m128 z)
+{
+    __m128 r;
+
+    r = _mm_mul_ps(x, _mm_set1_ps(aliastransform[row][0]));
+    r = _mm_add_ps(r, _mm_mul_ps(y, _mm_set1_ps(aliastransform[row][1])));
+    r = _mm_add_ps(r, _mm_mul_ps(z, _mm_set1_ps(aliastransform[row][2])));
+
+    return _mm_add_ps(r, _mm_set1_ps(aliastransform[row][3]));
+}
+
+/*
+================
+R_AliasLight4
+================
+*/
+static __m128i R_AliasLight4(trivertx_t* pverts)
+{
+    float *n0, *n1, *n2, *n3;
+    __m128 lightcos;
+    __m128i temp, dark;
+
+    n0 = r_avertexnormals[pverts[0].lightnormalindex];
+    n1 = r_avertexnormals[pverts[1].lightnormalindex];
+    n2 = r_avertexnormals[pverts[2].lightnormalindex];
+    n3 = r_avertexnormals[pverts[3].lightnormalindex];
+
+    lightcos = _mm_mul_ps(_mm_setr_ps(n0[0], n1[0], n2[0], n3[0]), _mm_set1_ps(r_plightvec[0]));
+    lightcos = _mm_add_ps(lightcos, _mm_mul_ps(_mm_setr_ps(n0[1], n1[1], n2[1], n3[1]), _mm_set1_ps(r_plightvec[1])));
+    lightcos = _mm_add_ps(lightcos, _mm_mul_ps(_mm_setr_ps(n0[2], n1[2], n2[2], n3[2]), _mm_set1_ps(r_plightvec[2])));
+
+    dark = _mm_castps_si128(_mm_cmplt_ps(lightcos, _mm_setzero_ps()));
+    temp = _mm_cvttps_epi32(_mm_mul_ps(_mm_set1_ps(r_shadelight), lightcos));
+    temp = _mm_add_epi32(_mm_set1_epi32(r_ambientlight), _mm_and_si128(dark, temp));
+
+    // r_ambientlight is at least LIGHT_MIN, so only shaded lanes can go below
+    return _mm_andnot_si128(_mm_srai_epi32(temp, 31), temp);
+}
+
+/*
+================
+R_AliasStoreFinalVerts4
+
+Transposes four vertices' worth of lanes back into finalvert_t
+================
+*/
+static void R_AliasStoreFinalVerts4(finalvert_t* fv, stvert_t* pstverts, __m128i u, __m128i v, __m128i l, __m128i zi)
+{
+    __m128 r0, r1, r2, r3;
+
+    r0 = _mm_castsi128_ps(u);
+    r1 = _mm_castsi128_ps(v);
+    r2 = _mm_castsi128_ps(_mm_setr_epi32(pstverts[0].s, pstverts[1].s, pstverts[2].s, pstverts[3].s));
+    r3 = _mm_castsi128_ps(_mm_setr_epi32(pstverts[0].t, pstverts[1].t, pstverts[2].t, pstverts[3].t));
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps((float*)&fv[0].v[0], r0);
+    _mm_storeu_ps((float*)&fv[1].v[0], r1);
+    _mm_storeu_ps((float*)&fv[2].v[0], r2);
+    _mm_storeu_ps((float*)&fv[3].v[0], r3);
+
+    // v[4], v[5], flags and reserved
+    r0 = _mm_castsi128_ps(l);
+    r1 = _mm_castsi128_ps(zi);
+    r2 = _mm_castsi128_ps(_mm_setr_epi32(pstverts[0].onseam, pstverts[1].onseam, pstverts[2].onseam, pstverts[3].onseam));
+    r3 = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps((float*)&fv[0].v[4], r0);
+    _mm_storeu_ps((float*)&fv[1].v[4], r1);
+    _mm_storeu_ps((float*)&fv[2].v[4], r2);
+    _mm_storeu_ps((float*)&fv[3].v[4], r3);
+}
+#endif
+
+/*
+================
+R_AliasTransformFinalVerts
+
+Transforms and lights a run of vertices into view space for the clipped
+case, four at a time where SSE2 is available
+================
+*/
+void R_AliasTransformFinalVerts(finalvert_t* fv, auxvert_t* av, trivertx_t* pverts, stvert_t* pstverts, int numverts)
+{
+    int i;
+#if defined(__SSE2__)
+    __m128 x, y, z;
+    float out[3][4];
+    int light[4];
+    int j, k;
+
+    for (i = 0; i + 4 <= numverts; i += 4, fv += 4, av += 4, pverts += 4, pstverts += 4) {
+        R_AliasLoadVerts4(pverts, &x, &y, &z);
+
+        for (j = 0; j < 3; j++) {
+            _mm_storeu_ps(out[j], R_AliasTransformRow4(j, x, y, z));
+        }
+
+        _mm_storeu_si128((__m128i*)light, R_AliasLight4(pverts));
+
+        for (k = 0; k < 4; k++) {
+            av[k].fv[0] = out[0][k];
+            av[k].fv[1] = out[1][k];
+            av[k].fv[2] = out[2][k];
+
+            fv[k].v[2] = pstverts[k].s;
+            fv[k].v[3] = pstverts[k].t;
+            fv[k].flags = pstverts[k].onseam;
+            fv[k].v[4] = light[k];
+        }
+    }
+#else
+    i = 0;
+#endif
+
+    for (; i < numverts; i++, fv++, av++, pverts++, pstverts++) {
+        R_AliasTransformFinalVert(fv, av, pverts, pstverts);
+    }
+}
+
 /*
 ================
 R_AliasPreparePoints
@@ -262,8 +505,9 @@ void R_AliasPreparePoints(void)
     fv = pfinalverts;
     av = pauxverts;
 
-    for (i = 0; i < r_anumverts; i++, fv++, av++, r_apverts++, pstverts++) {
-        R_AliasTransformFinalVert(fv, av, r_apverts, pstverts);
+    R_AliasTransformFinalVerts(fv, av, r_apverts, pstverts, r_anumverts);
+
+    for (i = 0; i < r_anumverts; i++, fv++, av++) {
         if (av->fv[2] < ALIAS_Z_CLIP_PLANE) {
             fv->flags |= ALIAS_Z_CLIP;
         } else {
@@ -433,10 +677,28 @@ void R_AliasTransformAndProjectFinalVerts(finalvert_t* fv, stvert_t* pstverts)
     int i, temp;
     float lightcos, *plightnormal, zi;
     trivertx_t* pverts;
+#if defined(__SSE2__)
+    __m128 x, y, z, vzi;
+    __m128i u, v;
+#endif
 
     pverts = r_apverts;
+    i = 0;
 
-    for (i = 0; i < r_anumverts; i++, fv++, pverts++, pstverts++) {
+#if defined(__SSE2__)
+    for (; i + 4 <= r_anumverts; i += 4, fv += 4, pverts += 4, pstverts += 4) {
+        R_AliasLoadVerts4(pverts, &x, &y, &z);
+
+        // transform and project
+        vzi = _mm_div_ps(_mm_set1_ps(1.0), R_AliasTransformRow4(2, x, y, z));
+        u = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(R_AliasTransformRow4(0, x, y, z), vzi), _mm_set1_ps(aliasxcenter)));
+        v = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(R_AliasTransformRow4(1, x, y, z), vzi), _mm_set1_ps(aliasycenter)));
+
+        R_AliasStoreFinalVerts4(fv, pstverts, u, v, R_AliasLight4(pverts), _mm_cvttps_epi32(vzi));
+    }
+#endif
+
+    for (; i < r_anumverts; i++, fv++, pverts++, pstverts++) {
         // transform and project
         zi = 1.0 / (DotProduct(pverts->v, aliastransform[2]) + aliastransform[2][3]);
 
@@ -698,4 +960,7 @@ void R_AliasDrawModel(alight_t* plighting)
     } else {
         R_AliasPreparePoints();
     }
+
+    // the queued vertices live in finalverts on this stack frame
+    D_PolysetFlush();
 }
@@ -401,6 +401,29 @@ void R_DrawSubmodelPolygons(model_t* pmodel, int clipflags)
     }
 }
 
+/*
+================
+R_KeyOccludedLeafs
+
+Brush models still sort on the key of the leafs they sit in, so the leafs
+under an occluded node get a key even though nothing in them is drawn
+================
+*/
+static void R_KeyOccludedLeafs(mnode_t* node)
+{
+    if (node->visframe != r_visframecount) {
+        return;
+    }
+
+    if (node->contents < 0) {
+        ((mleaf_t*)node)->key = r_currentkey;
+        return;
+    }
+
+    R_KeyOccludedLeafs(node->children[0]);
+    R_KeyOccludedLeafs(node->children[1]);
+}
+
 /*
 ================
 R_RecursiveWorldNode
@@ -462,6 +485,21 @@ void R_RecursiveWorldNode(mnode_t* node, int clipflags)
         }
     }
 
+    // hidden behind the world faces already sent, which are all in front of it
+    if (r_occlusion.value) {
+        for (i = 0; i < 3; i++) {
+            acceptpt[i] = (float)node->minmaxs[i];
+            rejectpt[i] = (float)node->minmaxs[3 + i];
+        }
+
+        if (R_OccludedBox(acceptpt, rejectpt, true)) {
+            r_occludednodes++;
+            R_KeyOccludedLeafs(node);
+            r_currentkey++;
+            return;
+        }
+    }
+
     // if a leaf node, draw stuff
     if (node->contents < 0) {
         pleaf = (mleaf_t*)node;
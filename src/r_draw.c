@@ -532,6 +532,10 @@ void R_RenderFace(msurface_t* fa, int clipflags)
     surface_p->d_zistepv = -p_normal[1] * yscaleinv * distinv;
     surface_p->d_ziorigin = p_normal[2] * distinv - xcenter * surface_p->d_zistepu - ycenter * surface_p->d_zistepv;
 
+    if (!insubmodel) {
+        R_OcclusionAddFace(fa, surface_p);
+    }
+
     //JDC	VectorCopy (r_worldmodelorg, surface_p->modelorg);
     surface_p++;
 }
@@ -24,7 +24,6 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 #include "r_local.h"
 
-edge_t* auxedges;
 edge_t *r_edges, *edge_p, *edge_max;
 
 surf_t *surfaces, *surface_p, *surf_max;
@@ -33,10 +32,10 @@ surf_t *surfaces, *surface_p, *surf_max;
 // pointer is greater than another one, it should be drawn in front
 // surfaces[1] is the background, and is used as the active surface stack
 
-edge_t* newedges[MAXHEIGHT];
-edge_t* removeedges[MAXHEIGHT];
+edge_t** newedges;
+edge_t** removeedges;
 
-espan_t *span_p, *max_span_p;
+espan_t *r_spans, *span_p, *max_span_p;
 
 int r_currentkey;
 
@@ -608,14 +607,16 @@ Each surface has a linked list of its visible spans
 void R_ScanEdges(void)
 {
     int iv, bottom;
-    byte basespans[MAXSPANS * sizeof(espan_t) + CACHE_SIZE];
     espan_t* basespan_p;
     surf_t* s;
+    qboolean flushed;
 
-    basespan_p = (espan_t*)((long)(basespans + CACHE_SIZE - 1) & ~(CACHE_SIZE - 1));
-    max_span_p = &basespan_p[MAXSPANS - r_refdef.vrect.width];
+    basespan_p = r_spans;
+    max_span_p = &basespan_p[r_numallocatedspans - r_refdef.vrect.width];
 
     span_p = basespan_p;
+    flushed = false;
+    vstartscan = r_refdef.vrect.y;
 
     // clear active edges to just the background edges around the whole screen
     // FIXME: most of this only needs to be set up once
@@ -672,6 +673,7 @@ void R_ScanEdges(void)
             if (r_drawculledpolys) {
                 R_DrawCulledPolys();
             } else {
+                R_OcclusionAddSpans();
                 D_DrawSurfaces();
             }
 
@@ -681,6 +683,8 @@ void R_ScanEdges(void)
             }
 
             span_p = basespan_p;
+            vstartscan = iv + 1;
+            flushed = true;
         }
 
         if (removeedges[iv]) {
@@ -710,6 +714,13 @@ void R_ScanEdges(void)
     if (r_drawculledpolys) {
         R_DrawCulledPolys();
     } else {
+        R_OcclusionAddSpans();
         D_DrawSurfaces();
     }
+
+    // every flush costs a pass of surface setup, so give the next frame room
+    // to do it in one
+    if (flushed && r_numallocatedspans < MAXSPANS) {
+        R_AllocEdgePools(r_numallocatededges, r_cnumsurfs, r_numallocatedspans * 2);
+    }
 }
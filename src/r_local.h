@@ -72,6 +72,11 @@ extern cvar_t r_reportedgeout;
 extern cvar_t r_maxedges;
 extern cvar_t r_numedges;
 extern cvar_t r_udither;
+extern cvar_t r_occlusion;
+extern cvar_t r_dynres;
+extern cvar_t r_animphases;
+extern cvar_t r_animcache;
+extern cvar_t r_entitysort;
 
 #define XCENTERING (1.0 / 2.0)
 #define YCENTERING (1.0 / 2.0)
@@ -113,6 +118,7 @@ extern float verticalFieldOfView;
 extern float xOrigin, yOrigin;
 
 extern int r_visframecount;
+extern float r_marktime;
 
 //=============================================================================
 
@@ -175,11 +181,11 @@ extern int* pfrustum_indexes[4];
 // !!! if this is changed, it must be changed in asm_draw.h too !!!
 #define NEAR_CLIP 0.01
 
-extern int ubasestep, errorterm, erroradjustup, erroradjustdown;
+extern THREAD_LOCAL int ubasestep, errorterm, erroradjustup, erroradjustdown;
 extern int vstartscan;
 
-extern fixed16_t sadjust, tadjust;
-extern fixed16_t bbextents, bbextentt;
+extern THREAD_LOCAL fixed16_t sadjust, tadjust;
+extern THREAD_LOCAL fixed16_t bbextents, bbextentt;
 
 #define MAXBVERTINDEXES 1000 // new clipped vertices when clipping bmodels
 //  to the world BSP
@@ -225,6 +231,7 @@ extern finalvert_t* pfinalverts;
 extern auxvert_t* pauxverts;
 
 qboolean R_AliasCheckBBox(void);
+qboolean R_AliasOccluded(void);
 
 //=========================================================
 // turbulence stuff
@@ -233,6 +240,14 @@ qboolean R_AliasCheckBBox(void);
 #define AMP2 3
 #define SPEED 20
 
+// sky and turbulent textures keep r_animframes precomputed frames per cycle,
+// set up for each map by R_InitAnimFrames; 0 when they aren't kept
+extern int r_animframes;
+extern byte* r_skyframes;
+extern byte* r_skybuilt;
+
+void R_InitAnimFrames(void);
+
 //=========================================================
 // particle stuff
 
@@ -241,14 +256,16 @@ void R_InitParticles(void);
 void R_ClearParticles(void);
 void R_ReadPointFile_f(void);
 void R_SurfacePatch(void);
+void R_AllocEdgePools(int numedges, int numsurfs, int numspans);
 
 extern int r_amodels_drawn;
-extern edge_t* auxedges;
-extern int r_numallocatededges;
+extern int r_amodels_hidden;
+extern int r_numallocatededges, r_numallocatedspans;
 extern edge_t *r_edges, *edge_p, *edge_max;
+extern espan_t* r_spans;
 
-extern edge_t* newedges[MAXHEIGHT];
-extern edge_t* removeedges[MAXHEIGHT];
+extern edge_t** newedges;    // vid.height entries
+extern edge_t** removeedges; // vid.height entries
 
 extern int screenwidth;
 
@@ -275,9 +292,11 @@ extern float dp_time1, dp_time2, db_time1, db_time2, rw_time1, rw_time2;
 extern float se_time1, se_time2, de_time1, de_time2, dv_time1, dv_time2;
 extern int r_frustum_indexes[4 * 6];
 extern int r_maxsurfsseen, r_maxedgesseen, r_cnumsurfs;
-extern qboolean r_surfsonstack;
 extern cshift_t cshift_water;
 extern qboolean r_dowarpold, r_viewchanged;
+extern float r_viewscale;
+
+qboolean R_UpdateViewScale(void);
 
 extern mleaf_t *r_viewleaf, *r_oldviewleaf;
 
@@ -302,4 +321,14 @@ void R_ClipEdge(mvertex_t* pv0, mvertex_t* pv1, clipplane_t* clip);
 void R_SplitEntityOnNode2(mnode_t* node);
 void R_MarkLights(dlight_t* light, int bit, mnode_t* node);
 
+extern int r_occludednodes, r_occludedents;
+
+void R_BeginOcclusion(void);
+void R_OcclusionBeginFaces(void);
+void R_OcclusionAddFace(msurface_t* fa, surf_t* surf);
+void R_OcclusionAddSpans(void);
+void R_FinishOcclusion(void);
+qboolean R_OccludedBox(vec3_t mins, vec3_t maxs, qboolean world);
+qboolean R_OccludedEntity(entity_t* ent, qboolean world);
+
 #endif
@@ -21,6 +21,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 #include "r_local.h"
+#include "d_local.h"
 
 //define	PASSAGES
 
@@ -28,7 +29,7 @@ void* colormap;
 vec3_t viewlightvec;
 alight_t r_viewlighting = { 128, 192, viewlightvec };
 float r_time1;
-int r_numallocatededges;
+int r_numallocatededges, r_numallocatedspans;
 qboolean r_drawpolys;
 qboolean r_drawculledpolys;
 qboolean r_worldpolysbacktofront;
@@ -40,13 +41,18 @@ int r_outofedges;
 
 qboolean r_dowarp, r_dowarpold, r_viewchanged;
 
+qboolean r_scaleview;
+byte* r_scalebuffer;
+float r_viewscale = 1; // fraction of the screen size the 3D view is drawn at
+static float r_viewtime;    // last R_RenderView_, in ms
+static float r_viewtimeavg; // smoothed
+
 int numbtofpolys;
 btofpoly_t* pbtofpolys;
 mvertex_t* r_pcurrentvertbase;
 
 int c_surf;
 int r_maxsurfsseen, r_maxedgesseen, r_cnumsurfs;
-qboolean r_surfsonstack;
 int r_clipflags;
 
 byte* r_warpbuffer;
@@ -91,6 +97,7 @@ int d_spanpixcount;
 int r_polycount;
 int r_drawnpolycount;
 int r_wholepolycount;
+float r_marktime; // seconds spent in R_MarkLeaves since the last r_speeds report
 
 #define VIEWMODNAME_LENGTH 256
 char viewmodname[VIEWMODNAME_LENGTH + 1];
@@ -137,6 +144,14 @@ cvar_t r_numedges = { "r_numedges", "0" };
 cvar_t r_udither = { "r_udither", "1" };
 cvar_t r_aliastransbase = { "r_aliastransbase", "200" };
 cvar_t r_aliastransadj = { "r_aliastransadj", "100" };
+cvar_t r_threads = { "r_threads", "1" };
+cvar_t r_occlusion = { "r_occlusion", "1" };
+cvar_t r_dynres = { "r_dynres", "0" };
+cvar_t r_dynres_target = { "r_dynres_target", "16" }; // ms per 3D view
+cvar_t r_dynres_min = { "r_dynres_min", "0.5" };
+cvar_t r_animphases = { "r_animphases", "128" }; // sky and turbulent frames kept per cycle
+cvar_t r_animcache = { "r_animcache", "16384" }; // kilobytes they may use
+cvar_t r_entitysort = { "r_entitysort", "1" };
 
 /*
 
@@ -237,9 +252,17 @@ void R_Init(void)
     Cvar_RegisterVariable(&r_udither);
     Cvar_RegisterVariable(&r_aliastransbase);
     Cvar_RegisterVariable(&r_aliastransadj);
-
-    Cvar_SetValue("r_maxedges", (float)NUMSTACKEDGES);
-    Cvar_SetValue("r_maxsurfs", (float)NUMSTACKSURFACES);
+    Cvar_RegisterVariable(&r_threads);
+    Cvar_RegisterVariable(&r_occlusion);
+    Cvar_RegisterVariable(&r_dynres);
+    Cvar_RegisterVariable(&r_dynres_target);
+    Cvar_RegisterVariable(&r_dynres_min);
+    Cvar_RegisterVariable(&r_animphases);
+    Cvar_RegisterVariable(&r_animcache);
+    Cvar_RegisterVariable(&r_entitysort);
+
+    Cvar_SetValue("r_maxedges", (float)MINEDGES);
+    Cvar_SetValue("r_maxsurfs", (float)MINSURFACES);
 
     view_clipplanes[0].leftedge = true;
     view_clipplanes[1].rightedge = true;
@@ -255,56 +278,161 @@ void R_Init(void)
 
 /*
 ===============
-R_NewMap
+R_AllocScanTables
+
+Called by VID_Init once the mode is known
 ===============
 */
-void R_NewMap(void)
+void R_AllocScanTables(int width, int height)
 {
-    int i;
+    if (width > MAXWIDTH || height > MAXHEIGHT) {
+        Sys_Error("R_AllocScanTables: %ix%i is larger than %ix%i", width, height, MAXWIDTH, MAXHEIGHT);
+    }
 
-    // clear out efrags in case the level hasn't been reloaded
-    // FIXME: is this one short?
-    for (i = 0; i < cl.worldmodel->numleafs; i++) {
-        cl.worldmodel->leafs[i].efrags = NULL;
+    newedges = Hunk_HighAllocName(height * sizeof(*newedges), "video");
+    removeedges = Hunk_HighAllocName(height * sizeof(*removeedges), "video");
+    d_scantable = Hunk_HighAllocName(height * sizeof(*d_scantable), "video");
+    zspantable = Hunk_HighAllocName(height * sizeof(*zspantable), "video");
+}
+
+/*
+===============
+R_PoolAlloc
+===============
+*/
+static void* R_PoolAlloc(void** block, int size)
+{
+    free(*block);
+
+    *block = malloc(size + CACHE_SIZE - 1);
+    if (!*block) {
+        Sys_Error("R_AllocEdgePools: couldn't allocate %i bytes", size);
     }
 
-    r_viewleaf = NULL;
-    R_ClearParticles();
+    return (void*)(((intptr_t)*block + CACHE_SIZE - 1) & ~(CACHE_SIZE - 1));
+}
 
-    r_cnumsurfs = r_maxsurfs.value;
+/*
+===============
+R_AllocEdgePools
+
+Makes room for at least the given number of edges, surfaces and spans.  The
+pools are kept from frame to frame and map to map and never shrink, so once
+a big map or mode has grown them they stay that size.
+===============
+*/
+void R_AllocEdgePools(int numedges, int numsurfs, int numspans)
+{
+    static void *edgeblock, *surfblock, *spanblock, *gradblock, *pendingblock;
+
+    if (numedges < MINEDGES) {
+        numedges = MINEDGES;
+    } else if (numedges > MAXEDGES) {
+        numedges = MAXEDGES;
+    }
+
+    if (numsurfs < MINSURFACES) {
+        numsurfs = MINSURFACES;
+    } else if (numsurfs > MAXSURFACES) {
+        numsurfs = MAXSURFACES;
+    }
+
+    // a scanline can need up to a span per pixel
+    if (numspans < MINSPANS + (int)vid.width) {
+        numspans = MINSPANS + vid.width;
+    } else if (numspans > MAXSPANS) {
+        numspans = MAXSPANS;
+    }
 
-    if (r_cnumsurfs <= MINSURFACES) {
-        r_cnumsurfs = MINSURFACES;
+    if (numedges > r_numallocatededges) {
+        r_numallocatededges = numedges;
+        r_edges = R_PoolAlloc(&edgeblock, numedges * sizeof(edge_t));
+        Cvar_SetValue("r_maxedges", (float)numedges);
     }
 
-    if (r_cnumsurfs > NUMSTACKSURFACES) {
-        surfaces = Hunk_AllocName(r_cnumsurfs * sizeof(surf_t), "surfaces");
+    if (numsurfs > r_cnumsurfs) {
+        r_cnumsurfs = numsurfs;
+        surfaces = R_PoolAlloc(&surfblock, numsurfs * sizeof(surf_t));
         surface_p = surfaces;
-        surf_max = &surfaces[r_cnumsurfs];
-        r_surfsonstack = false;
+        surf_max = &surfaces[numsurfs];
         // surface 0 doesn't really exist; it's just a dummy because index 0
         // is used to indicate no edge attached to surface
         surfaces--;
         R_SurfacePatch();
-    } else {
-        r_surfsonstack = true;
+
+        // span setup for every surface, so D_DrawSurfaces can hand them to
+        // the worker threads
+        d_surfgrads = R_PoolAlloc(&gradblock, numsurfs * sizeof(surfgrad_t));
+        d_pendingsurfs = R_PoolAlloc(&pendingblock, numsurfs * sizeof(surfgrad_t*));
+
+        Cvar_SetValue("r_maxsurfs", (float)numsurfs);
     }
 
-    r_maxedgesseen = 0;
-    r_maxsurfsseen = 0;
+    if (numspans > r_numallocatedspans) {
+        r_numallocatedspans = numspans;
+        r_spans = R_PoolAlloc(&spanblock, numspans * sizeof(espan_t));
+    }
+}
 
-    r_numallocatededges = r_maxedges.value;
+/*
+===============
+R_GrowEdgePools
 
-    if (r_numallocatededges < MINEDGES) {
-        r_numallocatededges = MINEDGES;
+Doubles whichever pools the frame so far has run out of.  Returns false if
+none of them could grow.
+===============
+*/
+static qboolean R_GrowEdgePools(void)
+{
+    int numedges, numsurfs;
+
+    numedges = r_numallocatededges;
+    numsurfs = r_cnumsurfs;
+
+    if (r_outofedges && numedges < MAXEDGES) {
+        numedges *= 2;
     }
 
-    if (r_numallocatededges <= NUMSTACKEDGES) {
-        auxedges = NULL;
-    } else {
-        auxedges = Hunk_AllocName(r_numallocatededges * sizeof(edge_t), "edges");
+    if (r_outofsurfaces && numsurfs < MAXSURFACES) {
+        numsurfs *= 2;
+    }
+
+    if (numedges == r_numallocatededges && numsurfs == r_cnumsurfs) {
+        return false;
+    }
+
+    R_AllocEdgePools(numedges, numsurfs, r_numallocatedspans);
+
+    r_outofedges = 0;
+    r_outofsurfaces = 0;
+
+    return true;
+}
+
+/*
+===============
+R_NewMap
+===============
+*/
+void R_NewMap(void)
+{
+    int i;
+
+    // clear out efrags in case the level hasn't been reloaded
+    // FIXME: is this one short?
+    for (i = 0; i < cl.worldmodel->numleafs; i++) {
+        cl.worldmodel->leafs[i].efrags = NULL;
     }
 
+    r_viewleaf = NULL;
+    R_ClearParticles();
+
+    R_AllocEdgePools(r_maxedges.value, r_maxsurfs.value, MINSPANS);
+    R_InitAnimFrames();
+
+    r_maxedgesseen = 0;
+    r_maxsurfsseen = 0;
+
     r_dowarpold = false;
     r_viewchanged = false;
 #ifdef PASSAGES
@@ -467,6 +595,28 @@ void R_ViewChanged(vrect_t* pvrect, int lineadj, float aspect)
     D_ViewChanged();
 }
 
+/*
+===============
+R_MarkLeaf
+
+Marks a visible leaf and every node above it that isn't marked yet
+===============
+*/
+static void R_MarkLeaf(model_t* model, int leafnum)
+{
+    int p;
+
+    model->leafs[leafnum].visframe = r_visframecount;
+
+    for (p = model->leafparents[leafnum]; p >= 0; p = model->nodeparents[p]) {
+        if (model->nodes[p].visframe == r_visframecount) {
+            break;
+        }
+
+        model->nodes[p].visframe = r_visframecount;
+    }
+}
+
 /*
 ===============
 R_MarkLeaves
@@ -475,36 +625,77 @@ R_MarkLeaves
 void R_MarkLeaves(void)
 {
     byte* vis;
-    mnode_t* node;
-    int i;
+    model_t* model;
+    unsigned long long bits;
+    int i, row, numleafs, leafnum;
+    double time1;
 
     if (r_oldviewleaf == r_viewleaf) {
         return;
     }
 
+    time1 = r_speeds.value ? Sys_FloatTime() : 0;
+
     r_visframecount++;
     r_oldviewleaf = r_viewleaf;
 
-    vis = Mod_LeafPVS(r_viewleaf, cl.worldmodel);
+    model = cl.worldmodel;
+    vis = Mod_LeafPVS(r_viewleaf, model);
+    numleafs = model->numleafs;
+    row = (numleafs + 7) >> 3;
+
+    // scan the row a word at a time, jumping straight to each set bit; bit i
+    // is leaf i + 1
+    for (i = 0; i < row; i += sizeof(bits)) {
+        bits = 0;
+        memcpy(&bits, vis + i, row - i < (int)sizeof(bits) ? row - i : (int)sizeof(bits));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        bits = __builtin_bswap64(bits);
+#endif
 
-    for (i = 0; i < cl.worldmodel->numleafs; i++) {
-        if (vis[i >> 3] & (1 << (i & 7))) {
-            node = (mnode_t*)&cl.worldmodel->leafs[i + 1];
-            do {
-                if (node->visframe == r_visframecount) {
-                    break;
-                }
+        while (bits) {
+            leafnum = i * 8 + __builtin_ctzll(bits);
+            if (leafnum >= numleafs) {
+                break;
+            }
 
-                node->visframe = r_visframecount;
-                node = node->parent;
-            } while (node);
+            R_MarkLeaf(model, leafnum + 1);
+            bits &= bits - 1;
         }
     }
+
+    if (r_speeds.value) {
+        r_marktime += Sys_FloatTime() - time1;
+    }
+}
+
+typedef struct {
+    entity_t* ent;
+    float dist;
+} entsort_t;
+
+/*
+=============
+R_EntityDistCompare
+=============
+*/
+static int R_EntityDistCompare(const void* a, const void* b)
+{
+    float da, db;
+
+    da = ((const entsort_t*)a)->dist;
+    db = ((const entsort_t*)b)->dist;
+
+    return (da > db) - (da < db);
 }
 
 /*
 =============
 R_DrawEntitiesOnList
+
+With r_entitysort, alias models and sprites are drawn nearest first, and an
+alias model whose box is already covered in the z-buffer by the world or by
+a nearer model is skipped.
 =============
 */
 void R_DrawEntitiesOnList(void)
@@ -516,13 +707,24 @@ void R_DrawEntitiesOnList(void)
     float lightvec[3] = { -1, 0, 0 };
     vec3_t dist;
     float add;
+    entsort_t sorted[MAX_VISEDICTS];
 
     if (!r_drawentities.value) {
         return;
     }
 
     for (i = 0; i < cl_numvisedicts; i++) {
-        currententity = cl_visedicts[i];
+        sorted[i].ent = cl_visedicts[i];
+        VectorSubtract(cl_visedicts[i]->origin, r_origin, dist);
+        sorted[i].dist = DotProduct(dist, vpn);
+    }
+
+    if (r_entitysort.value) {
+        qsort(sorted, cl_numvisedicts, sizeof(*sorted), R_EntityDistCompare);
+    }
+
+    for (i = 0; i < cl_numvisedicts; i++) {
+        currententity = sorted[i].ent;
 
         if (currententity == &cl_entities[cl.viewentity]) {
             continue; // don't draw the player
@@ -532,6 +734,12 @@ void R_DrawEntitiesOnList(void)
         case mod_sprite:
             VectorCopy(currententity->origin, r_entorigin);
             VectorSubtract(r_origin, r_entorigin, modelorg);
+
+            if (R_OccludedEntity(currententity, false)) {
+                r_occludedents++;
+                break;
+            }
+
             R_DrawSprite();
             break;
 
@@ -542,6 +750,16 @@ void R_DrawEntitiesOnList(void)
             // see if the bounding box lets us trivially reject, also sets
             // trivial accept status
             if (R_AliasCheckBBox()) {
+                if (R_OccludedEntity(currententity, false)) {
+                    r_occludedents++;
+                    break;
+                }
+
+                if (r_entitysort.value && R_AliasOccluded()) {
+                    r_amodels_hidden++;
+                    break;
+                }
+
                 j = R_LightPoint(currententity->origin);
 
                 lighting.ambientlight = j;
@@ -766,6 +984,11 @@ void R_DrawBEntitiesOnList(void)
 
             clipflags = R_BmodelCheckBBox(clmodel, minmaxs);
 
+            if (clipflags != BMODEL_FULLY_CLIPPED && R_OccludedEntity(currententity, true)) {
+                r_occludedents++;
+                clipflags = BMODEL_FULLY_CLIPPED;
+            }
+
             if (clipflags != BMODEL_FULLY_CLIPPED) {
                 VectorCopy(currententity->origin, r_entorigin);
                 VectorSubtract(r_origin, r_entorigin, modelorg);
@@ -850,51 +1073,47 @@ R_EdgeDrawing
 */
 void R_EdgeDrawing(void)
 {
-    edge_t ledges[NUMSTACKEDGES + ((CACHE_SIZE - 1) / sizeof(edge_t)) + 1];
-    surf_t lsurfs[NUMSTACKSURFACES + ((CACHE_SIZE - 1) / sizeof(surf_t)) + 1];
+    int occludednodes, occludedents;
 
-    if (auxedges) {
-        r_edges = auxedges;
-    } else {
-        r_edges = (edge_t*)(((long)&ledges[0] + CACHE_SIZE - 1) & ~(CACHE_SIZE - 1));
-    }
+    occludednodes = r_occludednodes;
+    occludedents = r_occludedents;
 
-    if (r_surfsonstack) {
-        surfaces = (surf_t*)(((long)&lsurfs[0] + CACHE_SIZE - 1) & ~(CACHE_SIZE - 1));
-        surf_max = &surfaces[r_cnumsurfs];
-        // surface 0 doesn't really exist; it's just a dummy because index 0
-        // is used to indicate no edge attached to surface
-        surfaces--;
-        R_SurfacePatch();
-    }
+    // if the pools run out, grow them and emit the edges again rather than
+    // drop polygons; nothing has been drawn until R_ScanEdges
+    do {
+        R_BeginEdgeFrame();
+        R_OcclusionBeginFaces();
 
-    R_BeginEdgeFrame();
+        // only count what the last pass culls
+        r_occludednodes = occludednodes;
+        r_occludedents = occludedents;
 
-    if (r_dspeeds.value) {
-        rw_time1 = Sys_FloatTime();
-    }
+        if (r_dspeeds.value) {
+            rw_time1 = Sys_FloatTime();
+        }
 
-    R_RenderWorld();
+        R_RenderWorld();
 
-    if (r_drawculledpolys) {
-        R_ScanEdges();
-    }
+        if (r_drawculledpolys) {
+            R_ScanEdges();
+        }
 
-    // only the world can be drawn back to front with no z reads or compares, just
-    // z writes, so have the driver turn z compares on now
-    D_TurnZOn();
+        // only the world can be drawn back to front with no z reads or compares, just
+        // z writes, so have the driver turn z compares on now
+        D_TurnZOn();
 
-    if (r_dspeeds.value) {
-        rw_time2 = Sys_FloatTime();
-        db_time1 = rw_time2;
-    }
+        if (r_dspeeds.value) {
+            rw_time2 = Sys_FloatTime();
+            db_time1 = rw_time2;
+        }
 
-    R_DrawBEntitiesOnList();
+        R_DrawBEntitiesOnList();
 
-    if (r_dspeeds.value) {
-        db_time2 = Sys_FloatTime();
-        se_time1 = db_time2;
-    }
+        if (r_dspeeds.value) {
+            db_time2 = Sys_FloatTime();
+            se_time1 = db_time2;
+        }
+    } while (!r_drawculledpolys && (r_outofedges || r_outofsurfaces) && R_GrowEdgePools());
 
     if (!r_dspeeds.value) {
         VID_UnlockBuffer();
@@ -907,6 +1126,71 @@ void R_EdgeDrawing(void)
     }
 }
 
+/*
+================
+R_UpdateViewScale
+
+Moves r_viewscale so the 3D view takes about r_dynres_target ms.  Fill cost
+goes with the area, so the scale follows the square root of the ratio, a
+limited step at a time and in 1/32 increments so the view size doesn't
+twitch.  Returns true if the scale changed.
+================
+*/
+qboolean R_UpdateViewScale(void)
+{
+    static int lastchange;
+    float scale, minscale, ratio;
+
+    scale = r_viewscale;
+
+    if (!r_dynres.value || r_dynres_target.value <= 0) {
+        scale = 1;
+    } else {
+        r_viewtimeavg += (r_viewtime - r_viewtimeavg) * 0.1;
+
+        if (r_framecount - lastchange >= 8 && r_viewtimeavg > 0) {
+            ratio = r_dynres_target.value / r_viewtimeavg;
+            if (ratio < 0.95 || ratio > 1.25) {
+                ratio = sqrt(ratio);
+                if (ratio < 0.9) {
+                    ratio = 0.9;
+                } else if (ratio > 1.1) {
+                    ratio = 1.1;
+                }
+
+                scale = floor(scale * ratio * 32 + 0.5) / 32;
+            }
+        }
+
+        minscale = r_dynres_min.value;
+        if (minscale < 0.25) {
+            minscale = 0.25;
+        }
+
+        if (scale < minscale) {
+            scale = minscale;
+        } else if (scale > 1) {
+            scale = 1;
+        }
+    }
+
+    if (scale == r_viewscale) {
+        return false;
+    }
+
+    if (scale < 1 && !r_scalebuffer) {
+        r_scalebuffer = malloc(vid.width * vid.height);
+        if (!r_scalebuffer) {
+            Sys_Error("R_UpdateViewScale: couldn't allocate %dx%d", vid.width, vid.height);
+        }
+    }
+
+    r_viewscale = scale;
+    lastchange = r_framecount;
+
+    return true;
+}
+
 /*
 ================
 R_RenderView
@@ -916,12 +1200,14 @@ r_refdef must be set before the first call
 */
 void R_RenderView_(void)
 {
-    byte warpbuffer[WARP_WIDTH * WARP_HEIGHT];
+    byte warpbuffer[WARP_WIDTH * WARP_HEIGHT + 3]; // slack for D_WarpRow_AVX2
+    double time1;
 
     r_warpbuffer = warpbuffer;
 
+    time1 = Sys_FloatTime();
     if (r_timegraph.value || r_speeds.value || r_dspeeds.value) {
-        r_time1 = Sys_FloatTime();
+        r_time1 = time1;
     }
 
     R_SetupFrame();
@@ -948,8 +1234,12 @@ void R_RenderView_(void)
         VID_LockBuffer();
     }
 
+    R_BeginOcclusion();
+
     R_EdgeDrawing();
 
+    R_FinishOcclusion();
+
     if (!r_dspeeds.value) {
         VID_UnlockBuffer();
         S_ExtraUpdate(); // don't let sound get messed up if going slow
@@ -983,8 +1273,12 @@ void R_RenderView_(void)
 
     if (r_dowarp) {
         D_WarpScreen();
+    } else if (r_scaleview) {
+        D_ScaleScreen();
     }
 
+    r_viewtime = (Sys_FloatTime() - time1) * 1000;
+
     V_SetContentsColor(r_viewleaf->contents);
 
     if (r_timegraph.value) {
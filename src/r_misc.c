@@ -196,9 +196,18 @@ void R_PrintTimes(void)
 
     ms = 1000 * (r_time2 - r_time1);
 
-    Con_Printf("%5.1f ms %3i/%3i/%3i poly %3i surf\n", ms, c_faceclip,
-        r_polycount, r_drawnpolycount, c_surf);
+    Con_Printf("%5.1f ms %3i/%3i/%3i poly %3i surf %4.2f ms mark\n", ms, c_faceclip,
+        r_polycount, r_drawnpolycount, c_surf, r_marktime * 1000);
+    Con_Printf("%4i hit %3i miss %3i evict %5ik surfcache\n", c_schits,
+        c_scmisses, c_scevictions, sc_size / 1024);
+    Con_Printf("%4i nodes %3i entities occluded\n", r_occludednodes, r_occludedents);
     c_surf = 0;
+    r_marktime = 0;
+    c_schits = 0;
+    c_scmisses = 0;
+    c_scevictions = 0;
+    r_occludednodes = 0;
+    r_occludedents = 0;
 }
 
 /*
@@ -231,7 +240,7 @@ R_PrintAliasStats
 */
 void R_PrintAliasStats(void)
 {
-    Con_Printf("%3i polygon model drawn\n", r_amodels_drawn);
+    Con_Printf("%3i polygon model drawn, %3i hidden\n", r_amodels_drawn, r_amodels_hidden);
 }
 
 void WarpPalette(void)
@@ -404,7 +413,13 @@ void R_SetupFrame(void)
     r_dowarpold = r_dowarp;
     r_dowarp = r_waterwarp.value && (r_viewleaf->contents <= CONTENTS_WATER);
 
+    if (R_UpdateViewScale()) {
+        r_viewchanged = true;
+    }
+
     if ((r_dowarp != r_dowarpold) || r_viewchanged || lcd_x.value) {
+        r_scaleview = false;
+
         if (r_dowarp) {
             if ((vid.width <= vid.maxwarpwidth) && (vid.height <= vid.maxwarpheight)) {
                 vrect.x = 0;
@@ -436,6 +451,17 @@ void R_SetupFrame(void)
                     &vrect, (int)((float)sb_lines * (h / (float)vid.height)),
                     vid.aspect * (h / w) * ((float)vid.width / (float)vid.height));
             }
+        } else if (r_viewscale < 1) {
+            // draw into a smaller screen of the same shape and stretch it
+            // back up afterwards; the HUD still goes on the real one
+            r_scaleview = true;
+
+            vrect.x = 0;
+            vrect.y = 0;
+            vrect.width = (int)(vid.width * r_viewscale);
+            vrect.height = (int)(vid.height * r_viewscale);
+
+            R_ViewChanged(&vrect, (int)(sb_lines * r_viewscale), vid.aspect);
         } else {
             vrect.x = 0;
             vrect.y = 0;
@@ -470,6 +496,7 @@ void R_SetupFrame(void)
     r_drawnpolycount = 0;
     r_wholepolycount = 0;
     r_amodels_drawn = 0;
+    r_amodels_hidden = 0;
     r_outofsurfaces = 0;
     r_outofedges = 0;
 
@@ -0,0 +1,714 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// r_occlude.c: coarse occlusion culling against the scanned spans
+//
+// Every span handed to the driver has an exact 1/z gradient, so the farthest
+// 1/z in each OC_TILE x OC_TILE block of the view falls out of the span
+// endpoints.  Those tiles, and 2x2 reductions of them, make a pyramid that a
+// projected bounding box can be checked against with a handful of reads.
+//
+// The spans only exist once the whole world has been put through the edge
+// list, so the pyramid built this frame serves the alias models and sprites
+// drawn afterwards.  The world nodes and brush models are sent before the
+// scan, so for them each world face is also rasterized into the same tiles
+// as it goes into the edge list.  A tile keeps a bit per pixel and the
+// farthest 1/z of the faces that set them; the traversal is front to back, so
+// once every bit of a tile is set, nothing later can show through it.
+
+#include "quakedef.h"
+#include "r_local.h"
+
+#define OC_TILESHIFT 3
+#define OC_TILE (1 << OC_TILESHIFT)
+#define OC_MAXLEVELS 16
+#define OC_BIAS 1.001  // boxes have to be clearly behind to be culled
+#define OC_MAXVERTS 64 // bigger faces are left out of the face tiles
+
+int r_occludednodes, r_occludedents;
+
+typedef struct {
+    int numlevels;
+    int width[OC_MAXLEVELS], height[OC_MAXLEVELS];
+    float* level[OC_MAXLEVELS];
+} ocpyramid_t;
+
+static int oc_tilewidth, oc_tileheight, oc_numtiles;
+static float* oc_minzi;    // farthest 1/z seen in each tile
+static int* oc_count;      // pixels covered in each tile
+static ocpyramid_t oc_frame; // everything scanned this frame
+
+static unsigned long long* oc_facebits; // pixels set by world faces so far
+static float* oc_facezi;                // farthest 1/z of those faces
+static qboolean oc_faces;               // oc_facebits is from this pass
+
+static qboolean oc_scanned; // oc_frame is from this frame
+
+/*
+===============
+R_OcclusionAllocPyramid
+===============
+*/
+static void R_OcclusionAllocPyramid(ocpyramid_t* p)
+{
+    int i, w, h, total;
+
+    free(p->level[0]);
+
+    w = oc_tilewidth;
+    h = oc_tileheight;
+    total = 0;
+    for (i = 0; i < OC_MAXLEVELS; i++) {
+        p->width[i] = w;
+        p->height[i] = h;
+        total += w * h;
+
+        if (w == 1 && h == 1) {
+            break;
+        }
+
+        w = (w + 1) >> 1;
+        h = (h + 1) >> 1;
+    }
+
+    p->numlevels = i < OC_MAXLEVELS ? i + 1 : OC_MAXLEVELS;
+    p->level[0] = malloc(total * sizeof(float));
+    if (!p->level[0]) {
+        Sys_Error("R_OcclusionAllocPyramid: couldn't allocate %d tiles", total);
+    }
+
+    for (i = 1; i < p->numlevels; i++) {
+        p->level[i] = p->level[i - 1] + p->width[i - 1] * p->height[i - 1];
+    }
+}
+
+/*
+===============
+R_BeginOcclusion
+
+Called once the view is set up, before anything goes into the edge list
+===============
+*/
+void R_BeginOcclusion(void)
+{
+    int w, h;
+
+    oc_scanned = false;
+    oc_faces = false;
+
+    if (!r_occlusion.value) {
+        return;
+    }
+
+    w = (r_refdef.vrect.width + OC_TILE - 1) >> OC_TILESHIFT;
+    h = (r_refdef.vrect.height + OC_TILE - 1) >> OC_TILESHIFT;
+
+    if (w != oc_tilewidth || h != oc_tileheight) {
+        oc_tilewidth = w;
+        oc_tileheight = h;
+        oc_numtiles = w * h;
+
+        free(oc_minzi);
+        free(oc_count);
+        free(oc_facebits);
+        free(oc_facezi);
+        oc_minzi = malloc(oc_numtiles * sizeof(*oc_minzi));
+        oc_count = malloc(oc_numtiles * sizeof(*oc_count));
+        oc_facebits = malloc(oc_numtiles * sizeof(*oc_facebits));
+        oc_facezi = malloc(oc_numtiles * sizeof(*oc_facezi));
+        if (!oc_minzi || !oc_count || !oc_facebits || !oc_facezi) {
+            Sys_Error("R_BeginOcclusion: couldn't allocate %d tiles", oc_numtiles);
+        }
+
+        R_OcclusionAllocPyramid(&oc_frame);
+    }
+
+    memset(oc_count, 0, oc_numtiles * sizeof(*oc_count));
+}
+
+/*
+===============
+R_OcclusionBeginFaces
+
+Empties the face tiles; called before each pass of the world through the
+edge list.  Pixels past the right and bottom of the view are set already, so
+the tiles there can fill up.
+===============
+*/
+void R_OcclusionBeginFaces(void)
+{
+    int x, y, w, h;
+    unsigned long long rowbits, bits;
+
+    oc_faces = false;
+
+    if (!r_occlusion.value || !oc_numtiles) {
+        return;
+    }
+
+    for (y = 0; y < oc_tileheight; y++) {
+        h = r_refdef.vrect.height - (y << OC_TILESHIFT);
+        for (x = 0; x < oc_tilewidth; x++) {
+            w = r_refdef.vrect.width - (x << OC_TILESHIFT);
+
+            // a row of the tile's pixels outside the view, then the rows
+            bits = 0;
+            if (w < OC_TILE) {
+                rowbits = (0xffull << w) & 0xff;
+                bits = rowbits * 0x0101010101010101ull;
+            }
+
+            if (h < OC_TILE) {
+                bits |= ~0ull << (h * OC_TILE);
+            }
+
+            oc_facebits[y * oc_tilewidth + x] = bits;
+            oc_facezi[y * oc_tilewidth + x] = 1e30;
+        }
+    }
+
+    oc_faces = true;
+}
+
+/*
+===============
+R_OcclusionAddFace
+
+Rasterizes a world face that has just gone into the edge list, sampling
+pixels the way the edge stepping does.  Where the face sets new bits in a
+tile, the tile's 1/z drops to the nearest the face can be anywhere in it.
+===============
+*/
+void R_OcclusionAddFace(msurface_t* fa, surf_t* surf)
+{
+    vec3_t local, view[OC_MAXVERTS + 1];
+    float u[OC_MAXVERTS + 1], v[OC_MAXVERTS + 1];
+    float vmin, vmax, minzi, zi, frac, x, xl, xr, u0, u1, v0, v1, cu, cv;
+    model_t* model;
+    mvertex_t* vert;
+    unsigned long long bits, *facebits;
+    int i, j, a, b, n, lindex, y, ystart, yend, left, right, tx, ty, tx0, tx1, sx, ex;
+
+    if (!oc_faces || (fa->flags & SURF_DRAWSKY) || fa->numedges > OC_MAXVERTS) {
+        return;
+    }
+
+    // view space, clipped to the near plane
+    model = cl.worldmodel;
+    n = 0;
+    for (i = 0; i < fa->numedges; i++) {
+        lindex = model->surfedges[fa->firstedge + i];
+        if (lindex > 0) {
+            vert = &model->vertexes[model->edges[lindex].v[0]];
+        } else {
+            vert = &model->vertexes[model->edges[-lindex].v[1]];
+        }
+
+        VectorSubtract(vert->position, r_origin, local);
+        view[i][0] = DotProduct(local, vright);
+        view[i][1] = DotProduct(local, vup);
+        view[i][2] = DotProduct(local, vpn);
+    }
+
+    for (i = 0, j = fa->numedges - 1; i < fa->numedges; j = i, i++) {
+        if ((view[j][2] >= NEAR_CLIP) != (view[i][2] >= NEAR_CLIP)) {
+            frac = (NEAR_CLIP - view[j][2]) / (view[i][2] - view[j][2]);
+            x = view[j][0] + frac * (view[i][0] - view[j][0]);
+            u[n] = xcenter + xscale * x / NEAR_CLIP;
+            x = view[j][1] + frac * (view[i][1] - view[j][1]);
+            v[n] = ycenter - yscale * x / NEAR_CLIP;
+            n++;
+        }
+
+        if (view[i][2] >= NEAR_CLIP) {
+            zi = 1.0 / view[i][2];
+            u[n] = xcenter + xscale * view[i][0] * zi;
+            v[n] = ycenter - yscale * view[i][1] * zi;
+            n++;
+        }
+    }
+
+    if (n < 3) {
+        return;
+    }
+
+    vmin = vmax = v[0];
+    minzi = 1e30;
+    for (i = 0; i < fa->numedges; i++) {
+        if (view[i][2] >= NEAR_CLIP && 1.0 / view[i][2] < minzi) {
+            minzi = 1.0 / view[i][2];
+        }
+    }
+
+    for (i = 1; i < n; i++) {
+        if (v[i] < vmin) {
+            vmin = v[i];
+        }
+
+        if (v[i] > vmax) {
+            vmax = v[i];
+        }
+    }
+
+    // rows are sampled at whole v and pixels at whole u, as R_EmitEdge does
+    ystart = (int)ceil(vmin);
+    yend = (int)ceil(vmax) - 1;
+    if (ystart < r_refdef.vrect.y) {
+        ystart = r_refdef.vrect.y;
+    }
+
+    if (yend > r_refdef.vrect.y + r_refdef.vrect.height - 1) {
+        yend = r_refdef.vrect.y + r_refdef.vrect.height - 1;
+    }
+
+    for (y = ystart; y <= yend; y++) {
+        xl = 1e30;
+        xr = -1e30;
+        for (i = 0, j = n - 1; i < n; j = i, i++) {
+            // the same way round for both faces sharing the edge, so they
+            // meet without a gap
+            if (v[i] < v[j] || (v[i] == v[j] && u[i] < u[j])) {
+                a = i;
+                b = j;
+            } else {
+                a = j;
+                b = i;
+            }
+
+            if (v[a] == v[b] || y < ceil(v[a]) || y >= ceil(v[b])) {
+                continue;
+            }
+
+            x = u[a] + (y - v[a]) * (u[b] - u[a]) / (v[b] - v[a]);
+            if (x < xl) {
+                xl = x;
+            }
+
+            if (x > xr) {
+                xr = x;
+            }
+        }
+
+        left = (int)ceil(xl) - r_refdef.vrect.x;
+        right = (int)ceil(xr) - 1 - r_refdef.vrect.x;
+        if (left < 0) {
+            left = 0;
+        }
+
+        if (right > r_refdef.vrect.width - 1) {
+            right = r_refdef.vrect.width - 1;
+        }
+
+        if (left > right) {
+            continue;
+        }
+
+        ty = (y - r_refdef.vrect.y) >> OC_TILESHIFT;
+        tx0 = left >> OC_TILESHIFT;
+        tx1 = right >> OC_TILESHIFT;
+        facebits = oc_facebits + ty * oc_tilewidth;
+
+        for (tx = tx0; tx <= tx1; tx++) {
+            sx = tx == tx0 ? left & (OC_TILE - 1) : 0;
+            ex = tx == tx1 ? right & (OC_TILE - 1) : OC_TILE - 1;
+            bits = ((0xffull >> (OC_TILE - 1 - (ex - sx))) << sx) << (((y - r_refdef.vrect.y) & (OC_TILE - 1)) * OC_TILE);
+
+            if (!(bits & ~facebits[tx])) {
+                continue; // already hidden by a nearer face
+            }
+
+            facebits[tx] |= bits;
+
+            // 1/z is linear on screen, so the nearest over the tile is at a
+            // corner, and it can't be nearer than the face's nearest vertex
+            u0 = r_refdef.vrect.x + (tx << OC_TILESHIFT);
+            u1 = u0 + OC_TILE;
+            v0 = r_refdef.vrect.y + (ty << OC_TILESHIFT);
+            v1 = v0 + OC_TILE;
+            cu = surf->d_zistepu * (surf->d_zistepu < 0 ? u1 : u0);
+            cv = surf->d_zistepv * (surf->d_zistepv < 0 ? v1 : v0);
+            zi = surf->d_ziorigin + cu + cv;
+            if (zi < minzi) {
+                zi = minzi;
+            }
+
+            if (zi < oc_facezi[ty * oc_tilewidth + tx]) {
+                oc_facezi[ty * oc_tilewidth + tx] = zi;
+            }
+        }
+    }
+}
+
+/*
+===============
+R_OcclusionAddSpans
+
+Folds the spans waiting in the surface list into the tiles; called just
+before the driver draws and throws them away
+===============
+*/
+void R_OcclusionAddSpans(void)
+{
+    surf_t* s;
+    espan_t* span;
+    float zistepu, zistepv, ziorigin, zi0, zi1, zirow;
+    float* minzi;
+    int* count;
+    int u, u2, end, tile, x, y;
+
+    if (!r_occlusion.value || !oc_numtiles) {
+        return;
+    }
+
+    // first time through this frame
+    if (!oc_scanned) {
+        for (tile = 0; tile < oc_numtiles; tile++) {
+            oc_minzi[tile] = 1e30;
+        }
+
+        oc_scanned = true;
+    }
+
+    x = r_refdef.vrect.x;
+    y = r_refdef.vrect.y;
+
+    for (s = &surfaces[1]; s < surface_p; s++) {
+        if (!s->spans) {
+            continue;
+        }
+
+        // the sky and the background are as good as infinitely far away
+        if (s->flags & (SURF_DRAWSKY | SURF_DRAWBACKGROUND)) {
+            zistepu = zistepv = ziorigin = 0;
+        } else {
+            zistepu = s->d_zistepu;
+            zistepv = s->d_zistepv;
+            ziorigin = s->d_ziorigin;
+        }
+
+        for (span = s->spans; span; span = span->pnext) {
+            zirow = ziorigin + span->v * zistepv;
+            tile = ((span->v - y) >> OC_TILESHIFT) * oc_tilewidth;
+            minzi = oc_minzi + tile;
+            count = oc_count + tile;
+
+            // 1/z is linear along the span, so the ends of each piece bound it
+            u = span->u - x;
+            u2 = u + span->count;
+            for (; u < u2; u = end) {
+                end = (u | (OC_TILE - 1)) + 1;
+                if (end > u2) {
+                    end = u2;
+                }
+
+                tile = u >> OC_TILESHIFT;
+                zi0 = zirow + (u + x) * zistepu;
+                zi1 = zirow + (end - 1 + x) * zistepu;
+                if (zi1 < zi0) {
+                    zi0 = zi1;
+                }
+
+                if (zi0 < minzi[tile]) {
+                    minzi[tile] = zi0;
+                }
+
+                count[tile] += end - u;
+            }
+        }
+    }
+}
+
+/*
+===============
+R_OcclusionReduce
+
+Builds the upper levels of a pyramid, each tile keeping the farthest of the
+ones below it
+===============
+*/
+static void R_OcclusionReduce(ocpyramid_t* p)
+{
+    int i, x, y, x2, y2, w, h, pw, ph;
+    float *in, *out, zi;
+
+    for (i = 1; i < p->numlevels; i++) {
+        in = p->level[i - 1];
+        out = p->level[i];
+        pw = p->width[i - 1];
+        ph = p->height[i - 1];
+        w = p->width[i];
+        h = p->height[i];
+
+        for (y = 0; y < h; y++) {
+            for (x = 0; x < w; x++) {
+                x2 = x * 2;
+                y2 = y * 2;
+
+                zi = in[y2 * pw + x2];
+                if (x2 + 1 < pw && in[y2 * pw + x2 + 1] < zi) {
+                    zi = in[y2 * pw + x2 + 1];
+                }
+
+                if (y2 + 1 < ph) {
+                    if (in[(y2 + 1) * pw + x2] < zi) {
+                        zi = in[(y2 + 1) * pw + x2];
+                    }
+
+                    if (x2 + 1 < pw && in[(y2 + 1) * pw + x2 + 1] < zi) {
+                        zi = in[(y2 + 1) * pw + x2 + 1];
+                    }
+                }
+
+                out[y * w + x] = zi;
+            }
+        }
+    }
+}
+
+/*
+===============
+R_FinishOcclusion
+
+Turns the scanned tiles into pyramids.  A tile that wasn't completely covered
+can't hide anything, so it gets a 1/z of 0.
+===============
+*/
+void R_FinishOcclusion(void)
+{
+    int x, y, w, h, area, tile;
+    float* frame;
+
+    if (!oc_scanned) {
+        return;
+    }
+
+    frame = oc_frame.level[0];
+
+    for (y = 0; y < oc_tileheight; y++) {
+        h = r_refdef.vrect.height - (y << OC_TILESHIFT);
+        if (h > OC_TILE) {
+            h = OC_TILE;
+        }
+
+        for (x = 0; x < oc_tilewidth; x++) {
+            w = r_refdef.vrect.width - (x << OC_TILESHIFT);
+            if (w > OC_TILE) {
+                w = OC_TILE;
+            }
+
+            area = w * h;
+            tile = y * oc_tilewidth + x;
+
+            if (oc_count[tile] == area && oc_minzi[tile] > 0) {
+                frame[tile] = oc_minzi[tile];
+            } else {
+                frame[tile] = 0;
+            }
+        }
+    }
+
+    R_OcclusionReduce(&oc_frame);
+}
+
+/*
+===============
+R_OccludedBox
+
+True if the box is completely hidden behind what has been drawn.  With world
+set it is checked against the world faces sent so far in this pass.
+===============
+*/
+qboolean R_OccludedBox(vec3_t mins, vec3_t maxs, qboolean world)
+{
+    ocpyramid_t* p;
+    vec3_t corner, local;
+    float x, y, z, zi, nearz, umin, umax, vmin, vmax, u, v;
+    float* level;
+    int i, x0, x1, y0, y1, l, tx, ty, tile;
+
+    if (world ? !oc_faces : !oc_scanned) {
+        return false;
+    }
+
+    p = &oc_frame;
+
+    nearz = 1e30;
+    umin = vmin = 1e30;
+    umax = vmax = -1e30;
+
+    for (i = 0; i < 8; i++) {
+        corner[0] = (i & 1) ? maxs[0] : mins[0];
+        corner[1] = (i & 2) ? maxs[1] : mins[1];
+        corner[2] = (i & 4) ? maxs[2] : mins[2];
+        VectorSubtract(corner, r_origin, local);
+
+        z = DotProduct(local, vpn);
+        if (z < NEAR_CLIP) {
+            return false; // reaches the eye
+        }
+
+        x = DotProduct(local, vright);
+        y = DotProduct(local, vup);
+        zi = 1.0 / z;
+
+        u = xcenter + xscale * x * zi;
+        v = ycenter - yscale * y * zi;
+
+        if (z < nearz) {
+            nearz = z;
+        }
+
+        if (u < umin) {
+            umin = u;
+        }
+
+        if (u > umax) {
+            umax = u;
+        }
+
+        if (v < vmin) {
+            vmin = v;
+        }
+
+        if (v > vmax) {
+            vmax = v;
+        }
+    }
+
+    // a pixel of slack all round for the edge stepping
+    x0 = (int)floor(umin) - 1 - r_refdef.vrect.x;
+    x1 = (int)ceil(umax) + 1 - r_refdef.vrect.x;
+    y0 = (int)floor(vmin) - 1 - r_refdef.vrect.y;
+    y1 = (int)ceil(vmax) + 1 - r_refdef.vrect.y;
+
+    if (x0 < 0) {
+        x0 = 0;
+    }
+
+    if (y0 < 0) {
+        y0 = 0;
+    }
+
+    if (x1 >= r_refdef.vrect.width) {
+        x1 = r_refdef.vrect.width - 1;
+    }
+
+    if (y1 >= r_refdef.vrect.height) {
+        y1 = r_refdef.vrect.height - 1;
+    }
+
+    if (x0 > x1 || y0 > y1) {
+        return false; // off screen, leave it to the frustum
+    }
+
+    x0 >>= OC_TILESHIFT;
+    x1 >>= OC_TILESHIFT;
+    y0 >>= OC_TILESHIFT;
+    y1 >>= OC_TILESHIFT;
+
+    zi = OC_BIAS / nearz;
+
+    if (world) {
+        for (ty = y0; ty <= y1; ty++) {
+            for (tx = x0; tx <= x1; tx++) {
+                tile = ty * oc_tilewidth + tx;
+                if (~oc_facebits[tile] || oc_facezi[tile] <= zi) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // go up until the box covers no more than 2x2 tiles
+    for (l = 0; l < p->numlevels - 1 && (x1 - x0 > 1 || y1 - y0 > 1); l++) {
+        x0 >>= 1;
+        x1 >>= 1;
+        y0 >>= 1;
+        y1 >>= 1;
+    }
+
+    level = p->level[l];
+
+    for (ty = y0; ty <= y1; ty++) {
+        for (tx = x0; tx <= x1; tx++) {
+            if (level[ty * p->width[l] + tx] <= zi) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+===============
+R_OccludedEntity
+
+Checks a box that holds the entity however it is turned
+===============
+*/
+qboolean R_OccludedEntity(entity_t* ent, qboolean world)
+{
+    model_t* clmodel;
+    aliashdr_t* paliashdr;
+    mdl_t* pmdl;
+    vec3_t mins, maxs;
+    float radius;
+    int i;
+
+    clmodel = ent->model;
+
+    switch (clmodel->type) {
+    case mod_alias:
+        paliashdr = (aliashdr_t*)Mod_Extradata(clmodel);
+        pmdl = (mdl_t*)((byte*)paliashdr + paliashdr->model);
+        radius = pmdl->boundingradius;
+        break;
+
+    case mod_sprite:
+        radius = Length(clmodel->mins);
+        if (Length(clmodel->maxs) > radius) {
+            radius = Length(clmodel->maxs);
+        }
+
+        break;
+
+    case mod_brush:
+        if (!ent->angles[0] && !ent->angles[1] && !ent->angles[2]) {
+            VectorAdd(ent->origin, clmodel->mins, mins);
+            VectorAdd(ent->origin, clmodel->maxs, maxs);
+            return R_OccludedBox(mins, maxs, world);
+        }
+
+        radius = clmodel->radius;
+        break;
+
+    default:
+        return false;
+    }
+
+    for (i = 0; i < 3; i++) {
+        mins[i] = ent->origin[i] - radius;
+        maxs[i] = ent->origin[i] + radius;
+    }
+
+    return R_OccludedBox(mins, maxs, world);
+}
@@ -21,6 +21,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 #include "r_local.h"
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #define MAX_PARTICLES 2048 // default max # of particles at one
 //  time
 #define ABSOLUTE_MIN_PARTICLES 512 // no fewer than this no matter what's
@@ -30,10 +34,7 @@ int ramp1[8] = { 0x6f, 0x6d, 0x6b, 0x69, 0x67, 0x65, 0x63, 0x61 };
 int ramp2[8] = { 0x6f, 0x6e, 0x6d, 0x6c, 0x6b, 0x6a, 0x68, 0x66 };
 int ramp3[8] = { 0x6d, 0x6b, 6, 5, 4, 3 };
 
-particle_t *active_particles, *free_particles;
-
-particle_t* particles;
-int r_numparticles;
+particles_t particles;
 
 vec3_t r_pright, r_pup, r_ppn;
 
@@ -44,28 +45,65 @@ R_InitParticles
 */
 void R_InitParticles(void)
 {
-    int i;
+    int i, n, stride;
+    float* f;
 
     i = COM_CheckParm("-particles");
 
     if (i) {
-        r_numparticles = (int)(Q_atoi(com_argv[i + 1]));
-        if (r_numparticles < ABSOLUTE_MIN_PARTICLES) {
-            r_numparticles = ABSOLUTE_MIN_PARTICLES;
+        n = (int)(Q_atoi(com_argv[i + 1]));
+        if (n < ABSOLUTE_MIN_PARTICLES) {
+            n = ABSOLUTE_MIN_PARTICLES;
         }
     } else {
-        r_numparticles = MAX_PARTICLES;
+        n = MAX_PARTICLES;
+    }
+
+    // one block, each array starting on a 16 byte boundary
+    stride = (n + 3) & ~3;
+    f = (float*)Hunk_AllocName(stride * (8 * sizeof(float) + 2), "particles");
+
+    for (i = 0; i < 3; i++) {
+        particles.org[i] = f + i * stride;
+        particles.vel[i] = f + (3 + i) * stride;
     }
 
-    particles = (particle_t*)Hunk_AllocName(r_numparticles * sizeof(particle_t),
-        "particles");
+    particles.ramp = f + 6 * stride;
+    particles.die = f + 7 * stride;
+    particles.color = (byte*)(f + 8 * stride);
+    particles.type = particles.color + stride;
+
+    particles.numactive = 0;
+    particles.maxparticles = n;
+}
+
+/*
+===============
+R_AllocParticle
+
+Returns a particle with no velocity or ramp, or -1 if they are all in use
+===============
+*/
+static int R_AllocParticle(void)
+{
+    int p;
+
+    if (particles.numactive == particles.maxparticles) {
+        return -1;
+    }
+
+    p = particles.numactive++;
+    particles.vel[0][p] = particles.vel[1][p] = particles.vel[2][p] = 0;
+    particles.ramp[p] = 0;
+
+    return p;
 }
 
 #ifdef QUAKE2
 void R_DarkFieldParticles(entity_t* ent)
 {
-    int i, j, k;
-    particle_t* p;
+    int i, j, k, l;
+    int p;
     float vel;
     vec3_t dir;
     vec3_t org;
@@ -76,30 +114,27 @@ void R_DarkFieldParticles(entity_t* ent)
     for (i = -16; i < 16; i += 8) {
         for (j = -16; j < 16; j += 8) {
             for (k = 0; k < 32; k += 8) {
-                if (!free_particles) {
+                if ((p = R_AllocParticle()) < 0) {
                     return;
                 }
 
-                p = free_particles;
-                free_particles = p->next;
-                p->next = active_particles;
-                active_particles = p;
-
-                p->die = cl.time + 0.2 + (rand() & 7) * 0.02;
-                p->color = 150 + rand() % 6;
-                p->type = pt_slowgrav;
+                particles.die[p] = cl.time + 0.2 + (rand() & 7) * 0.02;
+                particles.color[p] = 150 + rand() % 6;
+                particles.type[p] = pt_slowgrav;
 
                 dir[0] = j * 8;
                 dir[1] = i * 8;
                 dir[2] = k * 8;
 
-                p->org[0] = org[0] + i + (rand() & 3);
-                p->org[1] = org[1] + j + (rand() & 3);
-                p->org[2] = org[2] + k + (rand() & 3);
+                particles.org[0][p] = org[0] + i + (rand() & 3);
+                particles.org[1][p] = org[1] + j + (rand() & 3);
+                particles.org[2][p] = org[2] + k + (rand() & 3);
 
                 VectorNormalize(dir);
                 vel = 50 + (rand() & 63);
-                VectorScale(dir, vel, p->vel);
+                for (l = 0; l < 3; l++) {
+                    particles.vel[l][p] = dir[l] * vel;
+                }
             }
         }
     }
@@ -124,7 +159,7 @@ void R_EntityParticles(entity_t* ent)
 {
     int count;
     int i;
-    particle_t* p;
+    int p;
     float angle;
     float sr, sp, sy, cr, cp, cy;
     vec3_t forward;
@@ -156,22 +191,17 @@ void R_EntityParticles(entity_t* ent)
         forward[1] = cp * sy;
         forward[2] = -sp;
 
-        if (!free_particles) {
+        if ((p = R_AllocParticle()) < 0) {
             return;
         }
 
-        p = free_particles;
-        free_particles = p->next;
-        p->next = active_particles;
-        active_particles = p;
+        particles.die[p] = cl.time + 0.01;
+        particles.color[p] = 0x6f;
+        particles.type[p] = pt_explode;
 
-        p->die = cl.time + 0.01;
-        p->color = 0x6f;
-        p->type = pt_explode;
-
-        p->org[0] = ent->origin[0] + r_avertexnormals[i][0] * dist + forward[0] * beamlength;
-        p->org[1] = ent->origin[1] + r_avertexnormals[i][1] * dist + forward[1] * beamlength;
-        p->org[2] = ent->origin[2] + r_avertexnormals[i][2] * dist + forward[2] * beamlength;
+        particles.org[0][p] = ent->origin[0] + r_avertexnormals[i][0] * dist + forward[0] * beamlength;
+        particles.org[1][p] = ent->origin[1] + r_avertexnormals[i][1] * dist + forward[1] * beamlength;
+        particles.org[2][p] = ent->origin[2] + r_avertexnormals[i][2] * dist + forward[2] * beamlength;
     }
 }
 
@@ -182,15 +212,7 @@ R_ClearParticles
 */
 void R_ClearParticles(void)
 {
-    int i;
-
-    free_particles = &particles[0];
-    active_particles = NULL;
-
-    for (i = 0; i < r_numparticles; i++) {
-        particles[i].next = &particles[i + 1];
-    }
-    particles[r_numparticles - 1].next = NULL;
+    particles.numactive = 0;
 }
 
 void R_ReadPointFile_f(void)
@@ -199,7 +221,8 @@ void R_ReadPointFile_f(void)
     vec3_t org;
     int r;
     int c;
-    particle_t* p;
+    int j;
+    int p;
     char name[MAX_OSPATH];
 
     sprintf(name, "maps/%s.pts", sv.name);
@@ -221,21 +244,17 @@ void R_ReadPointFile_f(void)
 
         c++;
 
-        if (!free_particles) {
+        if ((p = R_AllocParticle()) < 0) {
             Con_Printf("Not enough free particles\n");
             break;
         }
 
-        p = free_particles;
-        free_particles = p->next;
-        p->next = active_particles;
-        active_particles = p;
-
-        p->die = 99999;
-        p->color = (-c) & 15;
-        p->type = pt_static;
-        VectorCopy(vec3_origin, p->vel);
-        VectorCopy(org, p->org);
+        particles.die[p] = 99999;
+        particles.color[p] = (-c) & 15;
+        particles.type[p] = pt_static;
+        for (j = 0; j < 3; j++) {
+            particles.org[j][p] = org[j];
+        }
     }
 
     fclose(f);
@@ -281,32 +300,27 @@ R_ParticleExplosion
 void R_ParticleExplosion(vec3_t org)
 {
     int i, j;
-    particle_t* p;
+    int p;
 
     for (i = 0; i < 1024; i++) {
-        if (!free_particles) {
+        if ((p = R_AllocParticle()) < 0) {
             return;
         }
 
-        p = free_particles;
-        free_particles = p->next;
-        p->next = active_particles;
-        active_particles = p;
-
-        p->die = cl.time + 5;
-        p->color = ramp1[0];
-        p->ramp = rand() & 3;
+        particles.die[p] = cl.time + 5;
+        particles.color[p] = ramp1[0];
+        particles.ramp[p] = rand() & 3;
         if (i & 1) {
-            p->type = pt_explode;
+            particles.type[p] = pt_explode;
             for (j = 0; j < 3; j++) {
-                p->org[j] = org[j] + ((rand() % 32) - 16);
-                p->vel[j] = (rand() % 512) - 256;
+                particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+                particles.vel[j][p] = (rand() % 512) - 256;
             }
         } else {
-            p->type = pt_explode2;
+            particles.type[p] = pt_explode2;
             for (j = 0; j < 3; j++) {
-                p->org[j] = org[j] + ((rand() % 32) - 16);
-                p->vel[j] = (rand() % 512) - 256;
+                particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+                particles.vel[j][p] = (rand() % 512) - 256;
             }
         }
     }
@@ -321,27 +335,22 @@ R_ParticleExplosion2
 void R_ParticleExplosion2(vec3_t org, int colorStart, int colorLength)
 {
     int i, j;
-    particle_t* p;
+    int p;
     int colorMod = 0;
 
     for (i = 0; i < 512; i++) {
-        if (!free_particles) {
+        if ((p = R_AllocParticle()) < 0) {
             return;
         }
 
-        p = free_particles;
-        free_particles = p->next;
-        p->next = active_particles;
-        active_particles = p;
-
-        p->die = cl.time + 0.3;
-        p->color = colorStart + (colorMod % colorLength);
+        particles.die[p] = cl.time + 0.3;
+        particles.color[p] = colorStart + (colorMod % colorLength);
         colorMod++;
 
-        p->type = pt_blob;
+        particles.type[p] = pt_blob;
         for (j = 0; j < 3; j++) {
-            p->org[j] = org[j] + ((rand() % 32) - 16);
-            p->vel[j] = (rand() % 512) - 256;
+            particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+            particles.vel[j][p] = (rand() % 512) - 256;
         }
     }
 }
@@ -355,33 +364,28 @@ R_BlobExplosion
 void R_BlobExplosion(vec3_t org)
 {
     int i, j;
-    particle_t* p;
+    int p;
 
     for (i = 0; i < 1024; i++) {
-        if (!free_particles) {
+        if ((p = R_AllocParticle()) < 0) {
             return;
         }
 
-        p = free_particles;
-        free_particles = p->next;
-        p->next = active_particles;
-        active_particles = p;
-
-        p->die = cl.time + 1 + (rand() & 8) * 0.05;
+        particles.die[p] = cl.time + 1 + (rand() & 8) * 0.05;
 
         if (i & 1) {
-            p->type = pt_blob;
-            p->color = 66 + rand() % 6;
+            particles.type[p] = pt_blob;
+            particles.color[p] = 66 + rand() % 6;
             for (j = 0; j < 3; j++) {
-                p->org[j] = org[j] + ((rand() % 32) - 16);
-                p->vel[j] = (rand() % 512) - 256;
+                particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+                particles.vel[j][p] = (rand() % 512) - 256;
             }
         } else {
-            p->type = pt_blob2;
-            p->color = 150 + rand() % 6;
+            particles.type[p] = pt_blob2;
+            particles.color[p] = 150 + rand() % 6;
             for (j = 0; j < 3; j++) {
-                p->org[j] = org[j] + ((rand() % 32) - 16);
-                p->vel[j] = (rand() % 512) - 256;
+                particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+                particles.vel[j][p] = (rand() % 512) - 256;
             }
         }
     }
@@ -396,42 +400,37 @@ R_RunParticleEffect
 void R_RunParticleEffect(vec3_t org, vec3_t dir, int color, int count)
 {
     int i, j;
-    particle_t* p;
+    int p;
 
     for (i = 0; i < count; i++) {
-        if (!free_particles) {
+        if ((p = R_AllocParticle()) < 0) {
             return;
         }
 
-        p = free_particles;
-        free_particles = p->next;
-        p->next = active_particles;
-        active_particles = p;
-
         if (count == 1024) { // rocket explosion
-            p->die = cl.time + 5;
-            p->color = ramp1[0];
-            p->ramp = rand() & 3;
+            particles.die[p] = cl.time + 5;
+            particles.color[p] = ramp1[0];
+            particles.ramp[p] = rand() & 3;
             if (i & 1) {
-                p->type = pt_explode;
+                particles.type[p] = pt_explode;
                 for (j = 0; j < 3; j++) {
-                    p->org[j] = org[j] + ((rand() % 32) - 16);
-                    p->vel[j] = (rand() % 512) - 256;
+                    particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+                    particles.vel[j][p] = (rand() % 512) - 256;
                 }
             } else {
-                p->type = pt_explode2;
+                particles.type[p] = pt_explode2;
                 for (j = 0; j < 3; j++) {
-                    p->org[j] = org[j] + ((rand() % 32) - 16);
-                    p->vel[j] = (rand() % 512) - 256;
+                    particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+                    particles.vel[j][p] = (rand() % 512) - 256;
                 }
             }
         } else {
-            p->die = cl.time + 0.1 * (rand() % 5);
-            p->color = (color & ~7) + (rand() & 7);
-            p->type = pt_slowgrav;
+            particles.die[p] = cl.time + 0.1 * (rand() % 5);
+            particles.color[p] = (color & ~7) + (rand() & 7);
+            particles.type[p] = pt_slowgrav;
             for (j = 0; j < 3; j++) {
-                p->org[j] = org[j] + ((rand() & 15) - 8);
-                p->vel[j] = dir[j] * 15; // + (rand()%300)-150;
+                particles.org[j][p] = org[j] + ((rand() & 15) - 8);
+                particles.vel[j][p] = dir[j] * 15; // + (rand()%300)-150;
             }
         }
     }
@@ -445,38 +444,35 @@ R_LavaSplash
 */
 void R_LavaSplash(vec3_t org)
 {
-    int i, j, k;
-    particle_t* p;
+    int i, j, k, l;
+    int p;
     float vel;
     vec3_t dir;
 
     for (i = -16; i < 16; i++) {
         for (j = -16; j < 16; j++) {
             for (k = 0; k < 1; k++) {
-                if (!free_particles) {
+                if ((p = R_AllocParticle()) < 0) {
                     return;
                 }
 
-                p = free_particles;
-                free_particles = p->next;
-                p->next = active_particles;
-                active_particles = p;
-
-                p->die = cl.time + 2 + (rand() & 31) * 0.02;
-                p->color = 224 + (rand() & 7);
-                p->type = pt_slowgrav;
+                particles.die[p] = cl.time + 2 + (rand() & 31) * 0.02;
+                particles.color[p] = 224 + (rand() & 7);
+                particles.type[p] = pt_slowgrav;
 
                 dir[0] = j * 8 + (rand() & 7);
                 dir[1] = i * 8 + (rand() & 7);
                 dir[2] = 256;
 
-                p->org[0] = org[0] + dir[0];
-                p->org[1] = org[1] + dir[1];
-                p->org[2] = org[2] + (rand() & 63);
+                particles.org[0][p] = org[0] + dir[0];
+                particles.org[1][p] = org[1] + dir[1];
+                particles.org[2][p] = org[2] + (rand() & 63);
 
                 VectorNormalize(dir);
                 vel = 50 + (rand() & 63);
-                VectorScale(dir, vel, p->vel);
+                for (l = 0; l < 3; l++) {
+                    particles.vel[l][p] = dir[l] * vel;
+                }
             }
         }
     }
@@ -490,38 +486,35 @@ R_TeleportSplash
 */
 void R_TeleportSplash(vec3_t org)
 {
-    int i, j, k;
-    particle_t* p;
+    int i, j, k, l;
+    int p;
     float vel;
     vec3_t dir;
 
     for (i = -16; i < 16; i += 4) {
         for (j = -16; j < 16; j += 4) {
             for (k = -24; k < 32; k += 4) {
-                if (!free_particles) {
+                if ((p = R_AllocParticle()) < 0) {
                     return;
                 }
 
-                p = free_particles;
-                free_particles = p->next;
-                p->next = active_particles;
-                active_particles = p;
-
-                p->die = cl.time + 0.2 + (rand() & 7) * 0.02;
-                p->color = 7 + (rand() & 7);
-                p->type = pt_slowgrav;
+                particles.die[p] = cl.time + 0.2 + (rand() & 7) * 0.02;
+                particles.color[p] = 7 + (rand() & 7);
+                particles.type[p] = pt_slowgrav;
 
                 dir[0] = j * 8;
                 dir[1] = i * 8;
                 dir[2] = k * 8;
 
-                p->org[0] = org[0] + i + (rand() & 3);
-                p->org[1] = org[1] + j + (rand() & 3);
-                p->org[2] = org[2] + k + (rand() & 3);
+                particles.org[0][p] = org[0] + i + (rand() & 3);
+                particles.org[1][p] = org[1] + j + (rand() & 3);
+                particles.org[2][p] = org[2] + k + (rand() & 3);
 
                 VectorNormalize(dir);
                 vel = 50 + (rand() & 63);
-                VectorScale(dir, vel, p->vel);
+                for (l = 0; l < 3; l++) {
+                    particles.vel[l][p] = dir[l] * vel;
+                }
             }
         }
     }
@@ -532,7 +525,7 @@ void R_RocketTrail(vec3_t start, vec3_t end, int type)
     vec3_t vec;
     float len;
     int j;
-    particle_t* p;
+    int p;
     int dec;
     static int tracercount;
 
@@ -548,83 +541,79 @@ void R_RocketTrail(vec3_t start, vec3_t end, int type)
     while (len > 0) {
         len -= dec;
 
-        if (!free_particles) {
+        if ((p = R_AllocParticle()) < 0) {
             return;
         }
 
-        p = free_particles;
-        free_particles = p->next;
-        p->next = active_particles;
-        active_particles = p;
-
-        VectorCopy(vec3_origin, p->vel);
-        p->die = cl.time + 2;
+        particles.die[p] = cl.time + 2;
 
         switch (type) {
         case 0: // rocket trail
-            p->ramp = (rand() & 3);
-            p->color = ramp3[(int)p->ramp];
-            p->type = pt_fire;
+            particles.ramp[p] = (rand() & 3);
+            particles.color[p] = ramp3[(int)particles.ramp[p]];
+            particles.type[p] = pt_fire;
             for (j = 0; j < 3; j++) {
-                p->org[j] = start[j] + ((rand() % 6) - 3);
+                particles.org[j][p] = start[j] + ((rand() % 6) - 3);
             }
             break;
 
         case 1: // smoke smoke
-            p->ramp = (rand() & 3) + 2;
-            p->color = ramp3[(int)p->ramp];
-            p->type = pt_fire;
+            particles.ramp[p] = (rand() & 3) + 2;
+            particles.color[p] = ramp3[(int)particles.ramp[p]];
+            particles.type[p] = pt_fire;
             for (j = 0; j < 3; j++) {
-                p->org[j] = start[j] + ((rand() % 6) - 3);
+                particles.org[j][p] = start[j] + ((rand() % 6) - 3);
             }
             break;
 
         case 2: // blood
-            p->type = pt_grav;
-            p->color = 67 + (rand() & 3);
+            particles.type[p] = pt_grav;
+            particles.color[p] = 67 + (rand() & 3);
             for (j = 0; j < 3; j++) {
-                p->org[j] = start[j] + ((rand() % 6) - 3);
+                particles.org[j][p] = start[j] + ((rand() % 6) - 3);
             }
             break;
 
         case 3:
         case 5: // tracer
-            p->die = cl.time + 0.5;
-            p->type = pt_static;
+            particles.die[p] = cl.time + 0.5;
+            particles.type[p] = pt_static;
             if (type == 3) {
-                p->color = 52 + ((tracercount & 4) << 1);
+                particles.color[p] = 52 + ((tracercount & 4) << 1);
             } else {
-                p->color = 230 + ((tracercount & 4) << 1);
+                particles.color[p] = 230 + ((tracercount & 4) << 1);
             }
 
             tracercount++;
 
-            VectorCopy(start, p->org);
+            for (j = 0; j < 3; j++) {
+                particles.org[j][p] = start[j];
+            }
             if (tracercount & 1) {
-                p->vel[0] = 30 * vec[1];
-                p->vel[1] = 30 * -vec[0];
+                particles.vel[0][p] = 30 * vec[1];
+                particles.vel[1][p] = 30 * -vec[0];
             } else {
-                p->vel[0] = 30 * -vec[1];
-                p->vel[1] = 30 * vec[0];
+                particles.vel[0][p] = 30 * -vec[1];
+                particles.vel[1][p] = 30 * vec[0];
             }
 
             break;
 
         case 4: // slight blood
-            p->type = pt_grav;
-            p->color = 67 + (rand() & 3);
+            particles.type[p] = pt_grav;
+            particles.color[p] = 67 + (rand() & 3);
             for (j = 0; j < 3; j++) {
-                p->org[j] = start[j] + ((rand() % 6) - 3);
+                particles.org[j][p] = start[j] + ((rand() % 6) - 3);
             }
             len -= 3;
             break;
 
         case 6: // voor trail
-            p->color = 9 * 16 + 8 + (rand() & 3);
-            p->type = pt_static;
-            p->die = cl.time + 0.3;
+            particles.color[p] = 9 * 16 + 8 + (rand() & 3);
+            particles.type[p] = pt_static;
+            particles.die[p] = cl.time + 0.3;
             for (j = 0; j < 3; j++) {
-                p->org[j] = start[j] + ((rand() & 15) - 8);
+                particles.org[j][p] = start[j] + ((rand() & 15) - 8);
             }
             break;
         }
@@ -635,24 +624,192 @@ void R_RocketTrail(vec3_t start, vec3_t end, int type)
 
 /*
 ===============
-R_DrawParticles
+R_KillParticles
+
+Moves the last live particle into each dead one's place, so the live ones
+stay packed at the front
 ===============
 */
+static void R_KillParticles(void)
+{
+    int i, j, last;
+
+    for (i = 0; i < particles.numactive;) {
+        if (!(particles.die[i] < cl.time)) {
+            i++;
+            continue;
+        }
+
+        last = --particles.numactive;
+        for (j = 0; j < 3; j++) {
+            particles.org[j][i] = particles.org[j][last];
+            particles.vel[j][i] = particles.vel[j][last];
+        }
+
+        particles.ramp[i] = particles.ramp[last];
+        particles.die[i] = particles.die[last];
+        particles.color[i] = particles.color[last];
+        particles.type[i] = particles.type[last];
+    }
+}
+
+#define NUM_PTYPES (pt_blob2 + 1)
+
+// every particle type moves the same way, only the numbers differ
+typedef struct {
+    float scalexy, scalez; // velocity multipliers
+    float accel;           // added to the z velocity
+    float rampstep;
+    float rampend; // burns out when the ramp gets this far
+    int* ramp;     // NULL if the color never changes
+} ptypephys_t;
+
 extern cvar_t sv_gravity;
 
-void R_DrawParticles(void)
+/*
+===============
+R_SetupParticlePhysics
+===============
+*/
+static void R_SetupParticlePhysics(ptypephys_t* phys, float frametime)
 {
-    particle_t *p, *kill;
-    float grav;
+    float grav, dvel;
     int i;
-    float time2, time3;
-    float time1;
-    float dvel;
-    float frametime;
 
+    grav = frametime * sv_gravity.value * 0.05;
+    dvel = 4 * frametime;
+
+    for (i = 0; i < NUM_PTYPES; i++) {
+        phys[i].scalexy = phys[i].scalez = 1;
+        phys[i].accel = -grav;
+        phys[i].rampstep = 0;
+        phys[i].rampend = 0;
+        phys[i].ramp = NULL;
+    }
+
+    phys[pt_static].accel = 0;
+
+#ifdef QUAKE2
+    phys[pt_grav].accel = -grav * 20;
+#endif
+
+    phys[pt_fire].accel = grav;
+    phys[pt_fire].rampstep = frametime * 5;
+    phys[pt_fire].rampend = 6;
+    phys[pt_fire].ramp = ramp3;
+
+    phys[pt_explode].scalexy = phys[pt_explode].scalez = 1 + dvel;
+    phys[pt_explode].rampstep = frametime * 10;
+    phys[pt_explode].rampend = 8;
+    phys[pt_explode].ramp = ramp1;
+
+    phys[pt_explode2].scalexy = phys[pt_explode2].scalez = 1 - frametime;
+    phys[pt_explode2].rampstep = frametime * 15;
+    phys[pt_explode2].rampend = 8;
+    phys[pt_explode2].ramp = ramp2;
+
+    phys[pt_blob].scalexy = phys[pt_blob].scalez = 1 + dvel;
+
+    phys[pt_blob2].scalexy = 1 - dvel;
+}
+
+/*
+===============
+R_MoveParticles
+===============
+*/
+static void R_MoveParticles(float frametime)
+{
+    ptypephys_t phys[NUM_PTYPES];
+    ptypephys_t* t;
+    float *ox, *oy, *oz, *vx, *vy, *vz, *ramp;
+    byte* type;
+    int i, count;
+
+    R_SetupParticlePhysics(phys, frametime);
+
+    ox = particles.org[0];
+    oy = particles.org[1];
+    oz = particles.org[2];
+    vx = particles.vel[0];
+    vy = particles.vel[1];
+    vz = particles.vel[2];
+    ramp = particles.ramp;
+    type = particles.type;
+    count = particles.numactive;
+    i = 0;
+
+#if defined(__SSE2__)
+    {
+        __m128 ft, x, y, z, scalexy, scalez, accel, rampstep;
+        ptypephys_t *t0, *t1, *t2, *t3;
+
+        ft = _mm_set1_ps(frametime);
+
+        for (; i + 4 <= count; i += 4) {
+            t0 = &phys[type[i]];
+            t1 = &phys[type[i + 1]];
+            t2 = &phys[type[i + 2]];
+            t3 = &phys[type[i + 3]];
+            scalexy = _mm_setr_ps(t0->scalexy, t1->scalexy, t2->scalexy, t3->scalexy);
+            scalez = _mm_setr_ps(t0->scalez, t1->scalez, t2->scalez, t3->scalez);
+            accel = _mm_setr_ps(t0->accel, t1->accel, t2->accel, t3->accel);
+            rampstep = _mm_setr_ps(t0->rampstep, t1->rampstep, t2->rampstep, t3->rampstep);
+
+            x = _mm_load_ps(vx + i);
+            y = _mm_load_ps(vy + i);
+            z = _mm_load_ps(vz + i);
+
+            _mm_store_ps(ox + i, _mm_add_ps(_mm_load_ps(ox + i), _mm_mul_ps(x, ft)));
+            _mm_store_ps(oy + i, _mm_add_ps(_mm_load_ps(oy + i), _mm_mul_ps(y, ft)));
+            _mm_store_ps(oz + i, _mm_add_ps(_mm_load_ps(oz + i), _mm_mul_ps(z, ft)));
+
+            _mm_store_ps(vx + i, _mm_mul_ps(x, scalexy));
+            _mm_store_ps(vy + i, _mm_mul_ps(y, scalexy));
+            _mm_store_ps(vz + i, _mm_add_ps(_mm_mul_ps(z, scalez), accel));
+            _mm_store_ps(ramp + i, _mm_add_ps(_mm_load_ps(ramp + i), rampstep));
+        }
+    }
+#endif
+
+    for (; i < count; i++) {
+        t = &phys[type[i]];
+
+        ox[i] += vx[i] * frametime;
+        oy[i] += vy[i] * frametime;
+        oz[i] += vz[i] * frametime;
+
+        vx[i] *= t->scalexy;
+        vy[i] *= t->scalexy;
+        vz[i] = vz[i] * t->scalez + t->accel;
+        ramp[i] += t->rampstep;
+    }
+
+    for (i = 0; i < count; i++) {
+        t = &phys[type[i]];
+        if (!t->ramp) {
+            continue;
+        }
+
+        if (ramp[i] >= t->rampend) {
+            particles.die[i] = -1;
+        } else {
+            particles.color[i] = t->ramp[(int)ramp[i]];
+        }
+    }
+}
+
+/*
+===============
+R_DrawParticles
+===============
+*/
+void R_DrawParticles(void)
+{
 #ifdef GLQUAKE
     vec3_t up, right;
-    float scale;
+    float scale, x, y, z;
+    int p;
 
     GL_Bind(particletexture);
     glEnable(GL_BLEND);
@@ -668,129 +825,36 @@ void R_DrawParticles(void)
     VectorScale(vup, yscaleshrink, r_pup);
     VectorCopy(vpn, r_ppn);
 #endif
-    frametime = cl.time - cl.oldtime;
-    time3 = frametime * 15;
-    time2 = frametime * 10; // 15;
-    time1 = frametime * 5;
-    grav = frametime * sv_gravity.value * 0.05;
-    dvel = 4 * frametime;
 
-    for (;;) {
-        kill = active_particles;
-        if (kill && kill->die < cl.time) {
-            active_particles = kill->next;
-            kill->next = free_particles;
-            free_particles = kill;
-            continue;
-        }
-
-        break;
-    }
-
-    for (p = active_particles; p; p = p->next) {
-        for (;;) {
-            kill = p->next;
-            if (kill && kill->die < cl.time) {
-                p->next = kill->next;
-                kill->next = free_particles;
-                free_particles = kill;
-                continue;
-            }
-
-            break;
-        }
+    R_KillParticles();
 
 #ifdef GLQUAKE
+    for (p = 0; p < particles.numactive; p++) {
+        x = particles.org[0][p];
+        y = particles.org[1][p];
+        z = particles.org[2][p];
+
         // hack a scale up to keep particles from disapearing
-        scale = (p->org[0] - r_origin[0]) * vpn[0] + (p->org[1] - r_origin[1]) * vpn[1] + (p->org[2] - r_origin[2]) * vpn[2];
+        scale = (x - r_origin[0]) * vpn[0] + (y - r_origin[1]) * vpn[1] + (z - r_origin[2]) * vpn[2];
         if (scale < 20) {
             scale = 1;
         } else {
             scale = 1 + scale * 0.004;
         }
 
-        glColor3ubv((byte*)&d_8to24table[(int)p->color]);
+        glColor3ubv((byte*)&d_8to24table[particles.color[p]]);
         glTexCoord2f(0, 0);
-        glVertex3fv(p->org);
+        glVertex3f(x, y, z);
         glTexCoord2f(1, 0);
-        glVertex3f(p->org[0] + up[0] * scale, p->org[1] + up[1] * scale,
-            p->org[2] + up[2] * scale);
+        glVertex3f(x + up[0] * scale, y + up[1] * scale, z + up[2] * scale);
         glTexCoord2f(0, 1);
-        glVertex3f(p->org[0] + right[0] * scale, p->org[1] + right[1] * scale,
-            p->org[2] + right[2] * scale);
+        glVertex3f(x + right[0] * scale, y + right[1] * scale, z + right[2] * scale);
+    }
 #else
-        D_DrawParticle(p);
+    D_DrawParticles(&particles);
 #endif
-        p->org[0] += p->vel[0] * frametime;
-        p->org[1] += p->vel[1] * frametime;
-        p->org[2] += p->vel[2] * frametime;
-
-        switch (p->type) {
-        case pt_static:
-            break;
-        case pt_fire:
-            p->ramp += time1;
-            if (p->ramp >= 6) {
-                p->die = -1;
-            } else {
-                p->color = ramp3[(int)p->ramp];
-            }
-
-            p->vel[2] += grav;
-            break;
-
-        case pt_explode:
-            p->ramp += time2;
-            if (p->ramp >= 8) {
-                p->die = -1;
-            } else {
-                p->color = ramp1[(int)p->ramp];
-            }
-
-            for (i = 0; i < 3; i++) {
-                p->vel[i] += p->vel[i] * dvel;
-            }
-            p->vel[2] -= grav;
-            break;
-
-        case pt_explode2:
-            p->ramp += time3;
-            if (p->ramp >= 8) {
-                p->die = -1;
-            } else {
-                p->color = ramp2[(int)p->ramp];
-            }
-
-            for (i = 0; i < 3; i++) {
-                p->vel[i] -= p->vel[i] * frametime;
-            }
-            p->vel[2] -= grav;
-            break;
-
-        case pt_blob:
-            for (i = 0; i < 3; i++) {
-                p->vel[i] += p->vel[i] * dvel;
-            }
-            p->vel[2] -= grav;
-            break;
 
-        case pt_blob2:
-            for (i = 0; i < 2; i++) {
-                p->vel[i] -= p->vel[i] * dvel;
-            }
-            p->vel[2] -= grav;
-            break;
-
-        case pt_grav:
-#ifdef QUAKE2
-            p->vel[2] -= grav * 20;
-            break;
-#endif
-        case pt_slowgrav:
-            p->vel[2] -= grav;
-            break;
-        }
-    }
+    R_MoveParticles(cl.time - cl.oldtime);
 
 #ifdef GLQUAKE
     glEnd();
@@ -29,9 +29,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define MAXVERTS 16                    // max points in a surface polygon
 #define MAXWORKINGVERTS (MAXVERTS + 4) // max points in an intermediate
 //  polygon (while processing)
+// largest video mode; the per-scanline tables are sized from the actual mode
+// at VID_Init, this only bounds the few tables still kept on the stack
 // !!! if this is changed, it must be changed in d_ifacea.h too !!!
-#define MAXHEIGHT 1024
-#define MAXWIDTH 1280
+#define MAXHEIGHT 2560
+#define MAXWIDTH 4096
 #define MAXDIMENSION ((MAXHEIGHT > MAXWIDTH) ? MAXHEIGHT : MAXWIDTH)
 
 #define SIN_BUFFER_SIZE (MAXDIMENSION + CYCLE)
@@ -44,8 +46,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 extern void R_DrawLine(polyvert_t* polyvert0, polyvert_t* polyvert1);
 
-extern int cachewidth;
-extern pixel_t* cacheblock;
+extern THREAD_LOCAL int cachewidth;
+extern THREAD_LOCAL pixel_t* cacheblock;
 extern int screenwidth;
 
 extern float pixelAspect;
@@ -53,6 +55,7 @@ extern float pixelAspect;
 extern int r_drawnpolycount;
 
 extern cvar_t r_clearcolor;
+extern cvar_t r_threads;
 
 extern int sintable[SIN_BUFFER_SIZE];
 extern int intsintable[SIN_BUFFER_SIZE];
@@ -62,11 +65,14 @@ extern vec3_t vpn, base_vpn;
 extern vec3_t vright, base_vright;
 extern entity_t* currententity;
 
-#define NUMSTACKEDGES 2400
-#define MINEDGES NUMSTACKEDGES
-#define NUMSTACKSURFACES 800
-#define MINSURFACES NUMSTACKSURFACES
-#define MAXSPANS 3000
+// the edge, surface and span pools start at these sizes and double as frames
+// overflow them
+#define MINEDGES 2400
+#define MAXEDGES (1 << 20)
+#define MINSURFACES 800
+#define MAXSURFACES 0xFFFF // edge_t.surfs is 16 bits
+#define MINSPANS 3000
+#define MAXSPANS (1 << 20)
 
 // !!! if this is changed, it must be changed in asm_draw.h too !!!
 typedef struct espan_s {
@@ -126,8 +132,13 @@ extern void SetUpForLineScan(fixed8_t startvertu,
 
 extern int r_skymade;
 extern void R_MakeSky(void);
+extern byte* R_TurbFrame(texture_t* tx);
 
-extern int ubasestep, errorterm, erroradjustup, erroradjustdown;
+extern THREAD_LOCAL int ubasestep, errorterm, erroradjustup, erroradjustdown;
+
+// scanlines [vstartscan, current_iv] hold the spans handed to D_DrawSurfaces
+extern int vstartscan;
+extern int current_iv;
 
 // flags in finalvert_t.flags
 #define ALIAS_LEFT_CLIP 0x0001
@@ -34,6 +34,9 @@ byte* r_skysource;
 int r_skymade;
 int r_skydirect; // not used?
 
+byte* r_skyframes; // r_animframes composited skies, see R_MakeSky
+byte* r_skybuilt;
+
 // TODO: clean up these routines
 
 byte bottomsky[128 * 131];
@@ -81,28 +84,19 @@ void R_InitSky(texture_t* mt)
 
 /*
 =================
-R_MakeSky
+R_CompositeSky
+
+Lays the top sky over the bottom sky scrolled by the given shifts, into
+128 bytes of each of pdest's 256-byte rows
 =================
 */
-void R_MakeSky(void)
+static void R_CompositeSky(byte* pdest, int xshift, int yshift)
 {
     int x, y;
     int ofs, baseofs;
-    int xshift, yshift;
-    unsigned* pnewsky;
-    static int xlast = -1, ylast = -1;
-
-    xshift = skytime * skyspeed;
-    yshift = skytime * skyspeed;
-
-    if ((xshift == xlast) && (yshift == ylast)) {
-        return;
-    }
+    byte* ptop;
 
-    xlast = xshift;
-    ylast = yshift;
-
-    pnewsky = (unsigned*)&newsky[0];
+    ptop = &newsky[128];
 
     for (y = 0; y < SKYSIZE; y++) {
         baseofs = ((y + yshift) & SKYMASK) * 131;
@@ -115,8 +109,7 @@ void R_MakeSky(void)
 
             // PORT: unaligned dword access to bottommask and bottomsky
 
-            *pnewsky = (*(pnewsky + (128 / sizeof(unsigned))) & *(unsigned*)&bottommask[ofs]) | *(unsigned*)&bottomsky[ofs];
-            pnewsky++;
+            *(unsigned*)&pdest[x] = (*(unsigned*)&ptop[x] & *(unsigned*)&bottommask[ofs]) | *(unsigned*)&bottomsky[ofs];
         }
 
 #else
@@ -124,15 +117,61 @@ void R_MakeSky(void)
         for (x = 0; x < SKYSIZE; x++) {
             ofs = baseofs + ((x + xshift) & SKYMASK);
 
-            *(byte*)pnewsky = (*((byte*)pnewsky + 128) & *(byte*)&bottommask[ofs]) | *(byte*)&bottomsky[ofs];
-            pnewsky = (unsigned*)((byte*)pnewsky + 1);
+            pdest[x] = (ptop[x] & bottommask[ofs]) | bottomsky[ofs];
         }
 
 #endif
 
-        pnewsky += 128 / sizeof(unsigned);
+        pdest += 256;
+        ptop += 256;
+    }
+}
+
+/*
+=================
+R_MakeSky
+
+With r_skyframes, each step of the scroll is composited once into its own
+frame and the drawers are pointed at it.  Frames are paired side by side,
+because the drawers want 256-byte rows.
+=================
+*/
+void R_MakeSky(void)
+{
+    int xshift, yshift;
+    int frame, step;
+    byte* pdest;
+    static int xlast = -1, ylast = -1;
+
+    xshift = skytime * skyspeed;
+    yshift = skytime * skyspeed;
+
+    if (r_skyframes) {
+        step = SKYSIZE / r_animframes;
+        frame = (xshift & SKYMASK) / step;
+        pdest = r_skyframes + (frame >> 1) * SKYSIZE * 256 + (frame & 1) * 128;
+
+        if (!r_skybuilt[frame]) {
+            R_CompositeSky(pdest, frame * step, frame * step);
+            r_skybuilt[frame] = 1;
+        }
+
+        r_skysource = pdest;
+        r_skymade = 1;
+        return;
     }
 
+    r_skysource = newsky;
+
+    if ((xshift == xlast) && (yshift == ylast)) {
+        return;
+    }
+
+    xlast = xshift;
+    ylast = yshift;
+
+    R_CompositeSky(newsky, xshift, yshift);
+
     r_skymade = 1;
 }
 
@@ -22,20 +22,26 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 #include "r_local.h"
 
-drawsurf_t r_drawsurf;
-
-int lightleft, sourcesstep, blocksize, sourcetstep;
-int lightdelta, lightdeltastep;
-int lightright, lightleftstep, lightrightstep, blockdivshift;
-unsigned blockdivmask;
-void* prowdestbase;
-unsigned char* pbasesource;
-int surfrowbytes; // used by ASM files
-unsigned* r_lightptr;
-int r_stepback;
-int r_lightwidth;
-int r_numhblocks, r_numvblocks;
-unsigned char *r_source, *r_sourcemax;
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// surfaces can be built on the worker threads, so all of the build state is
+// kept per thread
+THREAD_LOCAL drawsurf_t r_drawsurf;
+
+THREAD_LOCAL int lightleft, sourcesstep, blocksize, sourcetstep;
+THREAD_LOCAL int lightdelta, lightdeltastep;
+THREAD_LOCAL int lightright, lightleftstep, lightrightstep, blockdivshift;
+THREAD_LOCAL unsigned blockdivmask;
+THREAD_LOCAL void* prowdestbase;
+THREAD_LOCAL unsigned char* pbasesource;
+THREAD_LOCAL int surfrowbytes; // used by ASM files
+THREAD_LOCAL unsigned* r_lightptr;
+THREAD_LOCAL int r_stepback;
+THREAD_LOCAL int r_lightwidth;
+THREAD_LOCAL int r_numhblocks, r_numvblocks;
+THREAD_LOCAL unsigned char *r_source, *r_sourcemax;
 
 void R_DrawSurfaceBlock8_mip0(void);
 void R_DrawSurfaceBlock8_mip1(void);
@@ -47,7 +53,7 @@ static void (*surfmiptable[4])(void) = {
     R_DrawSurfaceBlock8_mip2, R_DrawSurfaceBlock8_mip3
 };
 
-unsigned blocklights[18 * 18];
+THREAD_LOCAL unsigned blocklights[18 * 18];
 
 /*
 ===============
@@ -65,6 +71,11 @@ void R_AddDynamicLights(void)
     int i;
     int smax, tmax;
     mtexinfo_t* tex;
+#if defined(__SSE2__) && !defined(QUAKE2)
+    __m128 vlocal, vrad, vminlight, vdist, vsum;
+    __m128i vs, vsd, vtd, vsign, vmax, vmin, vgt, vlit, vbl;
+    unsigned* bl;
+#endif
 
     surf = r_drawsurf.surf;
     smax = (surf->extents[0] >> 4) + 1;
@@ -96,6 +107,59 @@ void R_AddDynamicLights(void)
         local[0] -= surf->texturemins[0];
         local[1] -= surf->texturemins[1];
 
+#if defined(__SSE2__) && !defined(QUAKE2)
+        // four samples of a row at a time, with the same float rounding and
+        // truncation as the scalar loop below
+        vlocal = _mm_set1_ps(local[0]);
+        vrad = _mm_set1_ps(rad);
+        vminlight = _mm_set1_ps(minlight);
+
+        for (t = 0; t < tmax; t++) {
+            td = local[1] - t * 16;
+            if (td < 0) {
+                td = -td;
+            }
+
+            vtd = _mm_set1_epi32(td);
+            vs = _mm_setr_epi32(0, 16, 32, 48);
+            bl = &blocklights[t * smax];
+
+            for (s = 0; s + 4 <= smax; s += 4, vs = _mm_add_epi32(vs, _mm_set1_epi32(64))) {
+                vsd = _mm_cvttps_epi32(_mm_sub_ps(vlocal, _mm_cvtepi32_ps(vs)));
+                vsign = _mm_srai_epi32(vsd, 31);
+                vsd = _mm_sub_epi32(_mm_xor_si128(vsd, vsign), vsign);
+
+                // the larger distance plus half the smaller
+                vgt = _mm_cmpgt_epi32(vsd, vtd);
+                vmax = _mm_or_si128(_mm_and_si128(vgt, vsd), _mm_andnot_si128(vgt, vtd));
+                vmin = _mm_or_si128(_mm_and_si128(vgt, vtd), _mm_andnot_si128(vgt, vsd));
+                vdist = _mm_cvtepi32_ps(_mm_add_epi32(vmax, _mm_srai_epi32(vmin, 1)));
+
+                vlit = _mm_castps_si128(_mm_cmplt_ps(vdist, vminlight));
+                vbl = _mm_loadu_si128((__m128i*)(bl + s));
+                vsum = _mm_add_ps(_mm_cvtepi32_ps(vbl), _mm_mul_ps(_mm_sub_ps(vrad, vdist), _mm_set1_ps(256)));
+                vbl = _mm_or_si128(_mm_and_si128(vlit, _mm_cvttps_epi32(vsum)), _mm_andnot_si128(vlit, vbl));
+                _mm_storeu_si128((__m128i*)(bl + s), vbl);
+            }
+
+            for (; s < smax; s++) {
+                sd = local[0] - s * 16;
+                if (sd < 0) {
+                    sd = -sd;
+                }
+
+                if (sd > td) {
+                    dist = sd + (td >> 1);
+                } else {
+                    dist = td + (sd >> 1);
+                }
+
+                if (dist < minlight) {
+                    bl[s] += (rad - dist) * 256;
+                }
+            }
+        }
+#else
         for (t = 0; t < tmax; t++) {
             td = local[1] - t * 16;
             if (td < 0) {
@@ -138,6 +202,115 @@ void R_AddDynamicLights(void)
 #endif
             }
         }
+#endif
+    }
+}
+
+/*
+===============
+R_StaticLightForSurface
+
+Hands out a slot to keep the style and ambient lighting of a dynamically
+lit surface in, so the following frames only have to add the dlights.
+Called on the main thread as surfaces are queued for building.  A slot goes
+to one build a frame, since the builds run in parallel and another miplevel
+or instance of the same surface would be filling it at the same time.
+===============
+*/
+#define MAX_STATICLIGHTS 256
+
+typedef struct staticlight_s {
+    msurface_t* surf;
+    int lastframe;
+    qboolean valid;
+    int ambient;
+    fixed8_t lightadj[MAXLIGHTMAPS];
+    unsigned lights[18 * 18];
+} staticlight_t;
+
+static staticlight_t r_staticlights[MAX_STATICLIGHTS];
+static int r_nextstaticlight;
+
+staticlight_t* R_StaticLightForSurface(msurface_t* surf)
+{
+    staticlight_t* sl;
+
+    if (surf->dlightframe != r_framecount) {
+        return NULL;
+    }
+
+    if (surf->staticlight) {
+        sl = &r_staticlights[surf->staticlight - 1];
+        if (sl->surf == surf) {
+            if (sl->lastframe == r_framecount) {
+                return NULL; // already being built, light into blocklights
+            }
+
+            sl->lastframe = r_framecount;
+            return sl;
+        }
+    }
+
+    sl = &r_staticlights[r_nextstaticlight];
+    if (sl->lastframe == r_framecount) {
+        return NULL; // every slot is being built this frame
+    }
+
+    sl->surf = surf;
+    sl->lastframe = r_framecount;
+    sl->valid = false;
+    surf->staticlight = r_nextstaticlight + 1;
+
+    r_nextstaticlight = (r_nextstaticlight + 1) % MAX_STATICLIGHTS;
+
+    return sl;
+}
+
+/*
+===============
+R_AddStaticLights
+
+Sets lights to the ambient level plus every lightstyle of the surface
+===============
+*/
+static void R_AddStaticLights(msurface_t* surf, unsigned* lights, int size)
+{
+    byte* lightmap;
+    unsigned scale;
+    int maps;
+    int i;
+#if defined(__SSE2__)
+    __m128i vscale, vlm, zero;
+#endif
+
+    // clear to ambient
+    for (i = 0; i < size; i++) {
+        lights[i] = r_refdef.ambientlight << 8;
+    }
+
+    // add all the lightmaps
+    lightmap = surf->samples;
+    if (lightmap) {
+        for (maps = 0; maps < MAXLIGHTMAPS && surf->styles[maps] != 255; maps++) {
+            scale = r_drawsurf.lightadj[maps]; // 8.8 fraction
+            i = 0;
+#if defined(__SSE2__)
+            // scale is well under 0x8000, so a 16 bit multiply-add with the
+            // high halves zero gives the full product
+            vscale = _mm_set1_epi32(scale);
+            zero = _mm_setzero_si128();
+            for (; i + 4 <= size; i += 4) {
+                vlm = _mm_cvtsi32_si128(*(int*)(lightmap + i));
+                vlm = _mm_unpacklo_epi16(_mm_unpacklo_epi8(vlm, zero), zero);
+                vlm = _mm_add_epi32(_mm_loadu_si128((__m128i*)(lights + i)), _mm_madd_epi16(vlm, vscale));
+                _mm_storeu_si128((__m128i*)(lights + i), vlm);
+            }
+#endif
+            for (; i < size; i++) {
+                lights[i] += lightmap[i] * scale;
+            }
+            lightmap += size; // skip to next lightmap
+        }
     }
 }
 
@@ -153,17 +326,17 @@ void R_BuildLightMap(void)
     int smax, tmax;
     int t;
     int i, size;
-    byte* lightmap;
-    unsigned scale;
-    int maps;
     msurface_t* surf;
+    staticlight_t* sl;
+#if defined(__SSE2__)
+    __m128i vt, vmin, vlow;
+#endif
 
     surf = r_drawsurf.surf;
 
     smax = (surf->extents[0] >> 4) + 1;
     tmax = (surf->extents[1] >> 4) + 1;
     size = smax * tmax;
-    lightmap = surf->samples;
 
     if (r_fullbright.value || !cl.worldmodel->lightdata) {
         for (i = 0; i < size; i++) {
@@ -173,20 +346,18 @@ void R_BuildLightMap(void)
         return;
     }
 
-    // clear to ambient
-    for (i = 0; i < size; i++) {
-        blocklights[i] = r_refdef.ambientlight << 8;
-    }
-
-    // add all the lightmaps
-    if (lightmap) {
-        for (maps = 0; maps < MAXLIGHTMAPS && surf->styles[maps] != 255; maps++) {
-            scale = r_drawsurf.lightadj[maps]; // 8.8 fraction
-            for (i = 0; i < size; i++) {
-                blocklights[i] += lightmap[i] * scale;
-            }
-            lightmap += size; // skip to next lightmap
+    sl = r_drawsurf.staticlight;
+    if (sl) {
+        if (!sl->valid || sl->ambient != r_refdef.ambientlight || memcmp(sl->lightadj, r_drawsurf.lightadj, sizeof(sl->lightadj))) {
+            R_AddStaticLights(surf, sl->lights, size);
+            sl->ambient = r_refdef.ambientlight;
+            memcpy(sl->lightadj, r_drawsurf.lightadj, sizeof(sl->lightadj));
+            sl->valid = true;
         }
+
+        memcpy(blocklights, sl->lights, size * sizeof(*blocklights));
+    } else {
+        R_AddStaticLights(surf, blocklights, size);
     }
 
     // add all the dynamic lights
@@ -195,7 +366,18 @@ void R_BuildLightMap(void)
     }
 
     // bound, invert, and shift
-    for (i = 0; i < size; i++) {
+    i = 0;
+#if defined(__SSE2__)
+    vmin = _mm_set1_epi32(1 << 6);
+    for (; i + 4 <= size; i += 4) {
+        vt = _mm_sub_epi32(_mm_set1_epi32(255 * 256), _mm_loadu_si128((__m128i*)(blocklights + i)));
+        vt = _mm_srai_epi32(vt, 8 - VID_CBITS);
+        vlow = _mm_cmplt_epi32(vt, vmin);
+        vt = _mm_or_si128(_mm_and_si128(vlow, vmin), _mm_andnot_si128(vlow, vt));
+        _mm_storeu_si128((__m128i*)(blocklights + i), vt);
+    }
+#endif
+    for (; i < size; i++) {
         t = (255 * 256 - (int)blocklights[i]) >> (8 - VID_CBITS);
 
         if (t < (1 << 6)) {
@@ -565,19 +747,16 @@ void R_DrawSurfaceBlock16(void)
 
 //============================================================================
 
+int r_animframes;
+
 /*
 ================
-R_GenTurbTile
+R_WarpTurbTile
 ================
 */
-void R_GenTurbTile(pixel_t* pbasetex, void* pdest)
+static void R_WarpTurbTile(pixel_t* pbasetex, byte* pd, int* turb)
 {
-    int* turb;
     int i, j, s, t;
-    byte* pd;
-
-    turb = sintable + ((int)(cl.time * SPEED) & (CYCLE - 1));
-    pd = (byte*)pdest;
 
     for (i = 0; i < TILE_SIZE; i++) {
         for (j = 0; j < TILE_SIZE; j++) {
@@ -588,6 +767,120 @@ void R_GenTurbTile(pixel_t* pbasetex, void* pdest)
     }
 }
 
+/*
+================
+R_GenTurbTile
+================
+*/
+void R_GenTurbTile(pixel_t* pbasetex, void* pdest)
+{
+    R_WarpTurbTile(pbasetex, (byte*)pdest, sintable + ((int)(cl.time * SPEED) & (CYCLE - 1)));
+}
+
+/*
+================
+R_TurbFrame
+
+Returns the warped tile for the current turbulence phase, making it if this
+is the first time it has been asked for.  NULL if the texture has no frames
+kept, in which case it is warped per pixel as it is drawn.
+================
+*/
+byte* R_TurbFrame(texture_t* tx)
+{
+    int frame, step;
+    byte* pdest;
+
+    if (!tx->warpframes) {
+        return NULL;
+    }
+
+    step = CYCLE / r_animframes;
+    frame = ((int)(cl.time * SPEED) & (CYCLE - 1)) / step;
+    pdest = tx->warpframes + frame * TILE_SIZE * TILE_SIZE;
+
+    if (!tx->warpbuilt[frame]) {
+        R_WarpTurbTile((pixel_t*)((byte*)tx + tx->offsets[0]), pdest, sintable + frame * step);
+        tx->warpbuilt[frame] = 1;
+    }
+
+    return pdest;
+}
+
+/*
+================
+R_InitAnimFrames
+
+Sets aside room for r_animphases frames of the sky and of each turbulent
+world texture, halving the count until they fit in r_animcache kilobytes.
+Frames are made the first time they are drawn, and both cvars take effect
+on the next map.
+================
+*/
+void R_InitAnimFrames(void)
+{
+    texture_t* tx;
+    int i, frames, count, size;
+
+    r_animframes = 0;
+    r_skyframes = NULL;
+    r_skybuilt = NULL;
+
+    count = 0;
+    for (i = 0; i < cl.worldmodel->numtextures; i++) {
+        tx = cl.worldmodel->textures[i];
+        if (!tx) {
+            continue;
+        }
+
+        tx->warpframes = NULL;
+        tx->warpbuilt = NULL;
+
+        if (tx->name[0] == '*' || !Q_strncmp(tx->name, "sky", 3)) {
+            count++;
+        }
+    }
+
+    if (!count || r_pixbytes != 1 || r_animphases.value < 2) {
+        return;
+    }
+
+    // a power of two, so the frames divide the turbulence and sky cycles
+    // (CYCLE and SKYSIZE, which are the same) evenly
+    for (frames = CYCLE; frames > r_animphases.value; frames >>= 1) {
+    }
+
+    while (frames >= 2 && count * frames * TILE_SIZE * TILE_SIZE > r_animcache.value * 1024) {
+        frames >>= 1;
+    }
+
+    if (frames < 2) {
+        return;
+    }
+
+    size = 0;
+    for (i = 0; i < cl.worldmodel->numtextures; i++) {
+        tx = cl.worldmodel->textures[i];
+        if (!tx) {
+            continue;
+        }
+
+        if (tx->name[0] == '*') {
+            tx->warpframes = Hunk_AllocName(frames * TILE_SIZE * TILE_SIZE, "animtex");
+            tx->warpbuilt = Hunk_AllocName(frames, "animtex");
+            size += frames * TILE_SIZE * TILE_SIZE;
+        } else if (!Q_strncmp(tx->name, "sky", 3) && !r_skyframes) {
+            r_skyframes = Hunk_AllocName(frames * SKYSIZE * SKYSIZE, "animtex");
+            r_skybuilt = Hunk_AllocName(frames, "animtex");
+            size += frames * SKYSIZE * SKYSIZE;
+        }
+    }
+
+    r_animframes = frames;
+
+    Con_Printf("%ik animated texture cache, %i frames\n", size / 1024, frames);
+}
+
 /*
 ================
 R_GenTurbTile16
@@ -144,4 +144,5 @@ int D_SurfaceCacheForRes(int width, int height);
 void D_FlushCaches(void);
 void D_DeleteSurfaceCache(void);
 void D_InitCaches(void* buffer, int size);
+void R_AllocScanTables(int width, int height);
 void R_SetVrect(vrect_t* pvrect, vrect_t* pvrectin, int lineadj);
@@ -874,8 +874,6 @@ void Sbar_Draw(void)
         return;
     }
 
-    scr_copyeverything = 1;
-
     sb_updates++;
 
     if (sb_lines && vid.width > 320) {
@@ -1033,7 +1031,6 @@ void Sbar_DeathmatchOverlay(void)
     char num[12];
     scoreboard_t* s;
 
-    scr_copyeverything = 1;
     scr_fullupdate = 0;
 
     pic = Draw_CachePic("gfx/ranking.lmp");
@@ -1101,7 +1098,6 @@ void Sbar_MiniDeathmatchOverlay(void)
         return;
     }
 
-    scr_copyeverything = 1;
     scr_fullupdate = 0;
 
     // scores
@@ -1185,7 +1181,6 @@ void Sbar_IntermissionOverlay(void)
     int dig;
     int num;
 
-    scr_copyeverything = 1;
     scr_fullupdate = 0;
 
     if (cl.gametype == GAME_DEATHMATCH) {
@@ -1227,8 +1222,6 @@ void Sbar_FinaleOverlay(void)
 {
     qpic_t* pic;
 
-    scr_copyeverything = 1;
-
     pic = Draw_CachePic("gfx/finale.lmp");
     Draw_TransPic((vid.width - pic->width) / 2, 16, pic);
 }
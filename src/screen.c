@@ -22,10 +22,6 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 #include "r_local.h"
 
-// only the refresh window will be updated unless these variables are flagged
-int scr_copytop;
-int scr_copyeverything;
-
 float scr_con_current;
 float scr_conlines; // lines of console to display
 
@@ -64,6 +60,141 @@ qboolean block_drawing;
 
 void SCR_ScreenShot_f(void);
 
+// every draw into the screen adds the rect it touched, and only those are
+// handed to VID_Update.  Rects that touch or overlap are merged as they come
+// in, so a line of characters ends up as one rect.
+#define MAX_DIRTYRECTS 32
+
+static vrect_t scr_dirty[MAX_DIRTYRECTS];
+static int scr_numdirty;
+static vrect_t scr_lastdirty[MAX_DIRTYRECTS]; // last frame's, for the other page
+static int scr_numlastdirty;
+static vrect_t scr_updaterects[MAX_DIRTYRECTS * 2];
+
+/*
+==================
+SCR_UnionRect
+==================
+*/
+static void SCR_UnionRect(vrect_t* a, vrect_t* b, vrect_t* out)
+{
+    int x1, y1, x2, y2;
+
+    x1 = a->x < b->x ? a->x : b->x;
+    y1 = a->y < b->y ? a->y : b->y;
+    x2 = a->x + a->width > b->x + b->width ? a->x + a->width : b->x + b->width;
+    y2 = a->y + a->height > b->y + b->height ? a->y + a->height : b->y + b->height;
+
+    out->x = x1;
+    out->y = y1;
+    out->width = x2 - x1;
+    out->height = y2 - y1;
+}
+
+/*
+==================
+SCR_AddDirtyRect
+
+Marks part of the screen as changed this frame
+==================
+*/
+void SCR_AddDirtyRect(int x, int y, int width, int height)
+{
+    vrect_t r, u;
+    vrect_t* d;
+    int i, best, grow, bestgrow;
+
+    if (x < 0) {
+        width += x;
+        x = 0;
+    }
+
+    if (y < 0) {
+        height += y;
+        y = 0;
+    }
+
+    if (x + width > (int)vid.width) {
+        width = vid.width - x;
+    }
+
+    if (y + height > (int)vid.height) {
+        height = vid.height - y;
+    }
+
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+
+    r.x = x;
+    r.y = y;
+    r.width = width;
+    r.height = height;
+
+    // already covered, or close enough that merging wastes nothing
+    for (i = 0, d = scr_dirty; i < scr_numdirty; i++, d++) {
+        SCR_UnionRect(d, &r, &u);
+        if (u.width * u.height <= d->width * d->height + r.width * r.height) {
+            *d = u;
+            return;
+        }
+    }
+
+    if (scr_numdirty < MAX_DIRTYRECTS) {
+        scr_dirty[scr_numdirty++] = r;
+        return;
+    }
+
+    // out of rects, so grow whichever one grows least
+    best = 0;
+    bestgrow = 0x7fffffff;
+    for (i = 0, d = scr_dirty; i < scr_numdirty; i++, d++) {
+        SCR_UnionRect(d, &r, &u);
+        grow = u.width * u.height - d->width * d->height;
+        if (grow < bestgrow) {
+            bestgrow = grow;
+            best = i;
+        }
+    }
+
+    SCR_UnionRect(&scr_dirty[best], &r, &scr_dirty[best]);
+}
+
+/*
+==================
+SCR_DirtyRects
+
+Returns the rects changed this frame as a list for VID_Update, and starts
+the next frame with none.  With two pages, the page going up hasn't had
+last frame's changes either, so those are included too.
+==================
+*/
+static vrect_t* SCR_DirtyRects(void)
+{
+    int i, n;
+
+    n = 0;
+    for (i = 0; i < scr_numdirty; i++) {
+        scr_updaterects[n++] = scr_dirty[i];
+    }
+
+    if (vid.numpages > 1) {
+        for (i = 0; i < scr_numlastdirty; i++) {
+            scr_updaterects[n++] = scr_lastdirty[i];
+        }
+    }
+
+    memcpy(scr_lastdirty, scr_dirty, scr_numdirty * sizeof(*scr_dirty));
+    scr_numlastdirty = scr_numdirty;
+    scr_numdirty = 0;
+
+    for (i = 0; i < n; i++) {
+        scr_updaterects[i].pnext = i + 1 < n ? &scr_updaterects[i + 1] : NULL;
+    }
+
+    return n ? scr_updaterects : NULL;
+}
+
 /*
 ===============================================================================
 
@@ -120,7 +251,6 @@ void SCR_EraseCenterString(void)
         y = 48;
     }
 
-    scr_copytop = 1;
     Draw_TileClear(0, y, vid.width, 8 * scr_erase_lines);
 }
 
@@ -179,7 +309,6 @@ void SCR_DrawCenterString(void)
 
 void SCR_CheckDrawCenterString(void)
 {
-    scr_copytop = 1;
     if (scr_center_lines > scr_erase_lines) {
         scr_erase_lines = scr_center_lines;
     }
@@ -500,12 +629,10 @@ void SCR_SetUpToDrawConsole(void)
     }
 
     if (clearconsole++ < vid.numpages) {
-        scr_copytop = 1;
         Draw_TileClear(0, (int)scr_con_current, vid.width,
             vid.height - (int)scr_con_current);
         Sbar_Changed();
     } else if (clearnotify++ < vid.numpages) {
-        scr_copytop = 1;
         Draw_TileClear(0, 0, vid.width, con_notifylines);
     } else {
         con_notifylines = 0;
@@ -520,7 +647,6 @@ SCR_DrawConsole
 void SCR_DrawConsole(void)
 {
     if (scr_con_current) {
-        scr_copyeverything = 1;
         Con_DrawConsole(scr_con_current, true);
         clearconsole = 0;
     } else {
@@ -829,15 +955,11 @@ void SCR_UpdateScreen(void)
 {
     static float oldscr_viewsize;
     static float oldlcd_x;
-    vrect_t vrect;
 
     if (scr_skipupdate || block_drawing) {
         return;
     }
 
-    scr_copytop = 0;
-    scr_copyeverything = 0;
-
     if (scr_disabled_for_loading) {
         if (realtime - scr_disabled_time > 60) {
             scr_disabled_for_loading = false;
@@ -889,7 +1011,6 @@ void SCR_UpdateScreen(void)
     D_EnableBackBufferAccess(); // of all overlay stuff if drawing directly
 
     if (scr_fullupdate++ < vid.numpages) { // clear the entire screen
-        scr_copyeverything = 1;
         Draw_TileClear(0, 0, vid.width, vid.height);
         Sbar_Changed();
     }
@@ -914,7 +1035,6 @@ void SCR_UpdateScreen(void)
         Sbar_Draw();
         Draw_FadeScreen();
         SCR_DrawNotifyString();
-        scr_copyeverything = true;
     } else if (scr_drawloading) {
         SCR_DrawLoading();
         Sbar_Draw();
@@ -944,35 +1064,7 @@ void SCR_UpdateScreen(void)
 
     V_UpdatePalette();
 
-    //
-    // update one of three areas
-    //
-
-    if (scr_copyeverything) {
-        vrect.x = 0;
-        vrect.y = 0;
-        vrect.width = vid.width;
-        vrect.height = vid.height;
-        vrect.pnext = 0;
-
-        VID_Update(&vrect);
-    } else if (scr_copytop) {
-        vrect.x = 0;
-        vrect.y = 0;
-        vrect.width = vid.width;
-        vrect.height = vid.height - sb_lines;
-        vrect.pnext = 0;
-
-        VID_Update(&vrect);
-    } else {
-        vrect.x = scr_vrect.x;
-        vrect.y = scr_vrect.y;
-        vrect.width = scr_vrect.width;
-        vrect.height = scr_vrect.height;
-        vrect.pnext = 0;
-
-        VID_Update(&vrect);
-    }
+    VID_Update(SCR_DirtyRects());
 }
 
 /*
@@ -47,10 +47,10 @@ extern cvar_t scr_viewsize;
 
 extern cvar_t scr_viewsize;
 
-// only the refresh window will be updated unless these variables are flagged
-extern int scr_copytop;
-extern int scr_copyeverything;
-
 extern qboolean block_drawing;
 
 void SCR_UpdateWholeScreen(void);
+
+// anything that draws into vid.buffer marks what it touched, so only that
+// is presented
+void SCR_AddDirtyRect(int x, int y, int width, int height);
@@ -23,6 +23,11 @@ typedef struct {
     int maxclients;
     int maxclientslimit;
     struct client_s* clients;    // [maxclients]
+    int maxedicts;               // each level's sv.max_edicts
+
+    // delta frame rings, malloced the first time a slot asks for one and kept
+    // for whoever connects to it next, since client_t is cleared on connect
+    packetframe_t* clientframes[MAX_SCOREBOARD]; // [UPDATE_BACKUP] each
     int serverflags;             // episode completion information
     qboolean changelevel_issued; // cleared when at SV_SpawnServer
 } server_static_t;
@@ -58,6 +63,9 @@ typedef struct {
     edict_t* edicts; // can NOT be array indexed, because
     // edict_t is variable sized, but can
     // be used to reference the world ent
+    edict_t** moved_edict; // [max_edicts] for SV_PushMove and SV_PushRotate
+    vec3_t* moved_from;    // [max_edicts]
+    link_t* leafedicts; // [worldmodel->numleafs] edicts touching each leaf
     server_state_t state; // some actions are only valid during load
 
     sizebuf_t datagram;
@@ -73,6 +81,16 @@ typedef struct {
 #define NUM_PING_TIMES 16
 #define NUM_SPAWN_PARMS 16
 
+#define MAX_FATLEAFS 16 // beyond this a fat pvs isn't cached
+
+// the last fat pvs worked out for a client, with the leafs it was made from
+typedef struct {
+    int numleafs; // -1 if nothing is cached
+    int leafs[MAX_FATLEAFS];
+    unsigned pvs[MAX_MAP_LEAFS / 32];
+    int hits, misses; // for serverprofile
+} fatpvs_t;
+
 typedef struct client_s {
     qboolean active;     // false = client is free
     qboolean spawned;    // false = don't send datagrams
@@ -103,6 +121,13 @@ typedef struct client_s {
 
     // client known data for deltas
     int old_frags;
+
+    // delta compressed entity updates, if the client asked for them
+    qboolean deltaents; // frames are in svs.clientframes for the slot
+    int framesequence;  // of the newest frame sent
+    int ackedframe;     // newest frame the client has, 0 for none
+
+    fatpvs_t fatpvs; // only touched by whoever builds this client's datagram
 } client_t;
 
 //=============================================================================
@@ -197,6 +222,7 @@ extern cvar_t deathmatch;
 extern cvar_t coop;
 extern cvar_t fraglimit;
 extern cvar_t timelimit;
+extern cvar_t sv_deltaents;
 
 extern server_static_t svs; // persistant server info
 extern server_t sv;         // local server
@@ -26,6 +26,9 @@ server_static_t svs;
 
 char localmodels[MAX_MODELS][5]; // inline model names for precache
 
+cvar_t sv_threads = { "sv_threads", "1" }; // threads building client datagrams
+cvar_t sv_deltaents = { "sv_deltaents", "1" }; // allow clients delta compressed entity updates
+
 //============================================================================
 
 /*
@@ -57,6 +60,19 @@ void SV_Init(void)
     Cvar_RegisterVariable(&sv_idealpitchscale);
     Cvar_RegisterVariable(&sv_aim);
     Cvar_RegisterVariable(&sv_nostep);
+    Cvar_RegisterVariable(&sv_threads);
+    Cvar_RegisterVariable(&sv_deltaents);
+
+    svs.maxedicts = MAX_EDICTS;
+    i = COM_CheckParm("-edicts");
+    if (i && i < com_argc - 1) {
+        svs.maxedicts = Q_atoi(com_argv[i + 1]);
+        if (svs.maxedicts < MAX_EDICTS) {
+            svs.maxedicts = MAX_EDICTS;
+        } else if (svs.maxedicts > MAX_EDICTS_LIMIT) {
+            svs.maxedicts = MAX_EDICTS_LIMIT;
+        }
+    }
 
     for (i = 0; i < MAX_MODELS; i++) {
         sprintf(localmodels[i], "*%i", i);
@@ -218,6 +234,14 @@ void SV_SendServerinfo(client_t* client)
     sprintf(message, "%c\nVERSION %4.2f SERVER (%i CRC)", 2, VERSION, pr_crc);
     MSG_WriteString(&client->message, message);
 
+    // the client asks again once it has the new level
+    client->deltaents = false;
+    client->framesequence = 0;
+    client->ackedframe = 0;
+
+    // leaf numbers mean nothing on the new map
+    client->fatpvs.numleafs = -1;
+
     MSG_WriteByte(&client->message, svc_serverinfo);
     MSG_WriteLong(&client->message, PROTOCOL_VERSION);
     MSG_WriteByte(&client->message, svs.maxclients);
@@ -389,8 +413,12 @@ crosses a waterline.
 =============================================================================
 */
 
-int fatbytes;
-byte fatpvs[MAX_MAP_LEAFS / 8];
+// each thread building datagrams gets its own
+static THREAD_LOCAL int fatbytes;
+static THREAD_LOCAL int numfatleafs; // can run past MAX_FATLEAFS
+static THREAD_LOCAL int fatleafs[MAX_FATLEAFS];
+static THREAD_LOCAL byte* fatrow; // or the leaf pvs straight into this if set
+static THREAD_LOCAL unsigned visedicts[(MAX_EDICTS_LIMIT + 31) / 32];
 
 void SV_AddToFatPVS(vec3_t org, mnode_t* node)
 {
@@ -400,13 +428,18 @@ void SV_AddToFatPVS(vec3_t org, mnode_t* node)
     float d;
 
     while (1) {
-        // if this is a leaf, accumulate the pvs bits
+        // if this is a leaf, accumulate the pvs bits or note it down
         if (node->contents < 0) {
             if (node->contents != CONTENTS_SOLID) {
-                pvs = Mod_LeafPVS((mleaf_t*)node, sv.worldmodel);
-                for (i = 0; i < fatbytes; i++) {
-                    fatpvs[i] |= pvs[i];
+                if (fatrow) {
+                    pvs = Mod_LeafPVS((mleaf_t*)node, sv.worldmodel);
+                    for (i = 0; i < fatbytes; i++) {
+                        fatrow[i] |= pvs[i];
+                    }
+                } else if (numfatleafs < MAX_FATLEAFS) {
+                    fatleafs[numfatleafs] = (mleaf_t*)node - sv.worldmodel->leafs;
                 }
+                numfatleafs++;
             }
 
             return;
@@ -430,16 +463,93 @@ void SV_AddToFatPVS(vec3_t org, mnode_t* node)
 SV_FatPVS
 
 Calculates a PVS that is the inclusive or of all leafs within 8 pixels of the
-given point.
+given point.  The leafs are found first, and if they are the same ones as last
+time the row in fat is handed back as it is.
 =============
 */
-byte* SV_FatPVS(vec3_t org)
+byte* SV_FatPVS(vec3_t org, fatpvs_t* fat)
 {
-    fatbytes = (sv.worldmodel->numleafs + 31) >> 3;
-    Q_memset(fatpvs, 0, fatbytes);
+    int i, j;
+    byte *pvs, *row;
+
+    numfatleafs = 0;
     SV_AddToFatPVS(org, sv.worldmodel->nodes);
 
-    return fatpvs;
+    row = (byte*)fat->pvs;
+    if (numfatleafs == fat->numleafs
+        && !Q_memcmp(fatleafs, fat->leafs, numfatleafs * sizeof(*fatleafs))) {
+        fat->hits++;
+
+        return row;
+    }
+
+    fat->misses++;
+
+    fatbytes = ((sv.worldmodel->numleafs + 31) >> 5) << 2; // whole words
+    Q_memset(row, 0, fatbytes);
+
+    // too many to remember, so or them in on a second walk and don't cache
+    if (numfatleafs > MAX_FATLEAFS) {
+        fatrow = row;
+        SV_AddToFatPVS(org, sv.worldmodel->nodes);
+        fatrow = NULL;
+        fat->numleafs = -1;
+
+        return row;
+    }
+
+    for (i = 0; i < numfatleafs; i++) {
+        pvs = Mod_LeafPVS(sv.worldmodel->leafs + fatleafs[i], sv.worldmodel);
+        for (j = 0; j < fatbytes; j++) {
+            row[j] |= pvs[j];
+        }
+    }
+
+    fat->numleafs = numfatleafs;
+    Q_memcpy(fat->leafs, fatleafs, numfatleafs * sizeof(*fatleafs));
+
+    return row;
+}
+
+/*
+=============
+SV_MarkVisibleEdicts
+
+Sets the bits in visedicts for every edict touching a leaf in the fat pvs,
+going through sv.leafedicts for the leafs that are set.  Edicts in several
+of them are only marked once.
+=============
+*/
+void SV_MarkVisibleEdicts(unsigned* pvs)
+{
+    int i, bit, leafnum, e, numwords;
+    unsigned bits;
+    link_t *leaf, *l;
+
+    Q_memset(visedicts, 0, ((sv.num_edicts + 31) >> 5) * sizeof(*visedicts));
+
+    numwords = (sv.worldmodel->numleafs + 31) >> 5;
+    for (i = 0; i < numwords; i++) {
+        bits = LittleLong(pvs[i]);
+
+        for (bit = 0; bits; bit++, bits >>= 1) {
+            if (!(bits & 1)) {
+                continue;
+            }
+
+            // the row can run on into padding past the last leaf
+            leafnum = (i << 5) + bit;
+            if (leafnum >= sv.worldmodel->numleafs) {
+                break;
+            }
+
+            leaf = &sv.leafedicts[leafnum];
+            for (l = leaf->next; l != leaf; l = l->next) {
+                e = NUM_FOR_LEAFLINK(l);
+                visedicts[e >> 5] |= 1u << (e & 31);
+            }
+        }
+    }
 }
 
 //=============================================================================
@@ -448,24 +558,52 @@ byte* SV_FatPVS(vec3_t org)
 =============
 SV_WriteEntitiesToClient
 
+Fields are left out if they haven't changed since the from frame, or since
+the baseline for entities that weren't in it.  What the client will hold
+afterwards is kept in the to frame.  Either frame can be NULL.
+
+Returns false if the message filled up before every visible entity was in
 =============
 */
-void SV_WriteEntitiesToClient(edict_t* clent, sizebuf_t* msg)
+qboolean SV_WriteEntitiesToClient(client_t* client, packetframe_t* from, packetframe_t* to, sizebuf_t* msg)
 {
     int e, i;
+    edict_t* clent;
     int bits;
-    byte* pvs;
     vec3_t org;
     float miss;
     edict_t* ent;
+    entity_state_t* base;
+    packetentity_t* pe;
+    int fromindex;
+
+    clent = client->edict;
+    fromindex = 0;
+    if (to) {
+        to->numentities = 0;
+    }
 
     // find the client's PVS
     VectorAdd(clent->v.origin, clent->v.view_ofs, org);
-    pvs = SV_FatPVS(org);
+    SV_MarkVisibleEdicts((unsigned*)SV_FatPVS(org, &client->fatpvs));
+
+    // clent is ALLWAYS sent
+    e = NUM_FOR_EDICT(clent);
+    visedicts[e >> 5] |= 1u << (e & 31);
+
+    // send over all entities that touch the pvs, in order
+    for (e = 1; e < sv.num_edicts; e++) {
+        if (!visedicts[e >> 5]) {
+            e |= 31; // none in this word
+            continue;
+        }
+
+        if (!(visedicts[e >> 5] & (1u << (e & 31)))) {
+            continue;
+        }
+
+        ent = EDICT_NUM(e);
 
-    // send over all entities (excpet the client) that touch the pvs
-    ent = NEXT_EDICT(sv.edicts);
-    for (e = 1; e < sv.num_edicts; e++, ent = NEXT_EDICT(ent)) {
 #ifdef QUAKE2
         // don't send if flagged for NODRAW and there are no lighting effects
         if (ent->v.effects == EF_NODRAW) {
@@ -474,50 +612,46 @@ void SV_WriteEntitiesToClient(edict_t* clent, sizebuf_t* msg)
 
 #endif
 
-        // ignore if not touching a PV leaf
-        if (ent != clent) // clent is ALLWAYS sent
-        {
-            // ignore ents without visible models
-            if (!ent->v.modelindex || !*PR_GetString(ent->v.model)) {
-                continue;
-            }
-
-            for (i = 0; i < ent->num_leafs; i++) {
-                if (pvs[ent->leafnums[i] >> 3] & (1 << (ent->leafnums[i] & 7))) {
-                    break;
-                }
-            }
-
-            if (i == ent->num_leafs) {
-                continue; // not visible
-            }
+        // ignore ents without visible models
+        if (ent != clent && (!ent->v.modelindex || !*PR_GetString(ent->v.model))) {
+            continue;
         }
 
         if (msg->maxsize - msg->cursize < 16) {
-            Con_Printf("packet overflow\n");
+            return false;
+        }
 
-            return;
+        // both frames are in entity order, so the from one is walked along
+        base = &ent->baseline;
+        if (from) {
+            while (fromindex < from->numentities && from->entities[fromindex].number < e) {
+                fromindex++;
+            }
+
+            if (fromindex < from->numentities && from->entities[fromindex].number == e) {
+                base = &from->entities[fromindex].state;
+            }
         }
 
         // send an update
         bits = 0;
 
         for (i = 0; i < 3; i++) {
-            miss = ent->v.origin[i] - ent->baseline.origin[i];
+            miss = ent->v.origin[i] - base->origin[i];
             if (miss < -0.1 || miss > 0.1) {
                 bits |= U_ORIGIN1 << i;
             }
         }
 
-        if (ent->v.angles[0] != ent->baseline.angles[0]) {
+        if (ent->v.angles[0] != base->angles[0]) {
             bits |= U_ANGLE1;
         }
 
-        if (ent->v.angles[1] != ent->baseline.angles[1]) {
+        if (ent->v.angles[1] != base->angles[1]) {
             bits |= U_ANGLE2;
         }
 
-        if (ent->v.angles[2] != ent->baseline.angles[2]) {
+        if (ent->v.angles[2] != base->angles[2]) {
             bits |= U_ANGLE3;
         }
 
@@ -525,26 +659,70 @@ void SV_WriteEntitiesToClient(edict_t* clent, sizebuf_t* msg)
             bits |= U_NOLERP; // don't mess up the step animation
         }
 
-        if (ent->baseline.colormap != ent->v.colormap) {
+        if (base->colormap != ent->v.colormap) {
             bits |= U_COLORMAP;
         }
 
-        if (ent->baseline.skin != ent->v.skin) {
+        if (base->skin != ent->v.skin) {
             bits |= U_SKIN;
         }
 
-        if (ent->baseline.frame != ent->v.frame) {
+        if (base->frame != ent->v.frame) {
             bits |= U_FRAME;
         }
 
-        if (ent->baseline.effects != ent->v.effects) {
+        if (base->effects != ent->v.effects) {
             bits |= U_EFFECTS;
         }
 
-        if (ent->baseline.modelindex != ent->v.modelindex) {
+        if (base->modelindex != ent->v.modelindex) {
             bits |= U_MODEL;
         }
 
+        if (to && to->numentities < MAX_PACKET_ENTITIES) {
+            pe = &to->entities[to->numentities++];
+            pe->number = e;
+            pe->state = *base;
+
+            for (i = 0; i < 3; i++) {
+                if (bits & (U_ORIGIN1 << i)) {
+                    pe->state.origin[i] = ent->v.origin[i];
+                }
+            }
+
+            if (bits & U_ANGLE1) {
+                pe->state.angles[0] = ent->v.angles[0];
+            }
+
+            if (bits & U_ANGLE2) {
+                pe->state.angles[1] = ent->v.angles[1];
+            }
+
+            if (bits & U_ANGLE3) {
+                pe->state.angles[2] = ent->v.angles[2];
+            }
+
+            if (bits & U_COLORMAP) {
+                pe->state.colormap = ent->v.colormap;
+            }
+
+            if (bits & U_SKIN) {
+                pe->state.skin = ent->v.skin;
+            }
+
+            if (bits & U_FRAME) {
+                pe->state.frame = ent->v.frame;
+            }
+
+            if (bits & U_EFFECTS) {
+                pe->state.effects = ent->v.effects;
+            }
+
+            if (bits & U_MODEL) {
+                pe->state.modelindex = ent->v.modelindex;
+            }
+        }
+
         if (e >= 256) {
             bits |= U_LONGENTITY;
         }
@@ -612,6 +790,8 @@ void SV_WriteEntitiesToClient(edict_t* clent, sizebuf_t* msg)
             MSG_WriteAngle(msg, ent->v.angles[2]);
         }
     }
+
+    return true;
 }
 
 /*
@@ -633,19 +813,19 @@ void SV_CleanupEnts(void)
 
 /*
 ==================
-SV_WriteClientdataToMessage
+SV_WriteClientdata
 
+Only reads the world, so it can run for several clients at once.  items2 is
+the entity's "items2" field, looked up beforehand because
+GetEdictFieldValue's cache isn't safe to share between threads.
 ==================
 */
-void SV_WriteClientdataToMessage(edict_t* ent, sizebuf_t* msg)
+static void SV_WriteClientdata(edict_t* ent, eval_t* items2, sizebuf_t* msg)
 {
     int bits;
     int i;
     edict_t* other;
     int items;
-#ifndef QUAKE2
-    eval_t* val;
-#endif
 
     //
     // send a damage message
@@ -658,23 +838,14 @@ void SV_WriteClientdataToMessage(edict_t* ent, sizebuf_t* msg)
         for (i = 0; i < 3; i++) {
             MSG_WriteCoord(msg, other->v.origin[i] + 0.5 * (other->v.mins[i] + other->v.maxs[i]));
         }
-
-        ent->v.dmg_take = 0;
-        ent->v.dmg_save = 0;
     }
 
-    //
-    // send the current viewpos offset from the view entity
-    //
-    SV_SetIdealPitch(); // how much to look up / down ideally
-
     // a fixangle might get lost in a dropped packet.  Oh well.
     if (ent->v.fixangle) {
         MSG_WriteByte(msg, svc_setangle);
         for (i = 0; i < 3; i++) {
             MSG_WriteAngle(msg, ent->v.angles[i]);
         }
-        ent->v.fixangle = 0;
     }
 
     bits = 0;
@@ -690,12 +861,11 @@ void SV_WriteClientdataToMessage(edict_t* ent, sizebuf_t* msg)
 // stuff the sigil bits into the high bits of items for sbar, or else
 // mix in items2
 #ifdef QUAKE2
+    UNUSED(items2);
     items = (int)ent->v.items | ((int)ent->v.items2 << 23);
 #else
-    val = GetEdictFieldValue(ent, "items2");
-
-    if (val) {
-        items = (int)ent->v.items | ((int)val->_float << 23);
+    if (items2) {
+        items = (int)ent->v.items | ((int)items2->_float << 23);
     } else {
         items = (int)ent->v.items | ((int)pr_global_struct->serverflags << 28);
     }
@@ -791,34 +961,189 @@ void SV_WriteClientdataToMessage(edict_t* ent, sizebuf_t* msg)
 }
 
 /*
-=======================
-SV_SendClientDatagram
-=======================
+==================
+SV_ClearClientdata
+
+Forgets the one-shot damage and fixangle once they are on their way
+==================
+*/
+static void SV_ClearClientdata(edict_t* ent)
+{
+    ent->v.dmg_take = 0;
+    ent->v.dmg_save = 0;
+    ent->v.fixangle = 0;
+}
+
+/*
+==================
+SV_WriteClientdataToMessage
+
+==================
 */
-qboolean SV_SendClientDatagram(client_t* client)
+void SV_WriteClientdataToMessage(edict_t* ent, sizebuf_t* msg)
 {
+    eval_t* items2;
+
+    SV_SetIdealPitch(); // how much to look up / down ideally
+
+#ifdef QUAKE2
+    items2 = NULL;
+#else
+    items2 = GetEdictFieldValue(ent, "items2");
+#endif
+
+    SV_WriteClientdata(ent, items2, msg);
+    SV_ClearClientdata(ent);
+}
+
+// a client's unreliable message, built ahead of sending
+typedef struct {
     byte buf[MAX_DATAGRAM];
     sizebuf_t msg;
+    eval_t* items2;
+    qboolean overflowed; // not every visible entity fit
+} svdatagram_t;
 
-    msg.data = buf;
-    msg.maxsize = sizeof(buf);
-    msg.cursize = 0;
+static svdatagram_t sv_datagrams[MAX_SCOREBOARD];
+static int sv_buildclients[MAX_SCOREBOARD];
 
-    MSG_WriteByte(&msg, svc_time);
-    MSG_WriteFloat(&msg, sv.time);
+/*
+=======================
+SV_BuildClientDatagram
+
+SV_SetIdealPitch must have been run for this frame first
+=======================
+*/
+static void SV_BuildClientDatagram(client_t* client, svdatagram_t* dg)
+{
+    packetframe_t *frames, *from, *to;
+    int sequence;
+
+    dg->msg.data = dg->buf;
+    dg->msg.maxsize = sizeof(dg->buf);
+    dg->msg.cursize = 0;
+
+    MSG_WriteByte(&dg->msg, svc_time);
+    MSG_WriteFloat(&dg->msg, sv.time);
+
+    from = to = NULL;
+    if (client->deltaents) {
+        // the sequence only moves on once the datagram is sent
+        frames = svs.clientframes[client - svs.clients];
+        sequence = client->framesequence + 1;
+        to = &frames[sequence & UPDATE_MASK];
+        to->sequence = sequence;
+
+        if (client->ackedframe && sequence - client->ackedframe < UPDATE_BACKUP) {
+            from = &frames[client->ackedframe & UPDATE_MASK];
+        }
+
+        MSG_WriteByte(&dg->msg, svc_deltaframe);
+        MSG_WriteLong(&dg->msg, sequence);
+        MSG_WriteLong(&dg->msg, from ? from->sequence : 0);
+    }
 
     // add the client specific data to the datagram
-    SV_WriteClientdataToMessage(client->edict, &msg);
+    SV_WriteClientdata(client->edict, dg->items2, &dg->msg);
 
-    SV_WriteEntitiesToClient(client->edict, &msg);
+    dg->overflowed = !SV_WriteEntitiesToClient(client, from, to, &dg->msg);
 
     // copy the server datagram if there is space
-    if (msg.cursize + sv.datagram.cursize < msg.maxsize) {
-        SZ_Write(&msg, sv.datagram.data, sv.datagram.cursize);
+    if (dg->msg.cursize + sv.datagram.cursize < dg->msg.maxsize) {
+        SZ_Write(&dg->msg, sv.datagram.data, sv.datagram.cursize);
+    }
+}
+
+static void SV_BuildDatagramJob(int job, void* data)
+{
+    int clientnum;
+
+    UNUSED(data);
+
+    clientnum = sv_buildclients[job];
+    SV_BuildClientDatagram(&svs.clients[clientnum], &sv_datagrams[clientnum]);
+}
+
+/*
+=======================
+SV_BuildClientDatagrams
+
+Builds the datagrams of every spawned client at once.  Nothing in the world
+changes between the end of the physics and the sends, so each one comes out
+the same as if it had been built just before sending.
+=======================
+*/
+static void SV_BuildClientDatagrams(void)
+{
+    client_t* client;
+    int i, numclients, numthreads;
+
+    numclients = 0;
+    for (i = 0, client = svs.clients; i < svs.maxclients; i++, client++) {
+        if (!client->active || !client->spawned) {
+            continue;
+        }
+
+#ifdef QUAKE2
+        sv_datagrams[i].items2 = NULL;
+#else
+        sv_datagrams[i].items2 = GetEdictFieldValue(client->edict, "items2");
+#endif
+        sv_buildclients[numclients++] = i;
+    }
+
+    if (!numclients) {
+        return;
+    }
+
+    // only ever changes sv_player, the same way for every client
+    SV_SetIdealPitch();
+
+    numthreads = Sys_NumThreads();
+    if (numthreads > sv_threads.value) {
+        numthreads = sv_threads.value;
+    }
+
+    if (numthreads > 1) {
+        Sys_RunParallel(SV_BuildDatagramJob, numclients, NULL);
+    } else {
+        for (i = 0; i < numclients; i++) {
+            SV_BuildDatagramJob(i, NULL);
+        }
+    }
+}
+
+/*
+=======================
+SV_SendClientDatagram
+
+Sends the datagram built for the client.  If rebuild is set, something has
+changed since SV_BuildClientDatagrams and it is built over again first.
+=======================
+*/
+qboolean SV_SendClientDatagram(client_t* client, qboolean rebuild)
+{
+    svdatagram_t* dg;
+
+    dg = &sv_datagrams[client - svs.clients];
+
+    if (rebuild) {
+        SV_SetIdealPitch();
+        SV_BuildClientDatagram(client, dg);
+    }
+
+    if (dg->overflowed) {
+        Con_Printf("packet overflow\n");
+    }
+
+    SV_ClearClientdata(client->edict);
+
+    if (client->deltaents) {
+        client->framesequence++;
     }
 
     // send the datagram
-    if (NET_SendUnreliableMessage(client->netconnection, &msg) == -1) {
+    if (NET_SendUnreliableMessage(client->netconnection, &dg->msg) == -1) {
         SV_DropClient(true); // if the message couldn't send, kick off
 
         return false;
@@ -901,11 +1226,15 @@ SV_SendClientMessages
 void SV_SendClientMessages(void)
 {
     int i;
+    qboolean rebuild;
 
     // update frags, names, etc
     SV_UpdateToReliableMessages();
 
     // build individual updates
+    SV_BuildClientDatagrams();
+    rebuild = false;
+
     for (i = 0, host_client = svs.clients; i < svs.maxclients;
         i++, host_client++) {
         if (!host_client->active) {
@@ -913,7 +1242,7 @@ void SV_SendClientMessages(void)
         }
 
         if (host_client->spawned) {
-            if (!SV_SendClientDatagram(host_client)) {
+            if (!SV_SendClientDatagram(host_client, rebuild)) {
                 continue;
             }
         } else {
@@ -948,6 +1277,9 @@ void SV_SendClientMessages(void)
 
             if (host_client->dropasap) {
                 SV_DropClient(false); // went to another level
+
+                // ClientDisconnect may have changed what the rest were built from
+                rebuild = true;
             } else {
                 if (NET_SendMessage(host_client->netconnection,
                         &host_client->message)
@@ -1189,9 +1521,11 @@ void SV_SpawnServer(char* server)
     PR_LoadProgs();
 
     // allocate server memory
-    sv.max_edicts = MAX_EDICTS;
+    sv.max_edicts = svs.maxedicts;
 
     sv.edicts = Hunk_AllocName(sv.max_edicts * pr_edict_size, "edicts");
+    sv.moved_edict = Hunk_AllocName(sv.max_edicts * sizeof(*sv.moved_edict), "moved");
+    sv.moved_from = Hunk_AllocName(sv.max_edicts * sizeof(*sv.moved_from), "moved");
 
     sv.datagram.maxsize = sizeof(sv.datagram_buf);
     sv.datagram.cursize = 0;
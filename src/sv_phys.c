@@ -454,8 +454,11 @@ void SV_PushMove(edict_t* pusher, float movetime)
     vec3_t mins, maxs, move;
     vec3_t entorig, pushorig;
     int num_moved;
-    edict_t* moved_edict[MAX_EDICTS];
-    vec3_t moved_from[MAX_EDICTS];
+    edict_t** moved_edict;
+    vec3_t* moved_from;
+
+    moved_edict = sv.moved_edict;
+    moved_from = sv.moved_from;
 
     if (!pusher->v.velocity[0] && !pusher->v.velocity[1] && !pusher->v.velocity[2]) {
         pusher->v.ltime += movetime;
@@ -573,11 +576,14 @@ void SV_PushRotate(edict_t* pusher, float movetime)
     vec3_t move, a, amove;
     vec3_t entorig, pushorig;
     int num_moved;
-    edict_t* moved_edict[MAX_EDICTS];
-    vec3_t moved_from[MAX_EDICTS];
+    edict_t** moved_edict;
+    vec3_t* moved_from;
     vec3_t org, org2;
     vec3_t forward, right, up;
 
+    moved_edict = sv.moved_edict;
+    moved_from = sv.moved_from;
+
     if (!pusher->v.avelocity[0] && !pusher->v.avelocity[1] && !pusher->v.avelocity[2]) {
         pusher->v.ltime += movetime;
 
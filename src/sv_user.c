@@ -486,6 +486,7 @@ qboolean SV_ReadClientMessage(void)
     int ret;
     int cmd;
     char* s;
+    int frame;
 
     do {
     nextmsg:
@@ -574,6 +575,8 @@ qboolean SV_ReadClientMessage(void)
                     ret = 1;
                 } else if (Q_strncasecmp(s, "ban", 3) == 0) {
                     ret = 1;
+                } else if (Q_strncasecmp(s, "deltaents", 9) == 0) {
+                    ret = 1;
                 }
 
                 if (ret == 2) {
@@ -593,6 +596,15 @@ qboolean SV_ReadClientMessage(void)
             case clc_move:
                 SV_ReadClientMove(&host_client->cmd);
                 break;
+
+            case clc_ackframe:
+                // unreliable, so acks can come late or not at all
+                frame = MSG_ReadLong();
+                if (frame > host_client->ackedframe && frame <= host_client->framesequence) {
+                    host_client->ackedframe = frame;
+                }
+
+                break;
             }
         }
     } while (ret == 1);
@@ -68,3 +68,14 @@ void Sys_SendKeyEvents(void);
 void Sys_LowFPPrecision(void);
 void Sys_HighFPPrecision(void);
 void Sys_SetFPCW(void);
+
+//
+// worker threads
+//
+int Sys_NumThreads(void);
+// number of threads Sys_RunParallel can spread work over, counting the caller
+
+void Sys_RunParallel(void (*func)(int job, void* data), int numjobs, void* data);
+// runs func for every job in [0, numjobs) on the worker pool and the calling
+// thread, and returns once all of them have finished.  Only the main thread
+// may call this, and func must not call it again.
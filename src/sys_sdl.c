@@ -60,8 +60,137 @@ void Sys_Quit(void)
     exit(0);
 }
 
+/*
+===============================================================================
+
+WORKER THREADS
+
+===============================================================================
+*/
+
+#define MAX_THREADS 16
+
+static SDL_Thread* sys_threads[MAX_THREADS];
+static int sys_numworkers;
+
+static SDL_sem* sys_jobstart;
+static SDL_sem* sys_jobdone;
+static SDL_atomic_t sys_nextjob;
+static void (*sys_jobfunc)(int job, void* data);
+static void* sys_jobdata;
+static int sys_numjobs;
+
+/*
+================
+Sys_RunJobs
+
+Pulls jobs off the current batch until there are none left
+================
+*/
+static void Sys_RunJobs(void)
+{
+    int job;
+
+    while ((job = SDL_AtomicAdd(&sys_nextjob, 1)) < sys_numjobs) {
+        sys_jobfunc(job, sys_jobdata);
+    }
+}
+
+static int Sys_WorkerThread(void* data)
+{
+    UNUSED(data);
+
+    while (1) {
+        SDL_SemWait(sys_jobstart);
+        Sys_RunJobs();
+        SDL_SemPost(sys_jobdone);
+    }
+
+    return 0;
+}
+
+/*
+================
+Sys_InitThreads
+
+-threads <n> sets the total thread count, including the main thread
+================
+*/
+static void Sys_InitThreads(void)
+{
+    int i, numthreads;
+
+    numthreads = SDL_GetCPUCount();
+    if ((i = COM_CheckParm("-threads")) && i < com_argc - 1) {
+        numthreads = Q_atoi(com_argv[i + 1]);
+    }
+
+    if (numthreads > MAX_THREADS) {
+        numthreads = MAX_THREADS;
+    }
+
+    if (numthreads <= 1) {
+        return;
+    }
+
+    sys_jobstart = SDL_CreateSemaphore(0);
+    sys_jobdone = SDL_CreateSemaphore(0);
+    if (!sys_jobstart || !sys_jobdone) {
+        Sys_Error("Sys_InitThreads: %s", SDL_GetError());
+    }
+
+    for (i = 0; i < numthreads - 1; i++) {
+        sys_threads[i] = SDL_CreateThread(Sys_WorkerThread, "worker", NULL);
+        if (!sys_threads[i]) {
+            break;
+        }
+
+        SDL_DetachThread(sys_threads[i]);
+    }
+    sys_numworkers = i;
+}
+
+int Sys_NumThreads(void)
+{
+    return sys_numworkers + 1;
+}
+
+void Sys_RunParallel(void (*func)(int job, void* data), int numjobs, void* data)
+{
+    int i, wake;
+
+    if (numjobs <= 1 || !sys_numworkers) {
+        for (i = 0; i < numjobs; i++) {
+            func(i, data);
+        }
+
+        return;
+    }
+
+    sys_jobfunc = func;
+    sys_jobdata = data;
+    sys_numjobs = numjobs;
+    SDL_AtomicSet(&sys_nextjob, 0);
+
+    wake = numjobs - 1;
+    if (wake > sys_numworkers) {
+        wake = sys_numworkers;
+    }
+
+    for (i = 0; i < wake; i++) {
+        SDL_SemPost(sys_jobstart);
+    }
+
+    Sys_RunJobs();
+
+    for (i = 0; i < wake; i++) {
+        SDL_SemWait(sys_jobdone);
+    }
+}
+
 void Sys_Init(void)
 {
+    Sys_InitThreads();
 }
 
 /*
@@ -57,6 +57,11 @@ extern unsigned d_8to24table[256];
 extern void (*vid_menudrawfn)(void);
 extern void (*vid_menukeyfn)(int key);
 
+extern float vid_presenttime; // seconds spent getting frames to the window
+extern float vid_presentwait; // seconds the main thread waited for that
+extern float vid_updatetime;  // seconds the main thread spent in VID_Update
+extern int vid_presentpixels; // pixels converted for them
+
 void VID_SetPalette(unsigned char* palette);
 // called at startup and after any gamma correction
 
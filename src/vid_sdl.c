@@ -20,6 +20,37 @@ byte* VGA_pagebase;
 static SDL_Window* window = NULL;
 static SDL_Surface* screen = NULL;
 
+// when the window is 32 bit, the 8 bit screen is expanded straight into it
+// through vid_lut instead of going through SDL_BlitSurface.  Palette changes
+// only rebuild the table, and the next present then converts everything.
+static qboolean vid_lutpresent;
+static qboolean vid_lutchanged;
+static Uint32 vid_lut[256];
+static void (*vid_expandrow)(Uint32* dest, const byte* src, int count);
+
+// with a second 8 bit page, a finished frame is converted and shown on the
+// present thread while the next one is drawn into the other page
+cvar_t vid_presentthread = { "vid_presentthread", "0" }; // not every SDL backend allows it
+
+static SDL_Surface* vid_pages[2];
+static int vid_drawpage;
+static qboolean vid_canthread; // the second page and the thread are up
+static qboolean vid_threaded;  // last frame went through the present thread
+
+static SDL_sem* vid_presentstart;
+static SDL_sem* vid_presentdone;
+static qboolean vid_presentbusy;
+static SDL_Surface* vid_presentsource;
+static SDL_Rect* vid_presentrects;
+static int vid_numpresentrects, vid_maxpresentrects;
+static double vid_threadtime;
+static int vid_threadpixels;
+
+float vid_presenttime;
+float vid_presentwait;
+float vid_updatetime;
+int vid_presentpixels;
+
 static qboolean mouse_avail;
 static float mouse_x, mouse_y;
 static int mouse_oldbuttonstate = 0;
@@ -28,10 +59,281 @@ static int mouse_oldbuttonstate = 0;
 // void (*vid_menudrawfn)(void);  // already defined in menu.c
 // void (*vid_menukeyfn)(int key); // already defined in menu.c
 
+/*
+================
+VID_ExpandRow
+
+Palette expansion of one row into the window surface
+================
+*/
+static void VID_ExpandRow(Uint32* dest, const byte* src, int count)
+{
+    for (; count >= 4; count -= 4, dest += 4, src += 4) {
+        dest[0] = vid_lut[src[0]];
+        dest[1] = vid_lut[src[1]];
+        dest[2] = vid_lut[src[2]];
+        dest[3] = vid_lut[src[3]];
+    }
+
+    while (count--) {
+        *dest++ = vid_lut[*src++];
+    }
+}
+
+#if defined(__SSE2__)
+
+#include <immintrin.h>
+
+/*
+================
+VID_ExpandRow_AVX2
+
+Eight pixels at a time, with the table lookups done by a gather
+================
+*/
+__attribute__((target("avx2"))) static void VID_ExpandRow_AVX2(Uint32* dest, const byte* src, int count)
+{
+    __m256i index;
+
+    for (; count >= 8; count -= 8, dest += 8, src += 8) {
+        index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)src));
+        _mm256_storeu_si256((__m256i*)dest, _mm256_i32gather_epi32((const int*)vid_lut, index, 4));
+    }
+
+    VID_ExpandRow(dest, src, count);
+}
+
+#endif // __SSE2__
+
+/*
+================
+VID_ExpandRect
+
+Converts one rectangle of the 8 bit screen into the window surface
+================
+*/
+static int VID_ExpandRect(SDL_Surface* source, SDL_Surface* dest, SDL_Rect* rect)
+{
+    int x, y, w, h, pixels;
+    byte* src;
+    Uint8* out;
+
+    x = rect->x < 0 ? 0 : rect->x;
+    y = rect->y < 0 ? 0 : rect->y;
+    w = (rect->x + rect->w > source->w ? source->w : rect->x + rect->w) - x;
+    h = (rect->y + rect->h > source->h ? source->h : rect->y + rect->h) - y;
+    if (w <= 0 || h <= 0) {
+        return 0;
+    }
+
+    src = (byte*)source->pixels + y * source->pitch + x;
+    out = (Uint8*)dest->pixels + y * dest->pitch + x * 4;
+    pixels = w * h;
+
+    while (h--) {
+        vid_expandrow((Uint32*)out, src, w);
+        src += source->pitch;
+        out += dest->pitch;
+    }
+
+    return pixels;
+}
+
+/*
+================
+VID_Present
+
+Gets the given part of an 8 bit page into the window surface and shows it.
+Returns the number of pixels converted.
+================
+*/
+static int VID_Present(SDL_Surface* source, SDL_Rect* rects, int numrects)
+{
+    SDL_Surface* window_surface;
+    SDL_Rect all;
+    int i, pixels;
+
+    // the colors changed under every pixel, not just the dirty ones
+    if (vid_lutpresent && vid_lutchanged) {
+        all.x = 0;
+        all.y = 0;
+        all.w = source->w;
+        all.h = source->h;
+        rects = &all;
+        numrects = 1;
+        vid_lutchanged = false;
+    }
+
+    // If we're using our own 8-bit surface, we need to get it to the window
+    pixels = 0;
+    window_surface = SDL_GetWindowSurface(window);
+    if (source != window_surface) {
+        if (vid_lutpresent) {
+            if (SDL_MUSTLOCK(window_surface)) {
+                SDL_LockSurface(window_surface);
+            }
+
+            for (i = 0; i < numrects; i++) {
+                pixels += VID_ExpandRect(source, window_surface, &rects[i]);
+            }
+
+            if (SDL_MUSTLOCK(window_surface)) {
+                SDL_UnlockSurface(window_surface);
+            }
+        } else {
+            for (i = 0; i < numrects; i++) {
+                SDL_BlitSurface(source, &rects[i], window_surface, &rects[i]);
+                pixels += rects[i].w * rects[i].h;
+            }
+        }
+    }
+
+    SDL_UpdateWindowSurfaceRects(window, rects, numrects);
+
+    return pixels;
+}
+
+/*
+================
+VID_PresentNow
+
+Presents from the main thread
+================
+*/
+static void VID_PresentNow(SDL_Surface* source, SDL_Rect* rects, int numrects)
+{
+    double time1;
+
+    time1 = Sys_FloatTime();
+    vid_presentpixels += VID_Present(source, rects, numrects);
+    vid_presenttime += Sys_FloatTime() - time1;
+}
+
+/*
+================
+VID_PresentThread
+================
+*/
+static int VID_PresentThread(void* data)
+{
+    double time1;
+
+    UNUSED(data);
+
+    while (1) {
+        SDL_SemWait(vid_presentstart);
+
+        time1 = Sys_FloatTime();
+        vid_threadpixels = VID_Present(vid_presentsource, vid_presentrects, vid_numpresentrects);
+        vid_threadtime = Sys_FloatTime() - time1;
+
+        SDL_SemPost(vid_presentdone);
+    }
+
+    return 0;
+}
+
+/*
+================
+VID_WaitPresent
+
+Waits for the present thread to let go of its page, the lookup table and
+the window
+================
+*/
+static void VID_WaitPresent(void)
+{
+    double time1;
+
+    if (!vid_presentbusy) {
+        return;
+    }
+
+    time1 = Sys_FloatTime();
+    SDL_SemWait(vid_presentdone);
+    vid_presentwait += Sys_FloatTime() - time1;
+
+    vid_presentbusy = false;
+    vid_presenttime += vid_threadtime;
+    vid_presentpixels += vid_threadpixels;
+}
+
+/*
+================
+VID_SetDrawPage
+================
+*/
+static void VID_SetDrawPage(int page)
+{
+    vid_drawpage = page;
+    screen = vid_pages[page];
+    VGA_pagebase = vid.buffer = vid.conbuffer = screen->pixels;
+}
+
+/*
+================
+VID_InitPresentThread
+
+Sets up the second page and the thread; without them every frame is
+presented on the main thread as before
+================
+*/
+static void VID_InitPresentThread(void)
+{
+    SDL_Thread* thread;
+
+    Cvar_RegisterVariable(&vid_presentthread);
+
+    if (!vid_lutpresent) {
+        return;
+    }
+
+    vid_pages[1] = SDL_CreateRGBSurface(0, vid.width, vid.height, 8, 0, 0, 0, 0);
+    vid_presentstart = SDL_CreateSemaphore(0);
+    vid_presentdone = SDL_CreateSemaphore(0);
+    if (!vid_pages[1] || !vid_presentstart || !vid_presentdone || vid_pages[1]->pitch != screen->pitch) {
+        Con_Printf("VID: no present thread: %s\n", SDL_GetError());
+        return;
+    }
+
+    thread = SDL_CreateThread(VID_PresentThread, "present", NULL);
+    if (!thread) {
+        Con_Printf("VID: no present thread: %s\n", SDL_GetError());
+        return;
+    }
+
+    SDL_DetachThread(thread);
+
+    // vid.numpages only goes to 2 while the thread is in use
+    vid_pages[0] = screen;
+    vid_canthread = true;
+}
+
+/*
+================
+VID_SetPalette
+
+On the lookup table path this never touches the SDL palette, so SDL has no
+reason to think the screen surface changed
+================
+*/
 void VID_SetPalette(unsigned char* palette)
 {
     int i;
     SDL_Color colors[256];
+    SDL_Surface* window_surface;
+
+    if (vid_lutpresent) {
+        VID_WaitPresent();
+
+        window_surface = SDL_GetWindowSurface(window);
+        for (i = 0; i < 256; ++i, palette += 3) {
+            vid_lut[i] = SDL_MapRGB(window_surface->format, palette[0], palette[1], palette[2]);
+        }
+
+        vid_lutchanged = true;
+        return;
+    }
 
     for (i = 0; i < 256; ++i) {
         colors[i].r = *palette++;
@@ -42,6 +344,14 @@ void VID_SetPalette(unsigned char* palette)
     SDL_SetPaletteColors(screen->format->palette, colors, 0, 256);
 }
 
+/*
+================
+VID_ShiftPalette
+
+V_UpdatePalette hands over the base palette with the gamma table and color
+shifts already folded in
+================
+*/
 void VID_ShiftPalette(unsigned char* palette)
 {
     VID_SetPalette(palette);
@@ -74,6 +384,10 @@ void VID_Init(unsigned char* palette)
         if (!vid.width || !vid.height) {
             Sys_Error("VID: Bad window width/height\n");
         }
+
+        if (vid.width > MAXWIDTH || vid.height > MAXHEIGHT) {
+            Sys_Error("VID: %dx%d is larger than the %dx%d maximum\n", vid.width, vid.height, MAXWIDTH, MAXHEIGHT);
+        }
     }
 
     // Set video width, height and flags
@@ -115,6 +429,18 @@ void VID_Init(unsigned char* palette)
         SDL_SetSurfaceBlendMode(new_screen, SDL_BLENDMODE_NONE);
         SDL_SetSurfacePalette(new_screen, pal);
 
+        // a 32 bit window can be filled straight from a lookup table
+        if (screen->format->BytesPerPixel == 4) {
+            vid_lutpresent = true;
+            vid_expandrow = VID_ExpandRow;
+#if defined(__SSE2__)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) {
+                vid_expandrow = VID_ExpandRow_AVX2;
+            }
+#endif
+        }
+
         // Replace screen with our 8-bit surface
         screen = new_screen;
     }
@@ -147,12 +473,18 @@ void VID_Init(unsigned char* palette)
     cache = (byte*)d_pzbuffer + vid.width * vid.height * sizeof(*d_pzbuffer);
     D_InitCaches(cache, cachesize);
 
+    R_AllocScanTables(vid.width, vid.height);
+
+    VID_InitPresentThread();
+
     // initialize the mouse
     SDL_ShowCursor(0);
 }
 
 void VID_Shutdown(void)
 {
+    VID_WaitPresent();
+
     if (window) {
         SDL_DestroyWindow(window);
         window = NULL;
@@ -166,6 +498,10 @@ void VID_Update(vrect_t* rects)
     SDL_Rect* sdlrects;
     int n, i;
     vrect_t* rect;
+    qboolean threaded;
+    double time1;
+
+    time1 = Sys_FloatTime();
 
     // Two-pass system, since Quake doesn't do it the SDL way...
 
@@ -175,8 +511,36 @@ void VID_Update(vrect_t* rects)
         ++n;
     }
 
+    // the previous frame has to be out of the way before anything changes
+    VID_WaitPresent();
+
+    threaded = vid_canthread && vid_presentthread.value;
+    if (threaded != vid_threaded) {
+        // with two pages every change has to be drawn into both, and the
+        // other page missed everything drawn while it sat unused
+        vid_threaded = threaded;
+        vid.numpages = threaded ? 2 : 1;
+        vid.recalc_refdef = 1;
+    }
+
+    // nothing was drawn since the last present
+    if (!n && !vid_lutchanged) {
+        vid_updatetime += Sys_FloatTime() - time1;
+        return;
+    }
+
     // Second, copy them to SDL rectangles and update
-    if (!(sdlrects = (SDL_Rect*)alloca(n * sizeof(*sdlrects)))) {
+    if (threaded) {
+        if (n > vid_maxpresentrects) {
+            vid_maxpresentrects = n;
+            vid_presentrects = realloc(vid_presentrects, n * sizeof(*vid_presentrects));
+            if (!vid_presentrects) {
+                Sys_Error("Out of memory");
+            }
+        }
+
+        sdlrects = vid_presentrects;
+    } else if (!(sdlrects = (SDL_Rect*)alloca((n ? n : 1) * sizeof(*sdlrects)))) {
         Sys_Error("Out of memory");
     }
 
@@ -189,14 +553,19 @@ void VID_Update(vrect_t* rects)
         ++i;
     }
 
-    // If we're using our own 8-bit surface, we need to blit it to the window
-    SDL_Surface* window_surface = SDL_GetWindowSurface(window);
-    if (screen != window_surface) {
-        SDL_BlitSurface(screen, NULL, window_surface, NULL);
-        SDL_UpdateWindowSurfaceRects(window, sdlrects, n);
+    // only the rectangles that changed are converted
+    if (threaded) {
+        vid_presentsource = screen;
+        vid_numpresentrects = n;
+        vid_presentbusy = true;
+        SDL_SemPost(vid_presentstart);
+
+        VID_SetDrawPage(!vid_drawpage);
     } else {
-        SDL_UpdateWindowSurfaceRects(window, sdlrects, n);
+        VID_PresentNow(screen, sdlrects, n);
     }
+
+    vid_updatetime += Sys_FloatTime() - time1;
 }
 
 /*
@@ -212,6 +581,8 @@ void D_BeginDirectRect(int x, int y, byte* pbitmap, int width, int height)
         return;
     }
 
+    VID_WaitPresent();
+
     if (x < 0) {
         x = screen->w + x - 1;
     }
@@ -246,13 +617,7 @@ void D_EndDirectRect(int x, int y, int width, int height)
     rect.w = width;
     rect.h = height;
 
-    // If we're using our own 8-bit surface, we need to blit it to the window
-    SDL_Surface* window_surface = SDL_GetWindowSurface(window);
-    if (screen != window_surface) {
-        SDL_BlitSurface(screen, &rect, window_surface, &rect);
-    }
-
-    SDL_UpdateWindowSurfaceRects(window, &rect, 1);
+    VID_PresentNow(screen, &rect, 1);
 }
 
 /*
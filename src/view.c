@@ -1048,6 +1048,8 @@ void V_RenderView(void)
         R_RenderView();
     }
 
+    SCR_AddDirtyRect(scr_vrect.x, scr_vrect.y, scr_vrect.width, scr_vrect.height);
+
 #ifndef GLQUAKE
     if (crosshair.value) {
         Draw_Character(scr_vrect.x + scr_vrect.width / 2 + cl_crossx.value,
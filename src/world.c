@@ -240,11 +240,18 @@ SV_ClearWorld
 */
 void SV_ClearWorld(void)
 {
+    int i;
+
     SV_InitBoxHull();
 
     memset(sv_areanodes, 0, sizeof(sv_areanodes));
     sv_numareanodes = 0;
     SV_CreateAreaNode(0, sv.worldmodel->mins, sv.worldmodel->maxs);
+
+    sv.leafedicts = Hunk_AllocName(sv.worldmodel->numleafs * sizeof(*sv.leafedicts), "leafedicts");
+    for (i = 0; i < sv.worldmodel->numleafs; i++) {
+        ClearLink(&sv.leafedicts[i]);
+    }
 }
 
 /*
@@ -320,6 +327,8 @@ void SV_TouchLinks(edict_t* ent, areanode_t* node)
 ===============
 SV_FindTouchedLeafs
 
+Also links the edict into each leaf's list in sv.leafedicts, so the edicts in
+a pvs can be found without looking at all of them
 ===============
 */
 void SV_FindTouchedLeafs(edict_t* ent, mnode_t* node)
@@ -344,6 +353,7 @@ void SV_FindTouchedLeafs(edict_t* ent, mnode_t* node)
         leafnum = leaf - sv.worldmodel->leafs - 1;
 
         ent->leafnums[ent->num_leafs] = leafnum;
+        InsertLinkBefore(&ent->leaflinks[ent->num_leafs], &sv.leafedicts[leafnum]);
         ent->num_leafs++;
 
         return;
@@ -373,6 +383,7 @@ SV_LinkEdict
 void SV_LinkEdict(edict_t* ent, qboolean touch_triggers)
 {
     areanode_t* node;
+    int i;
 
     if (ent->area.prev) {
         SV_UnlinkEdict(ent); // unlink from old position
@@ -436,6 +447,10 @@ void SV_LinkEdict(edict_t* ent, qboolean touch_triggers)
     }
 
     // link to PVS leafs
+    for (i = 0; i < ent->num_leafs; i++) {
+        RemoveLink(&ent->leaflinks[i]);
+    }
+
     ent->num_leafs = 0;
     if (ent->v.modelindex) {
         SV_FindTouchedLeafs(ent, sv.worldmodel->nodes);